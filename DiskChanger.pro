@@ -1,4 +1,4 @@
-QT       += core gui
+QT       += core gui concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -8,16 +8,61 @@ CONFIG += c++17
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
-LIBS += -lparted
+# Log records below this level are compiled out (0 trace ... 5 critical, default 1 = debug)
+#DEFINES += LOG_COMPILE_LEVEL=2
+
+# Count operator new calls for the --stress report. Replaces the global
+# operator new, so keep it out of normal builds.
+#DEFINES += STRESS_COUNT_ALLOCATIONS
+
+LIBS += -lparted -lzstd -lext2fs -lcom_err -ludev
 
 SOURCES += \
+    checksum.cpp \
+    devicefilter.cpp \
     diskmanager.cpp \
+    diskmapbar.cpp \
+    freespacemap.cpp \
+    iostats.cpp \
+    kernelpartitions.cpp \
+    latencyheatmap.cpp \
+    layoutplanner.cpp \
+    logger.cpp \
     main.cpp \
-    mainwindow.cpp
+    mainwindow.cpp \
+    metrics.cpp \
+    partitionimage.cpp \
+    partitionverifier.cpp \
+    rescuescanner.cpp \
+    sparklinedelegate.cpp \
+    stressharness.cpp \
+    surfacescanner.cpp \
+    topologycache.cpp \
+    topologyexport.cpp \
+    topologyindex.cpp
 
 HEADERS += \
+    checksum.h \
+    devicefilter.h \
     diskmanager.h \
-    mainwindow.h
+    diskmapbar.h \
+    freespacemap.h \
+    iostats.h \
+    kernelpartitions.h \
+    latencyheatmap.h \
+    layoutplanner.h \
+    logger.h \
+    mainwindow.h \
+    metrics.h \
+    partitionimage.h \
+    partitionverifier.h \
+    rescuescanner.h \
+    sparklinedelegate.h \
+    stressharness.h \
+    surfacescanner.h \
+    topologycache.h \
+    topologyexport.h \
+    topologyindex.h
 
 FORMS += \
     mainwindow.ui
@@ -0,0 +1,196 @@
+#include "checksum.h"
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace {
+
+// Reflected Castagnoli polynomial
+const quint32 kCrc32cPolynomial = 0x82F63B78u;
+
+// Slicing-by-8 tables, built once on first use
+struct Crc32cTables {
+    quint32 table[8][256];
+
+    Crc32cTables() {
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 1) ? (crc >> 1) ^ kCrc32cPolynomial : (crc >> 1);
+            }
+            table[0][i] = crc;
+        }
+        for (quint32 i = 0; i < 256; ++i) {
+            for (int slice = 1; slice < 8; ++slice) {
+                table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+const Crc32cTables& tables() {
+    static const Crc32cTables instance;
+    return instance;
+}
+
+// Reflected IEEE polynomial
+const quint32 kCrc32Polynomial = 0xEDB88320u;
+
+struct Crc32Table {
+    quint32 table[256];
+
+    Crc32Table() {
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 1) ? (crc >> 1) ^ kCrc32Polynomial : (crc >> 1);
+            }
+            table[i] = crc;
+        }
+    }
+};
+
+#if defined(__x86_64__)
+// Bytes per stream in the interleaved loop
+const size_t kStreamBlock = 8192;
+
+// Operator that advances a raw crc register over kStreamBlock zero bytes,
+// split into four byte-indexed tables.
+struct Crc32cShiftTable {
+    quint32 table[4][256];
+
+    Crc32cShiftTable() {
+        const quint32 (*t)[256] = tables().table;
+        for (int k = 0; k < 4; ++k) {
+            for (quint32 b = 0; b < 256; ++b) {
+                quint32 x = b << (8 * k);
+                for (size_t n = 0; n < kStreamBlock; ++n) {
+                    x = (x >> 8) ^ t[0][x & 0xFF];
+                }
+                table[k][b] = x;
+            }
+        }
+    }
+};
+
+quint32 shiftBlock(quint32 crc) {
+    static const Crc32cShiftTable shift;
+    return shift.table[0][crc & 0xFF] ^ shift.table[1][(crc >> 8) & 0xFF] ^
+           shift.table[2][(crc >> 16) & 0xFF] ^ shift.table[3][crc >> 24];
+}
+
+// Three independent crc32 streams hide the 3 cycle latency of the instruction.
+// Each block is folded into the running crc with a zero-extension shift.
+__attribute__((target("sse4.2")))
+quint32 crc32cHardware(const void *data, size_t length, quint32 crc) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    quint64 c = ~crc;
+
+    while (length >= 8 && ((quintptr)p & 7) != 0) {
+        c = _mm_crc32_u8((quint32)c, *p++);
+        --length;
+    }
+
+    while (length >= 3 * kStreamBlock) {
+        quint64 c1 = 0;
+        quint64 c2 = 0;
+        const unsigned char *end = p + kStreamBlock;
+        while (p < end) {
+            quint64 w0, w1, w2;
+            memcpy(&w0, p, 8);
+            memcpy(&w1, p + kStreamBlock, 8);
+            memcpy(&w2, p + 2 * kStreamBlock, 8);
+            c = _mm_crc32_u64(c, w0);
+            c1 = _mm_crc32_u64(c1, w1);
+            c2 = _mm_crc32_u64(c2, w2);
+            p += 8;
+        }
+        c = shiftBlock((quint32)c) ^ (quint32)c1;
+        c = shiftBlock((quint32)c) ^ (quint32)c2;
+        p += 2 * kStreamBlock;
+        length -= 3 * kStreamBlock;
+    }
+
+    while (length >= 8) {
+        quint64 word;
+        memcpy(&word, p, 8);
+        c = _mm_crc32_u64(c, word);
+        p += 8;
+        length -= 8;
+    }
+
+    while (length--) {
+        c = _mm_crc32_u8((quint32)c, *p++);
+    }
+    return ~(quint32)c;
+}
+
+typedef quint32 (*Crc32cKernel)(const void *, size_t, quint32);
+
+Crc32cKernel selectKernel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        return crc32cHardware;
+    }
+    return Checksum::crc32cSoftware;
+}
+
+Crc32cKernel kernel() {
+    static const Crc32cKernel selected = selectKernel();
+    return selected;
+}
+#endif
+
+} // namespace
+
+quint32 Checksum::crc32c(const void *data, size_t length, quint32 crc) {
+#if defined(__x86_64__)
+    return kernel()(data, length, crc);
+#else
+    return crc32cSoftware(data, length, crc);
+#endif
+}
+
+const char *Checksum::crc32cImplementation() {
+#if defined(__x86_64__)
+    return kernel() == crc32cHardware ? "sse4.2" : "software";
+#else
+    return "software";
+#endif
+}
+
+quint32 Checksum::crc32cSoftware(const void *data, size_t length, quint32 crc) {
+    const quint32 (*t)[256] = tables().table;
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    crc = ~crc;
+
+    // Eight bytes per step (little-endian hosts)
+    while (length >= 8) {
+        quint32 low;
+        quint32 high;
+        memcpy(&low, p, 4);
+        memcpy(&high, p + 4, 4);
+        low ^= crc;
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+              t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+        p += 8;
+        length -= 8;
+    }
+
+    while (length--) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+    }
+
+    return ~crc;
+}
+
+quint32 Checksum::crc32(const void *data, size_t length, quint32 crc) {
+    static const Crc32Table ieee;
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    crc = ~crc;
+    while (length--) {
+        crc = (crc >> 8) ^ ieee.table[(crc ^ *p++) & 0xFF];
+    }
+    return ~crc;
+}
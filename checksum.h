@@ -0,0 +1,26 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <QtGlobal>
+#include <stddef.h>
+
+// CRC32C (Castagnoli) as used for chunk checksums in partition images and
+// verify digests. Pass the previous result as 'crc' to checksum data in
+// several pieces. Uses the SSE4.2 crc32 instruction when the CPU has it.
+namespace Checksum {
+
+quint32 crc32c(const void *data, size_t length, quint32 crc = 0);
+
+// Portable table driven version, also the fallback of crc32c()
+quint32 crc32cSoftware(const void *data, size_t length, quint32 crc = 0);
+
+// Name of the kernel crc32c() dispatches to ("sse4.2" or "software")
+const char *crc32cImplementation();
+
+// IEEE 802.3 CRC32 (zlib, GPT headers and partition entry arrays). Byte at a
+// time, meant for small on-disk structures rather than bulk data.
+quint32 crc32(const void *data, size_t length, quint32 crc = 0);
+
+} // namespace Checksum
+
+#endif // CHECKSUM_H
@@ -0,0 +1,229 @@
+#include "devicefilter.h"
+#include "logger.h"
+#include "metrics.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStandardPaths>
+#include <fnmatch.h>
+#include <algorithm>
+
+namespace {
+
+void setError(QString *error, const QString& message) {
+    if (error) *error = message;
+}
+
+QString readAttribute(const QString& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return QString();
+    return QString::fromUtf8(file.readAll()).trimmed();
+}
+
+QString deviceType(const QString& name, const QString& sysDir) {
+    if (name.startsWith("loop")) return "loop";
+    if (name.startsWith("zram")) return "zram";
+    if (name.startsWith("ram")) return "ram";
+    if (name.startsWith("dm-")) return "dm";
+    if (name.startsWith("md")) return "md";
+    if (name.startsWith("nbd")) return "nbd";
+    if (name.startsWith("nvme")) return "nvme";
+    if (name.startsWith("mmcblk")) return "mmc";
+    // SCSI peripheral type 5 is a CD/DVD drive
+    if (name.startsWith("sr") || readAttribute(sysDir + "/device/type") == "5") return "rom";
+    return "disk";
+}
+
+// The bus the disk hangs off, from where its sysfs directory sits in /sys/devices
+QString deviceTransport(const QString& sysDir) {
+    QString devicePath = QFileInfo(sysDir).canonicalFilePath();
+    if (devicePath.contains("/usb")) return "usb";
+    if (devicePath.contains("/nvme")) return "nvme";
+    if (devicePath.contains("/mmc_host/")) return "mmc";
+    if (devicePath.contains("/virtio")) return "virtio";
+    if (devicePath.contains("/ata")) return "sata";
+    if (devicePath.contains("/host")) return "scsi";
+    return "none";
+}
+
+QStringList listValue(const QSettings& settings, const QString& key) {
+    QStringList values;
+    for (const QString& value : settings.value(key).toStringList()) {
+        if (!value.trimmed().isEmpty()) values << value.trimmed();
+    }
+    return values;
+}
+
+int triStateValue(const QSettings& settings, const QString& key) {
+    if (!settings.contains(key)) return -1;
+    return settings.value(key).toBool() ? 1 : 0;
+}
+
+} // namespace
+
+bool DeviceFilterRule::matches(const BlockDeviceAttributes& device) const {
+    if (!types.isEmpty() && !types.contains(device.type, Qt::CaseInsensitive)) return false;
+    if (!transports.isEmpty() && !transports.contains(device.transport, Qt::CaseInsensitive)) return false;
+    if (!paths.isEmpty()) {
+        QByteArray path = device.path.toUtf8();
+        QByteArray node = ("/dev/" + device.name).toUtf8();
+        bool matched = std::any_of(paths.begin(), paths.end(), [&](const QString& glob) {
+            QByteArray pattern = glob.toUtf8();
+            return fnmatch(pattern.constData(), path.constData(), 0) == 0 ||
+                   fnmatch(pattern.constData(), node.constData(), 0) == 0;
+        });
+        if (!matched) return false;
+    }
+    if (minSize >= 0 && device.size < minSize) return false;
+    if (maxSize >= 0 && device.size > maxSize) return false;
+    if (readOnly >= 0 && device.readOnly != (readOnly == 1)) return false;
+    if (removable >= 0 && device.removable != (removable == 1)) return false;
+    return true;
+}
+
+QString DeviceFilterRule::describe() const {
+    QStringList conditions;
+    if (!types.isEmpty()) conditions << "type=" + types.join(',');
+    if (!paths.isEmpty()) conditions << "path=" + paths.join(',');
+    if (!transports.isEmpty()) conditions << "transport=" + transports.join(',');
+    if (minSize >= 0) conditions << QString("minSize=%1").arg(minSize);
+    if (maxSize >= 0) conditions << QString("maxSize=%1").arg(maxSize);
+    if (readOnly >= 0) conditions << QString("readOnly=%1").arg(readOnly ? "true" : "false");
+    if (removable >= 0) conditions << QString("removable=%1").arg(removable ? "true" : "false");
+    return QString("%1 %2").arg(include ? "include" : "exclude", conditions.join(' '));
+}
+
+DeviceFilter::DeviceFilter() {
+    DeviceFilterRule virtualDisks;
+    virtualDisks.types = QStringList{"ram", "zram", "rom", "dm"};
+    m_rules.push_back(virtualDisks);
+
+    DeviceFilterRule readOnly;
+    readOnly.readOnly = 1;
+    m_rules.push_back(readOnly);
+
+    DeviceFilterRule empty; // detached loop devices, card readers without a card
+    empty.maxSize = 0;
+    m_rules.push_back(empty);
+}
+
+QString DeviceFilter::defaultPath() {
+    QString path = qEnvironmentVariable("PARTED_EXPLORER_DEVICE_FILTER");
+    if (!path.isEmpty()) return path;
+    return QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation) + "/devicefilter.conf";
+}
+
+bool DeviceFilter::parseSize(const QString& text, qint64 *bytes) {
+    QString value = text.trimmed().toUpper();
+    if (value.endsWith('B')) value.chop(1);
+    qint64 multiplier = 1;
+    if (!value.isEmpty()) {
+        int shift = QString("KMGTP").indexOf(value.back()) + 1;
+        if (shift > 0) {
+            multiplier = 1LL << (10 * shift);
+            value.chop(1);
+        }
+    }
+    bool ok;
+    double number = value.trimmed().toDouble(&ok);
+    if (!ok || number < 0) return false;
+    *bytes = (qint64)(number * multiplier);
+    return true;
+}
+
+bool DeviceFilter::load(const QString& path, QString *error) {
+    if (!QFileInfo::exists(path)) return true;
+
+    QSettings settings(path, QSettings::IniFormat);
+    if (settings.status() != QSettings::NoError) {
+        setError(error, QString("Cannot read the device filter %1.").arg(path));
+        return false;
+    }
+
+    QString defaultAction = settings.value("default", "include").toString().trimmed();
+    if (defaultAction != "include" && defaultAction != "exclude") {
+        setError(error, QString("%1: default must be include or exclude, not '%2'.").arg(path, defaultAction));
+        return false;
+    }
+
+    std::vector<DeviceFilterRule> rules;
+    int count = settings.beginReadArray("rules");
+    for (int i = 0; i < count; ++i) {
+        settings.setArrayIndex(i);
+        DeviceFilterRule rule;
+        QString action = settings.value("action").toString().trimmed();
+        if (action != "include" && action != "exclude") {
+            setError(error, QString("%1: rule %2 needs action=include or action=exclude.").arg(path).arg(i + 1));
+            return false;
+        }
+        rule.include = action == "include";
+        rule.types = listValue(settings, "type");
+        rule.paths = listValue(settings, "path");
+        rule.transports = listValue(settings, "transport");
+        for (const QString& key : {QString("minSize"), QString("maxSize")}) {
+            if (!settings.contains(key)) continue;
+            qint64 bytes;
+            if (!parseSize(settings.value(key).toString(), &bytes)) {
+                setError(error, QString("%1: rule %2 has an invalid %3.").arg(path).arg(i + 1).arg(key));
+                return false;
+            }
+            (key == "minSize" ? rule.minSize : rule.maxSize) = bytes;
+        }
+        rule.readOnly = triStateValue(settings, "readOnly");
+        rule.removable = triStateValue(settings, "removable");
+        rules.push_back(rule);
+    }
+    settings.endArray();
+
+    m_rules = rules;
+    m_defaultInclude = defaultAction == "include";
+    return true;
+}
+
+bool DeviceFilter::accepts(const BlockDeviceAttributes& device, QString *reason) const {
+    for (const DeviceFilterRule& rule : m_rules) {
+        if (rule.matches(device)) {
+            if (reason) *reason = rule.describe();
+            return rule.include;
+        }
+    }
+    if (reason) *reason = m_defaultInclude ? "default include" : "default exclude";
+    return m_defaultInclude;
+}
+
+std::vector<BlockDeviceAttributes> DeviceFilter::scanSysfs(const QString& sysBlock) {
+    std::vector<BlockDeviceAttributes> devices;
+    // Only whole disks are listed here, partitions are subdirectories
+    for (const QString& name : QDir(sysBlock).entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name)) {
+        QString sysDir = sysBlock + "/" + name;
+        BlockDeviceAttributes device;
+        device.name = name;
+        device.type = deviceType(name, sysDir);
+        device.transport = deviceTransport(sysDir);
+        device.size = readAttribute(sysDir + "/size").toLongLong() * 512; // always 512 byte units
+        device.readOnly = readAttribute(sysDir + "/ro") == "1";
+        device.removable = readAttribute(sysDir + "/removable") == "1";
+
+        // libparted reports device-mapper nodes under their /dev/mapper name
+        QString mapperName = device.type == "dm" ? readAttribute(sysDir + "/dm/name") : QString();
+        device.path = mapperName.isEmpty() ? "/dev/" + name : "/dev/mapper/" + mapperName;
+        devices.push_back(device);
+    }
+    return devices;
+}
+
+QStringList DeviceFilter::acceptedDevicePaths() const {
+    Metrics::ScopedTrace trace("DeviceFilter::acceptedDevicePaths");
+    QStringList paths;
+    for (const BlockDeviceAttributes& device : scanSysfs()) {
+        QString reason;
+        if (accepts(device, &reason)) {
+            paths << device.path;
+        } else {
+            LOG_DEBUG("device-filter", device.path, QString("Skipped (%1, %2, %3 bytes): %4")
+                                                       .arg(device.type, device.transport).arg(device.size).arg(reason));
+        }
+    }
+    return paths;
+}
@@ -0,0 +1,84 @@
+#ifndef DEVICEFILTER_H
+#define DEVICEFILTER_H
+
+#include <QString>
+#include <QStringList>
+#include <QtGlobal>
+#include <vector>
+
+// Decides which block devices are worth opening with libparted, from
+// sysfs attributes alone, so excluded devices cost no I/O at all.
+//
+// Rules live in an INI file, $PARTED_EXPLORER_DEVICE_FILTER or
+// <config dir>/devicefilter.conf. They are checked in order, the first
+// rule whose conditions all match decides; without a match 'default'
+// applies. Without a file the built-in rules below are used.
+//
+//   [General]
+//   default=include
+//
+//   [rules]
+//   size=2
+//   1\action=exclude
+//   1\type=zram, ram, rom, dm       ; disk loop zram ram rom dm md nvme mmc nbd
+//   2\action=include
+//   2\path=/dev/sd*, /dev/nvme*     ; glob on /dev/<name>
+//   2\transport=sata, usb, nvme     ; sata scsi usb nvme mmc virtio, none for virtual devices
+//   2\minSize=1G                    ; bytes, K/M/G/T suffixes
+//   2\maxSize=16T
+//   2\readOnly=false
+//   2\removable=false
+
+// What sysfs tells about one entry of /sys/block
+struct BlockDeviceAttributes {
+    QString name;      // kernel name, e.g. sda, nvme0n1, loop3
+    QString path;      // node libparted opens, e.g. /dev/sda or /dev/mapper/vg-root
+    QString type;
+    QString transport; // 'none' for virtual devices
+    qint64 size = 0;   // bytes, 0 for detached loop devices and empty card readers
+    bool readOnly = false;
+    bool removable = false;
+};
+
+struct DeviceFilterRule {
+    bool include = false;
+    QStringList types;
+    QStringList paths;      // globs
+    QStringList transports;
+    qint64 minSize = -1;    // -1 = no bound
+    qint64 maxSize = -1;
+    int readOnly = -1;      // -1 = any, 0 = false, 1 = true
+    int removable = -1;
+
+    bool matches(const BlockDeviceAttributes& device) const;
+    QString describe() const;
+};
+
+class DeviceFilter {
+public:
+    // Built-in rules: skip RAM disks, zram, optical drives, device-mapper
+    // nodes, read-only devices and devices of size 0 (detached loops);
+    // everything else, attached loop devices included, is listed.
+    DeviceFilter();
+
+    static QString defaultPath();
+
+    // A missing file keeps the built-in rules and is not an error
+    bool load(const QString& path, QString *error);
+
+    bool accepts(const BlockDeviceAttributes& device, QString *reason = nullptr) const;
+
+    // Every whole-disk entry of /sys/block, sorted by name
+    static std::vector<BlockDeviceAttributes> scanSysfs(const QString& sysBlock = "/sys/block");
+
+    // Paths of the accepted devices; excluded ones are logged at debug level
+    QStringList acceptedDevicePaths() const;
+
+    static bool parseSize(const QString& text, qint64 *bytes);
+
+private:
+    std::vector<DeviceFilterRule> m_rules;
+    bool m_defaultInclude = true;
+};
+
+#endif // DEVICEFILTER_H
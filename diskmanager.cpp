@@ -1,15 +1,25 @@
 #include "diskmanager.h"
+#include "devicefilter.h"
+#include "logger.h"
+#include "metrics.h"
+#include "partitionverifier.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <mntent.h>
 #include <ext2fs/ext2_fs.h>
 #include <ext2fs/ext2fs.h>
 #include <uuid/uuid.h>
-#include <iostream>
-#include <QDebug>
 #include <QProcess>
 #include <QMessageBox>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QMap>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QFuture>
+#include <QtConcurrent>
 
 
 
@@ -23,7 +33,7 @@ DiskManager::~DiskManager() {
 }
 
 PedExceptionOption DiskManager::exceptionHandler(PedException *exception) {
-    qCritical() << "libparted Exception:" << exception->message;
+    LOG_ERROR("libparted", QString(), QString::fromUtf8(exception->message));
     // QMessageBox msgBox;
     // msgBox.setWindowTitle("Libparted Exception");
     // msgBox.setText("libparted Exception:" + QString::fromUtf8(exception->message));
@@ -73,67 +83,113 @@ PedExceptionOption DiskManager::exceptionHandler(PedException *exception) {
 
 
 std::vector<DeviceInfo> DiskManager::listAllDevices() {
+    Metrics::ScopedTrace trace("DiskManager::listAllDevices");
     std::vector<DeviceInfo> devicesList;
-    ped_device_probe_all();
+    for (const QString& path : listDevicePaths()) {
+        PedDevice *device = lookupDevice(path);
+        if (device) {
+            devicesList.push_back(scanDevice(device));
+        }
+    }
+
+    return devicesList;
+}
+
+QStringList DiskManager::listDevicePaths() {
+    // Decided from sysfs alone: libparted only opens what the filter accepts,
+    // instead of ped_device_probe_all() opening every block device
+    DeviceFilter filter;
+    QString error;
+    if (!filter.load(DeviceFilter::defaultPath(), &error)) {
+        LOG_WARNING("device-filter", QString(), error + " Using the built-in rules.");
+    }
+    QStringList paths = filter.acceptedDevicePaths();
 
+    // Image files opened explicitly are not in sysfs
     PedDevice *device = nullptr;
-    //"/dev/loop0" is used for safe testing only
-    const char* loop_device_path = "/dev/loop0";
-    PedDevice* loop_dev = ped_device_get(loop_device_path);
     while ((device = ped_device_get_next(device)) != nullptr) {
-        // Skip busy devices for listing to avoid issues
-        //if (ped_device_is_busy(device)) continue; // we dont use it for tests on /dev/loop0
-
-        DeviceInfo info;
-        info.model = QString::fromUtf8(device->model);
-        info.path = QString::fromUtf8(device->path);
-        info.size = device->length * device->sector_size;
-
-        PedDisk *disk = ped_disk_new(device);
-        if (disk) {
-            PedPartition *partition = nullptr;
-            while ((partition = ped_disk_next_partition(disk, partition)) != nullptr) {
-                // Include free space partitions for operation targeting
-                 if (!ped_partition_is_active(partition) && !(partition->type & PED_PARTITION_FREESPACE)) {
-                     continue;
-                 }
-
-                PartitionInfo pInfo;
-                pInfo.number = partition->num;
-                pInfo.type = QString::fromUtf8(ped_partition_type_get_name(partition->type));
-                pInfo.isFreeSpace = (partition->type & PED_PARTITION_FREESPACE);
-                pInfo.start = (long long)partition->geom.start * (long long)device->sector_size;
-                pInfo.end = (long long)partition->geom.end * (long long)device->sector_size;
-                pInfo.size = pInfo.end - pInfo.start;
-                // Check if fs_type pointer is valid, then access its internal 'name' field
-                pInfo.fileSystem = (partition->fs_type)
-                                       ? QString::fromUtf8(partition->fs_type->name)
-                                       : "Unknown/None";
-
-                // --- FIX: Use ped_file_system_probe instead of partition->fs ---
-                const PedFileSystemType *fs_type = ped_file_system_probe(&(partition->geom));
-                if (fs_type) {
-                    //const char* fs_name = ped_file_system_type_get_name(fs_type);
-                    const char* fs_name = fs_type->name;
-                    pInfo.fileSystem = QString::fromUtf8(fs_name);
-                } else {
-                    pInfo.fileSystem = "Unknown/None";
-                }
-                // ---------------------------------------------------------------
-                //qDebug() << "###info.path: "  << info.path;
-                pInfo.flags = getPartitionFlags(partition);
-                pInfo.devicePath = info.path;
+        if (device->type == PED_DEVICE_FILE) {
+            paths << QString::fromUtf8(device->path);
+        }
+    }
+    return paths;
+}
 
+DeviceInfo DiskManager::scanDevice(const QString& devicePath, bool *found) {
+    Metrics::ScopedTrace trace("DiskManager::scanDevice", devicePath);
+    PedDevice *device = lookupDevice(devicePath);
+    if (found) *found = device != nullptr;
+    if (!device) {
+        DeviceInfo missing;
+        missing.path = devicePath;
+        missing.size = 0;
+        return missing;
+    }
+    return scanDevice(device);
+}
 
-                info.partitions.push_back(pInfo);
+DeviceInfo DiskManager::scanDevice(PedDevice *device) {
+    DeviceInfo info;
+    info.model = QString::fromUtf8(device->model);
+    info.path = QString::fromUtf8(device->path);
+    info.size = device->length * device->sector_size;
+    info.sectorSize = device->sector_size;
+    info.lengthSectors = device->length;
+    PedSector alignOffset = 0;
+    info.alignmentBytes = LayoutPlanner::alignmentGrain(device, &alignOffset) * device->sector_size;
+    info.alignmentOffsetBytes = alignOffset * device->sector_size;
+
+    PedDisk *disk = Metrics::traced("ped_disk_new", info.path, [&] { return ped_disk_new(device); });
+    if (disk) {
+        PedPartition *partition = nullptr;
+        while ((partition = ped_disk_next_partition(disk, partition)) != nullptr) {
+            // Include free space partitions for operation targeting
+             if (!ped_partition_is_active(partition) && !(partition->type & PED_PARTITION_FREESPACE)) {
+                 continue;
+             }
+
+            PartitionInfo pInfo;
+            pInfo.number = partition->num;
+            pInfo.type = QString::fromUtf8(ped_partition_type_get_name(partition->type));
+            pInfo.isFreeSpace = (partition->type & PED_PARTITION_FREESPACE);
+            pInfo.isExtendedContainer = (partition->type & PED_PARTITION_EXTENDED);
+            pInfo.isLogical = (partition->type & PED_PARTITION_LOGICAL);
+            pInfo.startSector = partition->geom.start;
+            pInfo.endSector = partition->geom.end;
+            pInfo.start = (long long)partition->geom.start * (long long)device->sector_size;
+            pInfo.end = (long long)partition->geom.end * (long long)device->sector_size;
+            pInfo.size = pInfo.end - pInfo.start;
+            // Check if fs_type pointer is valid, then access its internal 'name' field
+            pInfo.fileSystem = (partition->fs_type)
+                                   ? QString::fromUtf8(partition->fs_type->name)
+                                   : "Unknown/None";
+
+            // --- FIX: Use ped_file_system_probe instead of partition->fs ---
+            // Reads the start of the partition, one of the slower steps of a scan
+            const PedFileSystemType *fs_type = nullptr;
+            if (!(partition->type & PED_PARTITION_FREESPACE)) {
+                fs_type = Metrics::traced("ped_file_system_probe", info.path,
+                                          [&] { return ped_file_system_probe(&(partition->geom)); });
             }
-            ped_disk_destroy(disk);
-            //ped_device_close(device);
+            if (fs_type) {
+                //const char* fs_name = ped_file_system_type_get_name(fs_type);
+                const char* fs_name = fs_type->name;
+                pInfo.fileSystem = QString::fromUtf8(fs_name);
+            } else {
+                pInfo.fileSystem = "Unknown/None";
+            }
+            // ---------------------------------------------------------------
+            //qDebug() << "###info.path: "  << info.path;
+            pInfo.flags = getPartitionFlags(partition);
+            pInfo.devicePath = info.path;
+
+
+            info.partitions.push_back(pInfo);
         }
-        devicesList.push_back(info);
+        ped_disk_destroy(disk);
+        //ped_device_close(device);
     }
-
-    return devicesList;
+    return info;
 }
 
 
@@ -144,8 +200,9 @@ QString DiskManager::getPartitionFlags(PedPartition *partition) {
         return flags; // Handle null pointer
     }
 
+    // Runs for every row of every scan, so these are trace records (compiled out by default)
     if (partition->type & PED_PARTITION_FREESPACE) {
-        qDebug() << "Error: Partition is not active because there is Free space.";
+        LOG_TRACE("flags", QString::fromUtf8(partition->disk->dev->path), "Free space has no flags.");
         // Free space is a "type", but usually not what we consider an "active partition"
         // Return true/false based on your specific requirements (usually false for operations)
          return flags;
@@ -153,7 +210,7 @@ QString DiskManager::getPartitionFlags(PedPartition *partition) {
 
     // This is the critical check that matches the assertion failure:
     if (!ped_partition_is_active(partition)) {
-        qDebug() << "Error: Partition is not active (parent disk context lost?).";
+        LOG_TRACE("flags", QString::fromUtf8(partition->disk->dev->path), "Partition is not active (metadata or lost disk context).");
         return flags;
     }
 
@@ -190,25 +247,27 @@ QString DiskManager::getPartitionFlags(PedPartition *partition) {
 // --- Disk Operations ---
 
 bool DiskManager::createPartition(const QString& devicePath, long long startBytes, long long endBytes, const QString& fsType,  const QString& PartitionType) {
+    Metrics::ScopedTrace trace("DiskManager::createPartition", devicePath, false);
     PedDevice *dev = ped_device_get(devicePath.toUtf8().constData());
     if (!dev) return false;
 
-    PedDisk *disk = ped_disk_new(dev);
+    PedDisk *disk = Metrics::traced("ped_disk_new", devicePath, [&] { return ped_disk_new(dev); });
     if (!disk) {
         ped_device_close(dev);
         return false;
     }
+    std::vector<KernelPartitions::Partition> before = kernelPartitions(disk);
 
     // Ensure startBytes < endBytes in your calling logic!
     // E.g., if you have 10GB free, startBytes might be 0 (of free space) and endBytes 10000.
 
     PedSector startSector = (startBytes * 1024 * 1024 / dev->sector_size);
     PedSector endSector = endBytes *  1024 * 1024 / dev->sector_size;
-    qDebug() << "startSector:  " << startSector << "endSector:  " << endSector;
+    LOG_DEBUG("create", devicePath, QString("startSector %1 endSector %2").arg(startSector).arg(endSector));
 
 
     if (endSector <= startSector) {
-        qDebug() << "Invalid partition size or end sector calculation.";
+        LOG_ERROR("create", devicePath, "Invalid partition size or end sector calculation.");
         // Clean up disk object before returning
         ped_disk_destroy(disk);
         return false;
@@ -230,7 +289,7 @@ bool DiskManager::createPartition(const QString& devicePath, long long startByte
         type = PED_PARTITION_LOGICAL;
         }
     else{
-        qDebug() << "Invalid Partition Type specified: " << PartitionType;
+        LOG_ERROR("create", devicePath, QString("Invalid partition type specified: %1").arg(PartitionType));
         return false; // Error handling
         }
 
@@ -239,55 +298,43 @@ bool DiskManager::createPartition(const QString& devicePath, long long startByte
     PedPartition *newPartition = ped_partition_new(disk, type, fsTypePtr, startSector, endSector);
 
     if (!newPartition) {
-        qDebug() << "Failed to create new partition object (likely alignment or space issue).";
+        LOG_ERROR("create", devicePath, "Failed to create new partition object (likely alignment or space issue).");
         ped_constraint_destroy(constraint);
         ped_disk_destroy(disk);
         return false;
     }
 
-    qDebug() << "New Partition Num: " << newPartition->num;
+    LOG_DEBUG("create", devicePath, QString("New partition number %1").arg(newPartition->num));
     //qDebug() << "Actual Start: " << newPartition->start << " Actual End: " << newPartition->end;
 
     // ped_disk_add_partition returns 0 on failure
     if (!ped_disk_add_partition(disk, newPartition, constraint)) {
-        qDebug() << "Failed to add partition to disk structure.";
+        LOG_ERROR("create", devicePath, "Failed to add partition to disk structure.");
         ped_constraint_destroy(constraint);
         ped_disk_destroy(disk);
         return false;
     }
 
-    // ped_disk_commit returns 0 on failure
-    bool success = ped_disk_commit(disk);
+    // Write the table and announce the new partition (and any logical
+    // partitions renumbered behind it) to the kernel
+    bool success = commitPartitionChanges(disk, before);
     if (!success) {
-        qDebug() << "Failed to commit changes to disk. The libparted exception likely occurred here.";
+        LOG_ERROR("create", devicePath, "Failed to commit changes to disk, see the libparted record before this one.");
     }
 
     if (success) {
         // After committing, you might want to format the filesystem (e.g., using mkfs external process)
-        qDebug() << "Partition created successfully. Committing changes.";
+        LOG_INFO("create", devicePath, QString("Partition %1 created.").arg(newPartition->num));
 
         // Example using QProcess to run mkfs.ext4 (for Linux systems):
 
-        //1. Determine the device path of the new partition (e.g. /dev/sda1, /dev/nvme0n1p3)
-        //You can use newPartition->num for this, appending it to the base devicePath
-        //we use + "p" only for /dev/loop0p1 as a test partition
-        QString newPartPath;
-        if(devicePath == "/dev/loop0"){
-            newPartPath = devicePath + "p" + QString::number(newPartition->num); // <------- it's only for test
-        } else {
-
-            newPartPath = devicePath + QString::number(newPartition->num);
-        }
+        //1. Determine the device path of the new partition (e.g. /dev/sda1, /dev/nvme0n1p3, /dev/loop0p1)
+        QString newPartPath = partitionPath(newPartition);
 
         // 2. Execute the mkfs command
-        if (fsType == "ext4" && fsTypePtr != NULL) {
-            QProcess::execute("mkfs.ext4", QStringList() << newPartPath);
-        } else if (fsType == "ntfs" && fsTypePtr != NULL) {
-            QProcess::execute("mkfs.ntfs", QStringList() << newPartPath);
-        } else if (fsType == "xfs" && fsTypePtr != NULL) {
-            QProcess::execute("mkfs.xfs", QStringList() << newPartPath);
+        if (fsTypePtr != NULL) {
+            formatPartition(newPartPath, fsType);
         }
-        qDebug() << "Filesystem formatting command executed. Check system logs for final status.";
         // ... handle other fsTypes
         // --- Call the C library function instead of QProcess ---
         // if (format_ext4_library(newPartPath.toUtf8().constData())) {
@@ -303,20 +350,96 @@ bool DiskManager::createPartition(const QString& devicePath, long long startByte
     ped_disk_destroy(disk);
     //ped_device_close(dev);
     close_my_device();
-    return success;
+    return trace.finish(success);
     } else {
-        qDebug() << "Failed to create partition.";
+        LOG_ERROR("create", devicePath, "Failed to create partition.");
         ped_disk_delete_all(disk); // Cleanup if commit fails
+        ped_constraint_destroy(constraint);
+        ped_disk_destroy(disk);
+        return trace.finish(false);
+    }
+}
+
+bool DiskManager::recreatePartition(const QString& devicePath, long long startSector, long long endSector,
+                                    const QString& fsType, PedPartitionType type, const QString& name, const QString& labelType) {
+    Metrics::ScopedTrace trace("DiskManager::recreatePartition", devicePath, false);
+    PedDevice *dev = lookupDevice(devicePath);
+    if (!dev) return false;
+    if (endSector <= startSector || endSector >= dev->length) {
+        LOG_ERROR("recreate", devicePath, QString("Sectors %1-%2 are outside the device.").arg(startSector).arg(endSector));
+        return false;
+    }
+
+    bool freshLabel = false;
+    std::vector<KernelPartitions::Partition> before;
+    PedDisk *disk = Metrics::traced("ped_disk_new", devicePath, [&] { return ped_disk_new(dev); });
+    if (disk) {
+        before = kernelPartitions(disk);
+    } else {
+        const PedDiskType *diskType = ped_disk_type_get(labelType.toUtf8().constData());
+        if (!diskType) {
+            LOG_ERROR("recreate", devicePath, QString("Unknown disk label type %1").arg(labelType));
+            return false;
+        }
+        // Only the label sectors are written, the partition contents stay where they are
+        LOG_WARNING("recreate", devicePath, QString("No readable partition table, writing a fresh %1 label.").arg(labelType));
+        disk = ped_disk_new_fresh(dev, diskType);
+        freshLabel = true;
+        if (!disk) {
+            LOG_ERROR("recreate", devicePath, QString("Failed to create a fresh %1 label.").arg(labelType));
+            return false;
+        }
+    }
+
+    if (type == PED_PARTITION_LOGICAL && !ped_disk_extended_partition(disk)) {
+        LOG_ERROR("recreate", devicePath, "A logical partition needs an extended partition around it, create that first.");
+        ped_disk_destroy(disk);
+        return false;
+    }
+
+    const PedFileSystemType *fsTypePtr = fsType.isEmpty() || type == PED_PARTITION_EXTENDED
+                                             ? NULL : ped_file_system_type_get(fsType.toUtf8().constData());
+    PedPartition *partition = ped_partition_new(disk, type, fsTypePtr, startSector, endSector);
+    if (!partition) {
+        LOG_ERROR("recreate", devicePath, "Failed to create new partition object.");
+        ped_disk_destroy(disk);
+        return false;
+    }
+
+    // Exactly where the data is: no alignment, no rounding
+    PedConstraint *constraint = ped_constraint_exact(&partition->geom);
+    bool added = ped_disk_add_partition(disk, partition, constraint);
+    ped_constraint_destroy(constraint);
+    if (!added) {
+        LOG_ERROR("recreate", devicePath, QString("Sectors %1-%2 overlap an existing partition.").arg(startSector).arg(endSector));
+        ped_partition_destroy(partition);
+        ped_disk_destroy(disk);
+        return false;
     }
 
+    if (!name.isEmpty() && type != PED_PARTITION_EXTENDED && ped_disk_type_check_feature(disk->type, PED_DISK_TYPE_PARTITION_NAME)) {
+        ped_partition_set_name(partition, name.toUtf8().constData());
+    }
 
+    bool success = freshLabel ? Metrics::traced("ped_disk_commit", devicePath, [&] { return ped_disk_commit(disk); })
+                              : commitPartitionChanges(disk, before);
+    if (success) {
+        LOG_INFO("recreate", devicePath, QString("Partition %1 recreated at sectors %2-%3 (%4).")
+                                             .arg(partition->num).arg(startSector).arg(endSector)
+                                             .arg(fsType.isEmpty() ? "unknown file system" : fsType));
+    } else {
+        LOG_ERROR("recreate", devicePath, "Failed to commit changes to disk, see the libparted record before this one.");
+    }
+    ped_disk_destroy(disk);
+    return trace.finish(success);
 }
 
 bool DiskManager::deletePartition(const QString& devicePath, int partitionNumber) {
+    Metrics::ScopedTrace trace("DiskManager::deletePartition", devicePath, false);
     PedDevice *dev = ped_device_get(devicePath.toUtf8().constData());
     if (!dev) return false;
 
-    PedDisk *disk = ped_disk_new(dev);
+    PedDisk *disk = Metrics::traced("ped_disk_new", devicePath, [&] { return ped_disk_new(dev); });
     if (!disk) {
         ped_device_close(dev);
         return false;
@@ -325,7 +448,7 @@ bool DiskManager::deletePartition(const QString& devicePath, int partitionNumber
     // Find the partition by number
     PedPartition *part = ped_disk_get_partition(disk, partitionNumber);
     if (!part || (part->type & PED_PARTITION_FREESPACE)) {
-        qDebug() << "Partition not found or is free space.";
+        LOG_ERROR("delete", devicePath, QString("Partition %1 not found or is free space.").arg(partitionNumber));
         ped_disk_destroy(disk);
         ped_device_close(dev);
         return false;
@@ -333,41 +456,43 @@ bool DiskManager::deletePartition(const QString& devicePath, int partitionNumber
 
     // Check if partition is busy
     if(ped_partition_is_busy(part)){
-        qDebug() << "Partition is busy (mounted). Cannot delete.";
+        LOG_ERROR("delete", devicePath, QString("Partition %1 is busy (mounted), cannot delete.").arg(partitionNumber));
         ped_disk_destroy(disk);
         ped_device_close(dev);
         return false;
     }
 
-    bool success = ped_disk_delete_partition(disk, part) && ped_disk_commit(disk);
+    // Captured before libparted frees the partition and renumbers the rest
+    std::vector<KernelPartitions::Partition> before = kernelPartitions(disk);
+    bool success = ped_disk_delete_partition(disk, part) && commitPartitionChanges(disk, before);
 
     if (success) {
-        qDebug() << "Partition deleted successfully. Committing changes.";
+        LOG_INFO("delete", devicePath, QString("Partition %1 deleted.").arg(partitionNumber));
     } else {
-        qDebug() << "Failed to delete partition.";
-        ped_disk_destroy(disk); // Cleanup if commit fails
+        LOG_ERROR("delete", devicePath, QString("Failed to delete partition %1.").arg(partitionNumber));
     }
 
     ped_disk_destroy(disk);
     //ped_device_close(dev);
     close_my_device();
-    return success;
+    return trace.finish(success);
 }
 
 
 
 bool DiskManager::resizePartition(const QString& devicePath, int partitionNumber, long long newEndMBytes) {
+    Metrics::ScopedTrace trace("DiskManager::resizePartition", devicePath, false);
     // libparted works with device names like "/dev/sda"
     PedDevice *dev = ped_device_get(devicePath.toUtf8().constData());
     if (!dev) {
-        qDebug() << "Failed to get device" << devicePath;
+        LOG_ERROR("resize", devicePath, "Failed to get device.");
         return false;
     }
 
     // Attempt to read the disk's partition table
-    PedDisk *disk = ped_disk_new(dev);
+    PedDisk *disk = Metrics::traced("ped_disk_new", devicePath, [&] { return ped_disk_new(dev); });
     if (!disk) {
-        qDebug() << "Failed to read partition table for" << devicePath;
+        LOG_ERROR("resize", devicePath, "Failed to read partition table.");
         ped_device_close(dev);
         return false;
     }
@@ -375,7 +500,7 @@ bool DiskManager::resizePartition(const QString& devicePath, int partitionNumber
     // Get the partition by its number (1-based index typically)
     PedPartition *part = ped_disk_get_partition(disk, partitionNumber);
     if (!part || (part->type & PED_PARTITION_FREESPACE)) {
-        qDebug() << "Partition not found or is free space.";
+        LOG_ERROR("resize", devicePath, QString("Partition %1 not found or is free space.").arg(partitionNumber));
         ped_disk_destroy(disk);
         ped_device_close(dev);
         return false;
@@ -388,16 +513,18 @@ bool DiskManager::resizePartition(const QString& devicePath, int partitionNumber
     //     return false;
     // }
 
+    std::vector<KernelPartitions::Partition> before = kernelPartitions(disk);
+
     // Calculate the new end sector based on the new end bytes and device sector size
     PedSector newEndSector = newEndMBytes * 1024 * 1024 / dev->sector_size;
-    qDebug() << "newEndSector:  " << newEndSector;
+    LOG_DEBUG("resize", devicePath, QString("newEndSector %1").arg(newEndSector));
     // --- Correct approach for resizing ---
 
     // 1. Define a constraint. Using ped_constraint_any ensures maximum compatibility,
     //    but for optimal alignment (e.g., SSDs), you might want a specific constraint.
     PedConstraint *constraint = ped_constraint_any(dev);
     if (!constraint) {
-        qDebug() << "Failed to create partition constraint.";
+        LOG_ERROR("resize", devicePath, "Failed to create partition constraint.");
         ped_disk_destroy(disk);
         ped_device_close(dev);
         return false;
@@ -416,16 +543,16 @@ bool DiskManager::resizePartition(const QString& devicePath, int partitionNumber
     // but the PedDiskSetPartitionGeom uses the end sector directly.
 
     if (success) {
-        qDebug() << "Partition geometry updated in memory.";
+        LOG_DEBUG("resize", devicePath, "Partition geometry updated in memory.");
         // Commit changes to disk
-        if (!ped_disk_commit(disk)) {
-            qDebug() << "Failed to commit partition changes to disk.";
+        if (!commitPartitionChanges(disk, before)) {
+            LOG_ERROR("resize", devicePath, "Failed to commit partition changes to disk.");
             success = false;
         } else {
-            qDebug() << "Partition resized successfully (geometry).";
+            LOG_INFO("resize", devicePath, QString("Partition %1 resized (geometry).").arg(partitionNumber));
         }
     } else {
-        qDebug() << "Failed to resize partition geometry (check constraints/validity).";
+        LOG_ERROR("resize", devicePath, "Failed to resize partition geometry (check constraints/validity).");
     }
 
     // Clean up
@@ -436,8 +563,453 @@ bool DiskManager::resizePartition(const QString& devicePath, int partitionNumber
     close_my_device();
     // Remember to resize the filesystem inside the partition using external tools after this.
 
-    return success;
+    return trace.finish(success);
+}
+bool DiskManager::applyLayout(const LayoutPlan& plan, bool format) {
+    Metrics::ScopedTrace trace("DiskManager::applyLayout", plan.devicePath, false);
+    if (!plan.isValid()) {
+        LOG_ERROR("apply-layout", plan.devicePath, QString("Refusing to apply an invalid layout: %1").arg(plan.error));
+        return false;
+    }
+
+    PedDevice *dev = lookupDevice(plan.devicePath);
+    if (!dev) {
+        LOG_ERROR("apply-layout", plan.devicePath, "Failed to get device.");
+        return false;
+    }
+    QString busy = busyReason(dev);
+    if (!busy.isEmpty()) {
+        LOG_ERROR("apply-layout", plan.devicePath, busy + " Refusing to write a new label.");
+        return false;
+    }
+
+    // What the kernel knows now, so the commit can drop the old partitions
+    // and add the new ones without a full table re-read
+    std::vector<KernelPartitions::Partition> before;
+    if (PedDisk *current = Metrics::traced("ped_disk_new", plan.devicePath, [&] { return ped_disk_new(dev); })) {
+        before = kernelPartitions(current);
+        ped_disk_destroy(current);
+    }
+
+    std::vector<std::pair<PedPartition*, QString>> toFormat;
+    PedDisk *disk = buildLayout(plan, format ? &toFormat : nullptr);
+    if (!disk) return false;
+
+    // One commit for the whole layout
+    PartitionVerifier::markDeviceWritten(plan.devicePath);
+    bool success = commitPartitionChanges(disk, before);
+    if (success) {
+        LOG_INFO("apply-layout", plan.devicePath, QString("Layout committed with %1 partitions.").arg(plan.partitions.size()));
+        for (const auto& entry : toFormat) {
+            formatPartition(partitionPath(entry.first), entry.second);
+        }
+    } else {
+        LOG_ERROR("apply-layout", plan.devicePath, "Failed to commit layout.");
+    }
+
+    ped_disk_destroy(disk);
+    return trace.finish(success);
 }
+
+PedDisk* DiskManager::buildLayout(const LayoutPlan& plan, std::vector<std::pair<PedPartition*, QString>> *toFormat) {
+    PedDevice *dev = lookupDevice(plan.devicePath);
+    if (!dev) {
+        LOG_ERROR("apply-layout", plan.devicePath, "Failed to get device.");
+        return nullptr;
+    }
+
+    // The plan is expressed in sectors, it must have been solved for this device
+    if (dev->sector_size != plan.sectorSize) {
+        LOG_ERROR("apply-layout", plan.devicePath,
+                  QString("Layout was planned for %1 byte sectors, device uses %2.").arg(plan.sectorSize).arg(dev->sector_size));
+        return nullptr;
+    }
+
+    const PedDiskType *diskType = ped_disk_type_get(plan.labelType.toUtf8().constData());
+    if (!diskType) {
+        LOG_ERROR("apply-layout", plan.devicePath, QString("Unknown disk label type %1").arg(plan.labelType));
+        return nullptr;
+    }
+
+    // Start from an empty table, nothing is written until the caller commits
+    PedDisk *disk = ped_disk_new_fresh(dev, diskType);
+    if (!disk) {
+        LOG_ERROR("apply-layout", plan.devicePath, QString("Failed to create a fresh %1 label.").arg(plan.labelType));
+        return nullptr;
+    }
+
+    bool canName = ped_disk_type_check_feature(diskType, PED_DISK_TYPE_PARTITION_NAME);
+
+    for (const PlannedPartition& planned : plan.partitions) {
+        const PedFileSystemType *fsTypePtr = NULL;
+        if (planned.type != PED_PARTITION_EXTENDED && !planned.fileSystem.isEmpty()) {
+            fsTypePtr = ped_file_system_type_get(planned.fileSystem.toUtf8().constData());
+        }
+
+        PedPartition *part = ped_partition_new(disk, planned.type, fsTypePtr, planned.start, planned.end);
+        if (!part) {
+            LOG_ERROR("apply-layout", plan.devicePath, QString("Failed to create partition object for %1").arg(planned.name));
+            ped_disk_destroy(disk);
+            return nullptr;
+        }
+
+        // The planner already solved alignment, so pin the exact geometry
+        PedConstraint *constraint = ped_constraint_exact(&part->geom);
+        bool added = constraint && ped_disk_add_partition(disk, part, constraint);
+        if (constraint) ped_constraint_destroy(constraint);
+        if (!added) {
+            LOG_ERROR("apply-layout", plan.devicePath,
+                      QString("Failed to add %1 at sectors %2-%3").arg(planned.name).arg(planned.start).arg(planned.end));
+            ped_partition_destroy(part);
+            ped_disk_destroy(disk);
+            return nullptr;
+        }
+
+        if (canName && planned.type != PED_PARTITION_EXTENDED) {
+            ped_partition_set_name(part, planned.name.toUtf8().constData());
+        }
+
+        for (const QString& flagName : planned.flags) {
+            PedPartitionFlag flag = ped_partition_flag_get_by_name(flagName.toUtf8().constData());
+            if (flag && ped_partition_is_flag_available(part, flag)) {
+                ped_partition_set_flag(part, flag, 1);
+            } else {
+                LOG_WARNING("apply-layout", plan.devicePath,
+                            QString("Flag %1 is not available on a %2 label, skipped.").arg(flagName, plan.labelType));
+            }
+        }
+
+        if (toFormat && fsTypePtr != NULL) {
+            toFormat->push_back(std::make_pair(part, planned.fileSystem));
+        }
+    }
+    return disk;
+}
+
+LayoutPlan DiskManager::readLayout(const QString& devicePath) {
+    Metrics::ScopedTrace trace("DiskManager::readLayout", devicePath);
+    LayoutPlan layout;
+    layout.devicePath = devicePath;
+
+    PedDevice *dev = lookupDevice(devicePath);
+    if (!dev) {
+        layout.error = QString("Device %1 not found.").arg(devicePath);
+        return layout;
+    }
+    layout.sectorSize = dev->sector_size;
+    layout.lengthSectors = dev->length;
+    layout.grainSectors = LayoutPlanner::alignmentGrain(dev, &layout.alignOffset);
+
+    PedDisk *disk = Metrics::traced("ped_disk_new", devicePath, [&] { return ped_disk_new(dev); });
+    if (!disk) {
+        layout.error = QString("Device %1 has no readable partition table.").arg(devicePath);
+        return layout;
+    }
+    layout.labelType = QString::fromUtf8(disk->type->name);
+    bool hasNames = ped_disk_type_check_feature(disk->type, PED_DISK_TYPE_PARTITION_NAME);
+
+    PedPartition *partition = nullptr;
+    while ((partition = ped_disk_next_partition(disk, partition)) != nullptr) {
+        // Only real partitions, free space and metadata are recreated by libparted
+        if (!ped_partition_is_active(partition)) {
+            continue;
+        }
+
+        PlannedPartition part;
+        part.type = (PedPartitionType)(partition->type & (PED_PARTITION_LOGICAL | PED_PARTITION_EXTENDED));
+        part.start = partition->geom.start;
+        part.end = partition->geom.end;
+        part.name = hasNames ? QString::fromUtf8(ped_partition_get_name(partition))
+                             : QString("Partition %1").arg(partition->num);
+        if (partition->fs_type) {
+            part.fileSystem = QString::fromUtf8(partition->fs_type->name);
+        }
+
+        if (part.type != PED_PARTITION_EXTENDED) {
+            for (PedPartitionFlag flag = ped_partition_flag_next((PedPartitionFlag)0); flag;
+                 flag = ped_partition_flag_next(flag)) {
+                if (ped_partition_is_flag_available(partition, flag) && ped_partition_get_flag(partition, flag)) {
+                    part.flags << QString::fromUtf8(ped_partition_flag_get_name(flag));
+                }
+            }
+        }
+        layout.partitions.push_back(part);
+    }
+
+    ped_disk_destroy(disk);
+    return layout;
+}
+
+std::vector<ReplicationResult> DiskManager::replicateLayout(const QString& sourcePath, const QStringList& targetPaths, bool scale) {
+    Metrics::ScopedTrace trace("DiskManager::replicateLayout", sourcePath);
+    std::vector<ReplicationResult> results;
+
+    LayoutPlan source = readLayout(sourcePath);
+    if (!source.isValid()) {
+        for (const QString& target : targetPaths) {
+            ReplicationResult result;
+            result.devicePath = target;
+            result.message = source.error;
+            results.push_back(result);
+        }
+        return results;
+    }
+
+    // libparted is not thread safe, so the labels are built and written one
+    // after another. ped_disk_commit_to_dev() also syncs the device, so the
+    // writes and their flushes stay serial; only the kernel re-reading each
+    // table (BLKRRPART, which waits for udev and the partition scan) runs in
+    // parallel afterwards.
+    struct Target {
+        ReplicationResult result;
+        PedDisk *disk = nullptr;
+        int partitions = 0;
+    };
+    std::vector<Target> written;
+    for (const QString& path : targetPaths) {
+        Target target;
+        target.result.devicePath = path;
+        QElapsedTimer timer;
+        timer.start();
+
+        PedDevice *dev = path == source.devicePath ? nullptr : lookupDevice(path);
+        if (path == source.devicePath) {
+            target.result.message = "Target is the source device.";
+        } else if (!dev) {
+            target.result.message = "Device not found.";
+        } else if (!(target.result.message = busyReason(dev)).isEmpty()) {
+            LOG_ERROR("replicate", path, target.result.message + " Target skipped.");
+        } else {
+            PedSector offset = 0;
+            PedSector grain = LayoutPlanner::alignmentGrain(dev, &offset);
+            LayoutPlan plan = LayoutPlanner::replicate(source, dev->length, dev->sector_size, grain, offset, scale);
+            plan.devicePath = path;
+            if (!plan.isValid()) {
+                target.result.message = plan.error;
+            } else if (!(target.disk = buildLayout(plan, nullptr))) {
+                target.result.message = "Failed to build the partition table, see the log.";
+            } else {
+                PartitionVerifier::markDeviceWritten(path);
+                if (Metrics::traced("ped_disk_commit_to_dev", path, [&] { return ped_disk_commit_to_dev(target.disk); })) {
+                    target.partitions = int(plan.partitions.size());
+                } else {
+                    target.result.message = "Failed to write the partition table, see the log.";
+                    ped_disk_destroy(target.disk);
+                    target.disk = nullptr;
+                }
+            }
+        }
+        target.result.elapsedMs = timer.elapsed();
+        written.push_back(target);
+    }
+
+    // One thread per target, no libparted calls in here
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, targetPaths.size()));
+    QList<QFuture<QString>> futures;
+    for (const Target& target : written) {
+        QString path = target.result.devicePath;
+        bool pending = target.disk != nullptr;
+        futures.append(QtConcurrent::run(&pool, [path, pending]() {
+            QString error;
+            if (pending) {
+                Metrics::traced("reread", path, [&] { return KernelPartitions::rereadTable(path, &error); });
+            }
+            return error;
+        }));
+    }
+
+    for (size_t i = 0; i < written.size(); ++i) {
+        Target& target = written[i];
+        QElapsedTimer timer;
+        timer.start();
+        futures[int(i)].waitForFinished();
+        if (target.disk) {
+            QString error = futures[int(i)].result();
+            bool success = error.isEmpty();
+            if (!success) {
+                // e.g. image files, back on this thread for the libparted fallback
+                LOG_WARNING("replicate", target.result.devicePath, error + " - falling back to libparted.");
+                success = Metrics::traced("ped_disk_commit_to_os", target.result.devicePath,
+                                          [&] { return ped_disk_commit_to_os(target.disk); });
+            }
+            target.result.success = success;
+            target.result.message = success ? QString("%1 partitions written.").arg(target.partitions)
+                                            : "The kernel did not accept the new partition table, see the log.";
+            ped_disk_destroy(target.disk);
+        }
+        target.result.elapsedMs += timer.elapsed();
+        results.push_back(target.result);
+    }
+    return results;
+}
+
+PedDevice* DiskManager::lookupDevice(const QString& devicePath) {
+    // ped_device_get() walks and extends libparted's global device list,
+    // which is not safe to do from several replication threads at once.
+    static QMutex deviceListMutex;
+    QMutexLocker locker(&deviceListMutex);
+    return ped_device_get(devicePath.toUtf8().constData());
+}
+
+QString DiskManager::busyReason(PedDevice *dev) {
+    if (ped_device_is_busy(dev)) {
+        return "The device is busy (mounted or in use).";
+    }
+    // ped_device_is_busy() only looks at the whole device
+    PedDisk *disk = Metrics::traced("ped_disk_new", QString::fromUtf8(dev->path), [&] { return ped_disk_new(dev); });
+    if (!disk) {
+        return QString(); // no readable label, so no partition of it can be in use
+    }
+    QString reason;
+    PedPartition *partition = nullptr;
+    while ((partition = ped_disk_next_partition(disk, partition)) != nullptr) {
+        if (partition->num > 0 && ped_partition_is_active(partition) && ped_partition_is_busy(partition)) {
+            reason = QString("Partition %1 is busy (mounted or in use).").arg(partition->num);
+            break;
+        }
+    }
+    ped_disk_destroy(disk);
+    return reason;
+}
+
+KernelPartitions::Partition DiskManager::kernelPartition(PedPartition *partition) {
+    KernelPartitions::Partition result;
+    PedDevice *dev = partition->disk->dev;
+    result.devicePath = QString::fromUtf8(dev->path);
+    result.partitionPath = partitionPath(partition);
+    result.number = partition->num;
+    result.startBytes = (long long)partition->geom.start * dev->sector_size;
+    result.lengthBytes = (long long)partition->geom.length * dev->sector_size;
+    if (partition->type & PED_PARTITION_EXTENDED) {
+        // Like the kernel's own msdos parser: only the first 1 KiB of an extended container is exposed
+        result.lengthBytes = (dev->sector_size == 512 ? 2 : 1) * dev->sector_size;
+    }
+    return result;
+}
+
+std::vector<KernelPartitions::Partition> DiskManager::kernelPartitions(PedDisk *disk) {
+    std::vector<KernelPartitions::Partition> partitions;
+    PedPartition *partition = nullptr;
+    while ((partition = ped_disk_next_partition(disk, partition)) != nullptr) {
+        // Free space and metadata have no number the kernel knows
+        if (partition->num <= 0 || !ped_partition_is_active(partition)) continue;
+        partitions.push_back(kernelPartition(partition));
+    }
+    return partitions;
+}
+
+bool DiskManager::commitPartitionChanges(PedDisk *disk, const std::vector<KernelPartitions::Partition>& before) {
+    QString devicePath = QString::fromUtf8(disk->dev->path);
+    // ped_disk_commit() would also re-read the whole table in the kernel,
+    // which fails or stalls as soon as any partition of the disk is busy.
+    if (!Metrics::traced("ped_disk_commit_to_dev", devicePath, [&] { return ped_disk_commit_to_dev(disk); })) {
+        LOG_ERROR("commit", devicePath, "Failed to write the partition table.");
+        return false;
+    }
+
+    std::vector<KernelPartitions::Partition> after = kernelPartitions(disk);
+    QMap<int, KernelPartitions::Partition> previous;
+    for (const KernelPartitions::Partition& partition : before) {
+        previous.insert(partition.number, partition);
+    }
+    QMap<int, KernelPartitions::Partition> current;
+    for (const KernelPartitions::Partition& partition : after) {
+        current.insert(partition.number, partition);
+    }
+
+    // Deletes first so the adds can reuse the numbers and ranges, shrinks
+    // before grows so no two partitions overlap in between
+    struct Update {
+        KernelPartitions::Operation operation;
+        KernelPartitions::Partition partition;
+    };
+    QList<Update> deletes, shrinks, adds, grows;
+    // A node that now names other data, or lost or gained a tail, has stale
+    // digests from the verifier
+    for (const KernelPartitions::Partition& old : before) {
+        auto now = current.constFind(old.number);
+        if (now == current.constEnd() || now.value().startBytes != old.startBytes) {
+            deletes << Update{KernelPartitions::Operation::Delete, old};
+            PartitionVerifier::markWritten(old.partitionPath, 0, 0);
+        }
+    }
+    for (const KernelPartitions::Partition& now : after) {
+        auto old = previous.constFind(now.number);
+        if (old == previous.constEnd() || old.value().startBytes != now.startBytes) {
+            adds << Update{KernelPartitions::Operation::Add, now};
+            PartitionVerifier::markWritten(now.partitionPath, 0, 0);
+        } else if (now.lengthBytes != old.value().lengthBytes) {
+            (now.lengthBytes < old.value().lengthBytes ? shrinks : grows) << Update{KernelPartitions::Operation::Resize, now};
+            PartitionVerifier::markWritten(now.partitionPath, qMin(now.lengthBytes, old.value().lengthBytes), 0);
+        }
+    }
+
+    QString error;
+    for (const QList<Update> *phase : {&deletes, &shrinks, &adds, &grows}) {
+        for (const Update& update : *phase) {
+            if (!Metrics::traced("blkpg", devicePath,
+                                 [&] { return KernelPartitions::apply(update.operation, update.partition, &error); })) {
+                // e.g. image files or kernels without BLKPG support
+                LOG_WARNING("commit", devicePath, error + " - falling back to a full partition table re-read.");
+                return Metrics::traced("ped_disk_commit_to_os", devicePath, [&] { return ped_disk_commit_to_os(disk); });
+            }
+        }
+    }
+    LOG_DEBUG("commit", devicePath, QString("Kernel updated: %1 deleted, %2 added, %3 resized.")
+                                        .arg(deletes.size()).arg(adds.size()).arg(shrinks.size() + grows.size()));
+    return true;
+}
+
+QString DiskManager::partitionDevicePath(const QString& devicePath, int partitionNumber) {
+    PedDevice *dev = lookupDevice(devicePath);
+    if (!dev) return QString();
+
+    PedDisk *disk = Metrics::traced("ped_disk_new", devicePath, [&] { return ped_disk_new(dev); });
+    if (!disk) return QString();
+
+    QString path;
+    PedPartition *part = ped_disk_get_partition(disk, partitionNumber);
+    if (part && !(part->type & PED_PARTITION_FREESPACE)) {
+        path = partitionPath(part);
+    }
+    ped_disk_destroy(disk);
+    return path;
+}
+
+QString DiskManager::partitionPath(PedPartition *partition) {
+    // libparted knows the naming rules (sda1, nvme0n1p1, loop0p1, mmcblk0p1)
+    char *path = ped_partition_get_path(partition);
+    if (!path) {
+        return QString();
+    }
+    QString result = QString::fromUtf8(path);
+    free(path);
+    return result;
+}
+
+void DiskManager::formatPartition(const QString& partitionPath, const QString& fsType) {
+    if (partitionPath.isEmpty()) {
+        return;
+    }
+
+    // mkfs usually dominates the time of a create, so it gets its own series
+    Metrics::ScopedTrace trace("mkfs", partitionPath);
+    int exitCode = -1;
+    if (fsType == "ext4") {
+        exitCode = QProcess::execute("mkfs.ext4", QStringList() << partitionPath);
+    } else if (fsType == "ntfs") {
+        exitCode = QProcess::execute("mkfs.ntfs", QStringList() << partitionPath);
+    } else if (fsType == "xfs") {
+        exitCode = QProcess::execute("mkfs.xfs", QStringList() << partitionPath);
+    } else if (fsType == "fat32") {
+        exitCode = QProcess::execute("mkfs.vfat", QStringList() << "-F" << "32" << partitionPath);
+    } else if (fsType.startsWith("linux-swap")) {
+        exitCode = QProcess::execute("mkswap", QStringList() << partitionPath);
+    }
+    trace.setOk(exitCode == 0);
+}
+
 //'my_device' is ManagedDevice struct instance
 ManagedDevice my_device = {NULL, true};
 // Function to SAFELY close a device (this prevents the assertion failure)
@@ -447,9 +1019,9 @@ void DiskManager::close_my_device() {
         ped_device_close(my_device.dev);
         my_device.is_open = false;
         my_device.dev = NULL;
-        printf("Device closed successfully.\n");
+        LOG_DEBUG("close-device", QString(), "Device closed.");
     } else {
-        printf("Warning: Attempted to close a device that was not open.\n");
+        LOG_DEBUG("close-device", QString(), "No open device to close.");
     }
 }
 
@@ -478,23 +1050,25 @@ PedPartitionFlag DiskManager::flagNameToEnum(const std::string& flag_name) {
  * @return True if the operation and commit were successful, false otherwise.
  */
 bool DiskManager::setPartitionFlag(PedDevice *dev, int partitionNumber, PedPartitionFlag flag_to_set, bool state) {
-    PedDisk *disk = ped_disk_new(dev);
+    const QString devicePath = QString::fromUtf8(dev->path);
+    Metrics::ScopedTrace trace("DiskManager::setPartitionFlag", devicePath, false);
+    PedDisk *disk = Metrics::traced("ped_disk_new", devicePath, [&] { return ped_disk_new(dev); });
     if (!disk) {
-        std::cerr << "Failed to get disk object." << std::endl;
+        LOG_ERROR("set-flag", devicePath, "Failed to read the partition table.");
         return false;
     }
 
     // Find the specific partition by its number
     PedPartition *part = ped_disk_get_partition(disk, partitionNumber);
     if (!part || part->type & PED_PARTITION_METADATA) {
-        std::cerr << "Invalid partition number or partition is metadata." << std::endl;
+        LOG_ERROR("set-flag", devicePath, QString("Invalid partition number %1 or partition is metadata.").arg(partitionNumber));
         ped_disk_destroy(disk);
         return false;
     }
 
     // Check if the flag is available for the current disk label type (MBR, GPT, etc.)
     if (!ped_partition_is_flag_available(part, flag_to_set)) {
-        std::cerr << "Flag is not applicable to this disk label type." << std::endl;
+        LOG_ERROR("set-flag", devicePath, QString("Flag %1 is not applicable to this disk label type.").arg(ped_partition_flag_get_name(flag_to_set)));
         ped_disk_destroy(disk);
         return false;
     }
@@ -505,19 +1079,22 @@ bool DiskManager::setPartitionFlag(PedDevice *dev, int partitionNumber, PedParti
 
     if (success) {
         // Commit the changes to the physical disk
-        success = ped_disk_commit(disk);
+        // Flags do not change the geometry: no kernel re-read, udev only refreshes properties
+        success = Metrics::traced("ped_disk_commit_to_dev", devicePath, [&] { return ped_disk_commit_to_dev(disk); });
         if (success) {
-            std::cout << "Successfully committed flag changes for flag: " << ped_partition_flag_get_name(flag_to_set) << std::endl;
+            KernelPartitions::refreshProperties(partitionPath(part));
+            LOG_INFO("set-flag", devicePath, QString("Flag %1 of partition %2 set to %3.")
+                                                 .arg(ped_partition_flag_get_name(flag_to_set)).arg(partitionNumber).arg(state ? "on" : "off"));
         } else {
-            std::cerr << "Failed to commit disk changes. Changes reverted/lost in memory." << std::endl;
+            LOG_ERROR("set-flag", devicePath, "Failed to commit disk changes. Changes reverted/lost in memory.");
         }
     } else {
-        std::cerr << "Failed to set the flag in memory (e.g., failed OS permission check)." << std::endl;
+        LOG_ERROR("set-flag", devicePath, "Failed to set the flag in memory (e.g., failed OS permission check).");
     }
 
     // Cleanup
     ped_disk_destroy(disk); // This handles closing the device too.
-    return success;
+    return trace.finish(success);
 }
 
 PedDevice* DiskManager::getDeviceFromPath(const QString& path) {
@@ -527,7 +1104,7 @@ PedDevice* DiskManager::getDeviceFromPath(const QString& path) {
     PedDevice* dev = ped_device_get(devicePathCstr);
 
     if (dev == nullptr) {
-        qCritical() << "Failed to get device for path:" << path;
+        LOG_ERROR("device-lookup", path, "Failed to get device.");
         // Check libparted errors here if necessary
         return nullptr;
     }
@@ -8,6 +8,8 @@
 #include <parted/disk.h>
 #include <parted/filesys.h>
 #include <parted/exception.h>
+#include "layoutplanner.h"
+#include "kernelpartitions.h"
 #include <vector>
 
 // Structure to hold partition details
@@ -18,13 +20,15 @@ struct PartitionInfo {
     long long start;
     long long end;
     long long size; // in bytes
+    long long startSector = 0; // exact geometry, 'start'/'end' are derived from these
+    long long endSector = 0;   // inclusive
     QString flags;
     bool isFreeSpace = false;
     QString devicePath; // To know which device it belongs to
 
     // --- New fields to manage hierarchy ---
-    bool isExtendedContainer; // True if this partition entry defines the MBR container
-    bool isLogical;           // True if this is a logical drive within the extended container
+    bool isExtendedContainer = false; // True if this partition entry defines the MBR container
+    bool isLogical = false;           // True if this is a logical drive (or free space) within the extended container
     // Optional: A unique ID to link back to the specific parent extended container item
     // QString parentContainerId;
 };
@@ -34,9 +38,21 @@ struct DeviceInfo {
     QString model;
     QString path;
     long long size; // in bytes
+    long long lengthSectors = 0;
+    long long sectorSize = 512;
+    long long alignmentBytes = 1024 * 1024; // optimum alignment grain
+    long long alignmentOffsetBytes = 0;
     std::vector<PartitionInfo> partitions;
 };
 
+// Outcome of replicating a layout onto one target device
+struct ReplicationResult {
+    QString devicePath;
+    bool success = false;
+    QString message;
+    long long elapsedMs = 0;
+};
+
 //Structure to manage device when it should be closed
 typedef struct {
     PedDevice *dev;
@@ -48,19 +64,64 @@ public:
     DiskManager();
     ~DiskManager();
     std::vector<DeviceInfo> listAllDevices();
+    // Block devices accepted by the DeviceFilter rules plus image files
+    // already opened through libparted, without reading their tables
+    QStringList listDevicePaths();
+    // Reads the partition table of a single device. 'found' is false if the
+    // device no longer exists.
+    DeviceInfo scanDevice(const QString& devicePath, bool *found = nullptr);
 
     // Disk operations (require root privileges)
     bool createPartition(const QString& devicePath, long long startBytes, long long endBytes, const QString& fsType, const QString& PartitionType);
     bool deletePartition(const QString& devicePath, int partitionNumber);
+    // Re-adds a lost partition at exactly the given sectors without formatting
+    // it, so the data found by the rescue scanner stays intact. Writes a fresh
+    // 'labelType' label first if the device has no readable table. A logical
+    // partition needs an extended one around it, recreate that first.
+    bool recreatePartition(const QString& devicePath, long long startSector, long long endSector,
+                           const QString& fsType, PedPartitionType type, const QString& name, const QString& labelType);
     bool resizePartition(const QString& devicePath, int partitionNumber, long long newEndMBytes);
+    // Writes a fresh label with every partition of the plan and commits once.
+    // All existing partitions on plan.devicePath are lost. Refused while the
+    // device or any of its partitions is busy.
+    bool applyLayout(const LayoutPlan& plan, bool format = true);
+    // Reads label type, geometry, types, names and flags of an existing device.
+    LayoutPlan readLayout(const QString& devicePath);
+    // Recreates the layout of sourcePath on every target. The tables are
+    // written and flushed one by one (libparted is not thread safe), only
+    // the kernel re-read runs in parallel. Busy targets fail untouched. With
+    // scale == false targets of a different size fail instead of being
+    // scaled. Blocks until every target is done, call it off the GUI thread.
+    std::vector<ReplicationResult> replicateLayout(const QString& sourcePath, const QStringList& targetPaths, bool scale);
     PedPartitionFlag flagNameToEnum(const std::string& flag_name);
     PedDevice* getDeviceFromPath(const QString& path);
+    // Kernel device node of a partition, e.g. /dev/sda2 or /dev/nvme0n1p2
+    QString partitionDevicePath(const QString& devicePath, int partitionNumber);
     bool setPartitionFlag(PedDevice *dev, int partitionNumber, PedPartitionFlag flag_to_set, bool state);
     bool format_ext4_library(const char* partition_path);
     void close_my_device();
 
 private:
+    DeviceInfo scanDevice(PedDevice *device);
     QString getPartitionFlags(PedPartition *partition);
+    QString partitionPath(PedPartition *partition);
+    PedDevice* lookupDevice(const QString& devicePath);
+    // Why the label of 'dev' must not be rewritten right now (the device or
+    // one of its partitions is mounted or held), empty if it is idle.
+    QString busyReason(PedDevice *dev);
+    // The uncommitted label of a plan, with the partitions to format if asked
+    PedDisk* buildLayout(const LayoutPlan& plan, std::vector<std::pair<PedPartition*, QString>> *toFormat);
+    KernelPartitions::Partition kernelPartition(PedPartition *partition);
+    // Kernel view of every numbered partition of the label, taken before a
+    // change so commitPartitionChanges() knows what to update.
+    std::vector<KernelPartitions::Partition> kernelPartitions(PedDisk *disk);
+    // Writes the table to disk and tells the kernel (BLKPG) about every
+    // partition whose number or geometry differs from 'before', instead of
+    // re-reading the whole table. One change can touch several: msdos
+    // renumbers the logical partitions behind a deleted or inserted one, and
+    // deleting an extended partition drops all of its logicals.
+    bool commitPartitionChanges(PedDisk *disk, const std::vector<KernelPartitions::Partition>& before);
+    void formatPartition(const QString& partitionPath, const QString& fsType);
     // Helper for exception handling in libparted
     static PedExceptionOption exceptionHandler(PedException *exception);
 };
@@ -0,0 +1,121 @@
+#include "diskmapbar.h"
+#include "freespacemap.h"
+#include <QPainter>
+#include <QResizeEvent>
+
+namespace {
+
+QColor colorForFileSystem(const QString& fileSystem) {
+    if (fileSystem.startsWith("ext")) return QColor(86, 140, 200);
+    if (fileSystem.startsWith("fat")) return QColor(120, 180, 90);
+    if (fileSystem == "ntfs") return QColor(90, 170, 170);
+    if (fileSystem == "xfs") return QColor(200, 150, 80);
+    if (fileSystem == "btrfs") return QColor(220, 120, 60);
+    if (fileSystem.startsWith("linux-swap")) return QColor(190, 90, 90);
+    return QColor(150, 150, 170);
+}
+
+} // namespace
+
+DiskMapBar::DiskMapBar(QWidget *parent) : QWidget(parent) {
+    setMinimumHeight(36);
+    setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Fixed);
+}
+
+QSize DiskMapBar::sizeHint() const {
+    return QSize(600, 40);
+}
+
+void DiskMapBar::setDevice(const DeviceInfo& device) {
+    // Same device layout as before: keep the cached rendering
+    quint64 signature = FreeSpaceIndex::layoutSignature(device);
+    if (signature == layoutSignature && deviceSize == device.size && !segments.empty()) {
+        return;
+    }
+
+    layoutSignature = signature;
+    deviceSize = device.size;
+    segments.clear();
+    for (const PartitionInfo& part : device.partitions) {
+        if (part.isExtendedContainer) continue; // its logical drives and gaps are drawn instead
+        Segment segment;
+        segment.start = part.start;
+        segment.end = part.end + device.sectorSize;
+        segment.isFree = part.isFreeSpace;
+        segment.isLogical = part.isLogical;
+        segment.label = part.isFreeSpace ? QString("Free") : QString("%1 %2").arg(part.number).arg(part.fileSystem);
+        segment.color = part.isFreeSpace ? QColor(235, 235, 235) : colorForFileSystem(part.fileSystem);
+        segments.push_back(segment);
+    }
+    cacheValid = false;
+    update();
+}
+
+void DiskMapBar::clearDevice() {
+    segments.clear();
+    deviceSize = 0;
+    layoutSignature = 0;
+    highlightStart = highlightEnd = 0;
+    cacheValid = false;
+    update();
+}
+
+void DiskMapBar::setHighlight(long long start, long long end) {
+    if (start == highlightStart && end == highlightEnd) return;
+    highlightStart = start;
+    highlightEnd = end;
+    update(); // the cache stays valid, only the outline changes
+}
+
+int DiskMapBar::xForOffset(long long offset) const {
+    if (deviceSize <= 0) return 0;
+    return (int)((double)offset / (double)deviceSize * (width() - 1));
+}
+
+void DiskMapBar::resizeEvent(QResizeEvent *event) {
+    QWidget::resizeEvent(event);
+    cacheValid = false;
+}
+
+void DiskMapBar::renderCache() {
+    cache = QPixmap(size());
+    cache.fill(palette().color(QPalette::Window));
+
+    QPainter painter(&cache);
+    QRect bar = rect().adjusted(0, 2, -1, -3);
+    painter.setPen(Qt::darkGray);
+    painter.drawRect(bar);
+
+    for (const Segment& segment : segments) {
+        int x1 = xForOffset(segment.start);
+        int x2 = qMax(x1 + 1, xForOffset(segment.end));
+        // Logical drives sit a little lower, inside the extended container
+        QRect box(x1, bar.top() + (segment.isLogical ? 6 : 1), x2 - x1, bar.height() - (segment.isLogical ? 7 : 1));
+        painter.fillRect(box, segment.color);
+        painter.setPen(segment.isFree ? Qt::lightGray : Qt::darkGray);
+        painter.drawRect(box);
+
+        // Label only when it fits
+        if (painter.fontMetrics().horizontalAdvance(segment.label) + 6 < box.width()) {
+            painter.setPen(segment.isFree ? Qt::darkGray : Qt::white);
+            painter.drawText(box, Qt::AlignCenter, segment.label);
+        }
+    }
+    cacheValid = true;
+}
+
+void DiskMapBar::paintEvent(QPaintEvent *) {
+    if (!cacheValid || cache.size() != size()) {
+        renderCache();
+    }
+
+    QPainter painter(this);
+    painter.drawPixmap(0, 0, cache);
+
+    if (highlightEnd > highlightStart) {
+        int x1 = xForOffset(highlightStart);
+        int x2 = qMax(x1 + 2, xForOffset(highlightEnd));
+        painter.setPen(QPen(palette().color(QPalette::Highlight), 2));
+        painter.drawRect(QRect(x1 + 1, 2, x2 - x1 - 2, height() - 5));
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef DISKMAPBAR_H
+#define DISKMAPBAR_H
+
+#include <QWidget>
+#include <QPixmap>
+#include "diskmanager.h"
+
+// Horizontal map of one device: partitions and free gaps drawn to scale.
+// The segments are rendered once into a cached pixmap which is only
+// regenerated when the layout or the widget size changes; moving the
+// selection just repaints the highlight on top of it.
+class DiskMapBar : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit DiskMapBar(QWidget *parent = nullptr);
+
+    void setDevice(const DeviceInfo& device);
+    void clearDevice();
+    // Byte range to outline, e.g. the selected partition; start == end clears it
+    void setHighlight(long long start, long long end);
+
+    QSize sizeHint() const override;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+
+private:
+    struct Segment {
+        long long start;
+        long long end;
+        QString label;
+        QColor color;
+        bool isFree;
+        bool isLogical;
+    };
+
+    int xForOffset(long long offset) const;
+    void renderCache();
+
+    std::vector<Segment> segments;
+    long long deviceSize = 0;
+    quint64 layoutSignature = 0;
+    long long highlightStart = 0;
+    long long highlightEnd = 0;
+    QPixmap cache;
+    bool cacheValid = false;
+};
+
+#endif // DISKMAPBAR_H
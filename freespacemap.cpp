@@ -0,0 +1,125 @@
+#include "freespacemap.h"
+#include <algorithm>
+
+namespace {
+
+// FNV-1a over the values that define a layout
+void mix(quint64& hash, long long value) {
+    for (int i = 0; i < 8; ++i) {
+        hash ^= (quint64)((value >> (8 * i)) & 0xFF);
+        hash *= 1099511628211ULL;
+    }
+}
+
+} // namespace
+
+FreeSpaceMap::FreeSpaceMap(const DeviceInfo& device) {
+    rebuild(device);
+}
+
+void FreeSpaceMap::rebuild(const DeviceInfo& device) {
+    m_extents.clear();
+    m_bySize.clear();
+    m_totalFree = 0;
+    m_totalAlignedFree = 0;
+    m_signature = FreeSpaceIndex::layoutSignature(device);
+
+    const long long sectorSize = device.sectorSize > 0 ? device.sectorSize : 512;
+    const long long grain = device.alignmentBytes > 0 ? device.alignmentBytes : 1024 * 1024;
+    const long long offset = device.alignmentOffsetBytes % grain;
+
+    for (const PartitionInfo& part : device.partitions) {
+        if (!part.isFreeSpace) continue;
+
+        FreeExtent extent;
+        extent.start = part.start;
+        extent.end = part.end + sectorSize; // PartitionInfo::end is the start of the last sector
+        extent.insideExtended = part.isLogical;
+
+        // Round inwards to whole alignment grains
+        long long startGrains = (extent.start - offset + grain - 1) / grain;
+        long long endGrains = (extent.end - offset) / grain;
+        extent.alignedStart = offset + std::max(0LL, startGrains) * grain;
+        extent.alignedEnd = offset + std::max(0LL, endGrains) * grain;
+        if (extent.insideExtended) {
+            // A logical drive needs room for its EBR in front of it
+            extent.alignedStart += grain;
+        }
+
+        m_totalFree += extent.size();
+        m_totalAlignedFree += extent.alignedSize();
+        m_extents.push_back(extent);
+    }
+
+    std::sort(m_extents.begin(), m_extents.end(), [](const FreeExtent& a, const FreeExtent& b) {
+        return a.start < b.start;
+    });
+
+    for (int i = 0; i < (int)m_extents.size(); ++i) {
+        if (m_extents[i].alignedSize() > 0) m_bySize.push_back(i);
+    }
+    std::stable_sort(m_bySize.begin(), m_bySize.end(), [this](int a, int b) {
+        return m_extents[a].alignedSize() < m_extents[b].alignedSize();
+    });
+}
+
+const FreeExtent* FreeSpaceMap::largest() const {
+    return m_bySize.empty() ? nullptr : &m_extents[m_bySize.back()];
+}
+
+double FreeSpaceMap::fragmentation() const {
+    const FreeExtent *big = largest();
+    if (!big || m_totalAlignedFree <= 0) return 0.0;
+    return 1.0 - (double)big->alignedSize() / (double)m_totalAlignedFree;
+}
+
+const FreeExtent* FreeSpaceMap::bestFit(long long bytes) const {
+    std::vector<const FreeExtent*> fits = candidates(bytes);
+    return fits.empty() ? nullptr : fits.front();
+}
+
+std::vector<const FreeExtent*> FreeSpaceMap::candidates(long long bytes) const {
+    auto first = std::lower_bound(m_bySize.begin(), m_bySize.end(), bytes, [this](int index, long long wanted) {
+        return m_extents[index].alignedSize() < wanted;
+    });
+
+    std::vector<const FreeExtent*> result;
+    for (auto it = first; it != m_bySize.end(); ++it) {
+        result.push_back(&m_extents[*it]);
+    }
+    return result;
+}
+
+// --- FreeSpaceIndex ---
+
+quint64 FreeSpaceIndex::layoutSignature(const DeviceInfo& device) {
+    quint64 hash = 14695981039346656037ULL;
+    mix(hash, device.size);
+    mix(hash, device.alignmentBytes);
+    for (const PartitionInfo& part : device.partitions) {
+        mix(hash, part.start);
+        mix(hash, part.end);
+        mix(hash, part.number);
+        mix(hash, part.isFreeSpace ? 1 : 0);
+        mix(hash, part.isLogical ? 1 : 0);
+    }
+    return hash;
+}
+
+void FreeSpaceIndex::update(const std::vector<DeviceInfo>& devices) {
+    QMap<QString, FreeSpaceMap> maps;
+    for (const DeviceInfo& device : devices) {
+        auto it = m_maps.find(device.path);
+        if (it != m_maps.end() && it->layoutSignature() == layoutSignature(device)) {
+            maps.insert(device.path, *it); // unchanged, keep the existing map
+        } else {
+            maps.insert(device.path, FreeSpaceMap(device));
+        }
+    }
+    m_maps.swap(maps);
+}
+
+const FreeSpaceMap* FreeSpaceIndex::device(const QString& devicePath) const {
+    auto it = m_maps.constFind(devicePath);
+    return it == m_maps.constEnd() ? nullptr : &it.value();
+}
@@ -0,0 +1,69 @@
+#ifndef FREESPACEMAP_H
+#define FREESPACEMAP_H
+
+#include "diskmanager.h"
+#include <QMap>
+#include <QString>
+#include <vector>
+
+// One unused region of a device, in bytes (end is exclusive)
+struct FreeExtent {
+    long long start = 0;
+    long long end = 0;
+    long long alignedStart = 0; // first usable byte after rounding to the device alignment
+    long long alignedEnd = 0;   // end of the last whole alignment grain
+    bool insideExtended = false; // only usable for logical partitions
+
+    long long size() const { return end - start; }
+    long long alignedSize() const { return alignedEnd > alignedStart ? alignedEnd - alignedStart : 0; }
+};
+
+// Free-space index of one device, built from the PartitionInfo rows of a scan
+class FreeSpaceMap {
+public:
+    FreeSpaceMap() {}
+    explicit FreeSpaceMap(const DeviceInfo& device);
+
+    void rebuild(const DeviceInfo& device);
+
+    const std::vector<FreeExtent>& extents() const { return m_extents; } // sorted by start
+    long long totalFree() const { return m_totalFree; }
+    long long totalAlignedFree() const { return m_totalAlignedFree; }
+
+    // Largest contiguous gap after alignment, nullptr if the device is full
+    const FreeExtent* largest() const;
+
+    // 0.0 when all aligned free space is one gap, towards 1.0 the more it is scattered
+    double fragmentation() const;
+
+    // Smallest gap that still holds 'bytes' after alignment (best fit)
+    const FreeExtent* bestFit(long long bytes) const;
+
+    // All gaps that hold 'bytes', best fit first
+    std::vector<const FreeExtent*> candidates(long long bytes) const;
+
+    // Changes whenever the partition layout of the device changes
+    quint64 layoutSignature() const { return m_signature; }
+
+private:
+    std::vector<FreeExtent> m_extents;
+    std::vector<int> m_bySize; // indices into m_extents, ascending aligned size
+    long long m_totalFree = 0;
+    long long m_totalAlignedFree = 0;
+    quint64 m_signature = 0;
+};
+
+// Free-space maps of all scanned devices. update() only rebuilds the maps
+// of devices whose layout changed since the previous scan.
+class FreeSpaceIndex {
+public:
+    void update(const std::vector<DeviceInfo>& devices);
+    const FreeSpaceMap* device(const QString& devicePath) const;
+
+    static quint64 layoutSignature(const DeviceInfo& device);
+
+private:
+    QMap<QString, FreeSpaceMap> m_maps;
+};
+
+#endif // FREESPACEMAP_H
@@ -0,0 +1,174 @@
+#include "iostats.h"
+#include "logger.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTimer>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+namespace {
+
+QString blockName(const QString& devicePath) {
+    // Resolves /dev/disk/by-id/... and /dev/mapper/... links to the kernel name
+    return QFileInfo(QFileInfo(devicePath).canonicalFilePath()).fileName();
+}
+
+// Counters restart from zero when a partition is recreated
+double delta(quint64 current, quint64 last) {
+    return current >= last ? double(current - last) : 0.0;
+}
+
+} // namespace
+
+IoStatsSampler::IoStatsSampler(QObject *parent) : QObject(parent) {
+    qRegisterMetaType<IoSample>("IoSample");
+    qRegisterMetaType<QVector<IoSample>>("QVector<IoSample>");
+    qRegisterMetaType<IoTargets>("IoTargets");
+}
+
+IoStatsSampler::~IoStatsSampler() {
+    closeTargets();
+}
+
+QString IoStatsSampler::deviceStatPath(const QString& devicePath) {
+    QString name = blockName(devicePath);
+    if (name.isEmpty() || !QFileInfo::exists("/sys/block/" + name + "/stat")) return QString();
+    return "/sys/block/" + name + "/stat";
+}
+
+QHash<int, QString> IoStatsSampler::partitionStatPaths(const QString& devicePath) {
+    QHash<int, QString> paths;
+    QString name = blockName(devicePath);
+    if (name.isEmpty()) return paths;
+
+    // Partition directories are named by the kernel (sda1, nvme0n1p1, loop0p1),
+    // the 'partition' attribute holds the number
+    QString sysfs = "/sys/block/" + name;
+    for (const QString& entry : QDir(sysfs).entryList(QStringList() << name + "*", QDir::Dirs | QDir::NoDotAndDotDot)) {
+        QFile partition(sysfs + "/" + entry + "/partition");
+        if (partition.open(QIODevice::ReadOnly)) {
+            paths.insert(partition.readAll().trimmed().toInt(), sysfs + "/" + entry + "/stat");
+        }
+    }
+    return paths;
+}
+
+void IoStatsSampler::setTargets(const IoTargets& targets) {
+    for (auto it = m_targets.begin(); it != m_targets.end();) {
+        // Gone, or the key now names another partition after a layout change
+        if (targets.value(it.key()) != it.value().statPath) {
+            if (it.value().fd >= 0) ::close(it.value().fd);
+            it = m_targets.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (auto it = targets.constBegin(); it != targets.constEnd(); ++it) {
+        if (m_targets.contains(it.key())) continue;
+        Target target;
+        target.statPath = it.value();
+        // Kept open: sysfs regenerates the attribute on every read at offset 0,
+        // which saves an open/close per file and interval
+        target.fd = ::open(it.value().toUtf8().constData(), O_RDONLY | O_CLOEXEC);
+        if (target.fd < 0) {
+            LOG_DEBUG("iostats", it.key(), QString("Cannot open %1.").arg(it.value()));
+            continue;
+        }
+        m_targets.insert(it.key(), target);
+    }
+}
+
+void IoStatsSampler::setInterval(int milliseconds) {
+    if (!m_timer) {
+        m_timer = new QTimer(this);
+        connect(m_timer, &QTimer::timeout, this, &IoStatsSampler::sample);
+        m_clock.start();
+    }
+
+    if (milliseconds <= 0) {
+        m_timer->stop();
+        return;
+    }
+    if (!m_timer->isActive()) {
+        // Do not average over the time sampling was off
+        for (Target& target : m_targets) {
+            target.hasLast = false;
+        }
+    }
+    m_timer->start(milliseconds);
+}
+
+bool IoStatsSampler::readCounters(int fd, IoCounters *counters) {
+    char buffer[256];
+    ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (length <= 0) return false;
+    buffer[length] = '\0';
+
+    // read I/Os, read merges, read sectors, read ticks, write I/Os, write merges,
+    // write sectors, write ticks, in flight, io ticks, time in queue, ...
+    quint64 fields[11];
+    char *p = buffer;
+    for (int i = 0; i < 11; ++i) {
+        char *end = nullptr;
+        fields[i] = strtoull(p, &end, 10);
+        if (end == p) return false;
+        p = end;
+    }
+    counters->readIos = fields[0];
+    counters->readSectors = fields[2];
+    counters->writeIos = fields[4];
+    counters->writeSectors = fields[6];
+    counters->inFlight = fields[8];
+    counters->ioTicksMs = fields[9];
+    counters->timeInQueueMs = fields[10];
+    return true;
+}
+
+void IoStatsSampler::sample() {
+    qint64 now = m_clock.nsecsElapsed();
+    double seconds = (now - m_lastSampleNs) / 1e9;
+    double milliseconds = seconds * 1000.0;
+    m_lastSampleNs = now;
+
+    QVector<IoSample> samples;
+    samples.reserve(m_targets.size());
+    for (auto it = m_targets.begin(); it != m_targets.end(); ++it) {
+        Target& target = it.value();
+        IoCounters current;
+        if (!readCounters(target.fd, &current)) continue;
+
+        // The first read only establishes the baseline
+        if (target.hasLast && seconds > 0) {
+            const IoCounters& last = target.last;
+            IoSample sample;
+            sample.key = it.key();
+            sample.readIops = delta(current.readIos, last.readIos) / seconds;
+            sample.writeIops = delta(current.writeIos, last.writeIos) / seconds;
+            sample.readBytesPerSec = delta(current.readSectors, last.readSectors) * 512.0 / seconds;
+            sample.writeBytesPerSec = delta(current.writeSectors, last.writeSectors) * 512.0 / seconds;
+            sample.queueDepth = delta(current.timeInQueueMs, last.timeInQueueMs) / milliseconds;
+            sample.utilization = qMin(100.0, delta(current.ioTicksMs, last.ioTicksMs) * 100.0 / milliseconds);
+
+            target.history.append(float(sample.readBytesPerSec + sample.writeBytesPerSec));
+            if (target.history.size() > kHistoryLength) target.history.removeFirst();
+            sample.history = target.history;
+            samples.append(sample);
+        }
+        target.last = current;
+        target.hasLast = true;
+    }
+
+    if (!samples.isEmpty()) {
+        emit samplesReady(samples);
+    }
+}
+
+void IoStatsSampler::closeTargets() {
+    for (Target& target : m_targets) {
+        if (target.fd >= 0) ::close(target.fd);
+    }
+    m_targets.clear();
+}
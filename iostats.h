@@ -0,0 +1,88 @@
+#ifndef IOSTATS_H
+#define IOSTATS_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMetaType>
+#include <QString>
+#include <QVector>
+
+class QTimer;
+
+// sampler key -> stat file path
+typedef QHash<QString, QString> IoTargets;
+
+// Cumulative counters of a /sys/block/.../stat file (see the kernel's
+// Documentation/block/stat.rst). Sectors are always 512 bytes there.
+struct IoCounters {
+    quint64 readIos = 0;
+    quint64 readSectors = 0;
+    quint64 writeIos = 0;
+    quint64 writeSectors = 0;
+    quint64 inFlight = 0;
+    quint64 ioTicksMs = 0;       // time the device had I/O in flight
+    quint64 timeInQueueMs = 0;   // weighted by the number of requests in flight
+};
+
+// Rates over one sampling interval
+struct IoSample {
+    QString key;
+    double readIops = 0;
+    double writeIops = 0;
+    double readBytesPerSec = 0;
+    double writeBytesPerSec = 0;
+    double queueDepth = 0;   // average requests in flight
+    double utilization = 0;  // percent of the interval with I/O in flight
+    QVector<float> history;  // recent read+write throughput, oldest first
+};
+Q_DECLARE_METATYPE(IoSample)
+
+// Samples the block layer statistics of disks and partitions on its own
+// thread and hands all results of one interval to the GUI in one signal.
+// Use it through queued calls only (moveToThread + invokeMethod).
+class IoStatsSampler : public QObject {
+    Q_OBJECT
+
+public:
+    static const int kHistoryLength = 60;
+
+    explicit IoStatsSampler(QObject *parent = nullptr);
+    ~IoStatsSampler();
+
+    // /sys/block/<dev>/stat of a whole device, empty if unknown
+    static QString deviceStatPath(const QString& devicePath);
+    // partition number -> /sys/block/<dev>/<part>/stat for all partitions of a device
+    static QHash<int, QString> partitionStatPaths(const QString& devicePath);
+
+public slots:
+    // Counters of keys that stay are kept
+    void setTargets(const IoTargets& targets);
+    // 0 stops sampling
+    void setInterval(int milliseconds);
+
+signals:
+    void samplesReady(const QVector<IoSample>& samples);
+
+private slots:
+    void sample();
+
+private:
+    struct Target {
+        QString statPath;
+        int fd = -1;
+        IoCounters last;
+        bool hasLast = false;
+        QVector<float> history;
+    };
+
+    static bool readCounters(int fd, IoCounters *counters);
+    void closeTargets();
+
+    QHash<QString, Target> m_targets;
+    QTimer *m_timer = nullptr;
+    QElapsedTimer m_clock;
+    qint64 m_lastSampleNs = 0;
+};
+
+#endif // IOSTATS_H
@@ -0,0 +1,157 @@
+#include "kernelpartitions.h"
+#include "logger.h"
+#include <QElapsedTimer>
+#include <libudev.h>
+#include <linux/blkpg.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+namespace {
+
+QString baseName(const QString& path) {
+    return path.section('/', -1);
+}
+
+// Listens for udev block/partition events. Created before the ioctl so the
+// event cannot slip through between the change and the start of the wait.
+class UdevEventWaiter {
+public:
+    UdevEventWaiter() {
+        m_udev = udev_new();
+        if (!m_udev) return;
+        m_monitor = udev_monitor_new_from_netlink(m_udev, "udev");
+        if (!m_monitor) return;
+        udev_monitor_filter_add_match_subsystem_devtype(m_monitor, "block", "partition");
+        if (udev_monitor_enable_receiving(m_monitor) < 0) {
+            udev_monitor_unref(m_monitor);
+            m_monitor = nullptr;
+        }
+    }
+
+    ~UdevEventWaiter() {
+        if (m_monitor) udev_monitor_unref(m_monitor);
+        if (m_udev) udev_unref(m_udev);
+    }
+
+    // Waits for 'action' ("add", "remove", "change") on the node named sysname
+    bool wait(const QString& sysname, const char *action, int timeoutMs) {
+        if (!m_monitor) return false;
+
+        QElapsedTimer timer;
+        timer.start();
+        struct pollfd pfd;
+        pfd.fd = udev_monitor_get_fd(m_monitor);
+        pfd.events = POLLIN;
+
+        while (timer.elapsed() < timeoutMs) {
+            int ready = poll(&pfd, 1, (int)(timeoutMs - timer.elapsed()));
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready <= 0) break;
+
+            struct udev_device *device = udev_monitor_receive_device(m_monitor);
+            if (!device) continue;
+            bool matches = sysname == QString::fromUtf8(udev_device_get_sysname(device)) &&
+                           strcmp(action, udev_device_get_action(device) ? udev_device_get_action(device) : "") == 0;
+            udev_device_unref(device);
+            if (matches) return true;
+        }
+        return false;
+    }
+
+private:
+    struct udev *m_udev = nullptr;
+    struct udev_monitor *m_monitor = nullptr;
+};
+
+bool writeUevent(const QString& partitionPath, const char *action) {
+    QString ueventPath = QString("/sys/class/block/%1/uevent").arg(baseName(partitionPath));
+    int fd = ::open(ueventPath.toUtf8().constData(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = write(fd, action, strlen(action)) == (ssize_t)strlen(action);
+    ::close(fd);
+    return ok;
+}
+
+} // namespace
+
+bool KernelPartitions::apply(Operation operation, const Partition& partition, QString *error, int udevTimeoutMs) {
+    int fd = ::open(partition.devicePath.toUtf8().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (error) *error = QString("Cannot open %1: %2").arg(partition.devicePath).arg(strerror(errno));
+        return false;
+    }
+
+    struct blkpg_partition part;
+    memset(&part, 0, sizeof(part));
+    part.pno = partition.number;
+    part.start = partition.startBytes;
+    part.length = partition.lengthBytes;
+
+    struct blkpg_ioctl_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.datalen = sizeof(part);
+    arg.data = &part;
+
+    const char *action = "add";
+    switch (operation) {
+    case Operation::Add:
+        arg.op = BLKPG_ADD_PARTITION;
+        break;
+    case Operation::Delete:
+        arg.op = BLKPG_DEL_PARTITION;
+        action = "remove";
+        break;
+    case Operation::Resize:
+        arg.op = BLKPG_RESIZE_PARTITION;
+        action = "change";
+        break;
+    }
+
+    UdevEventWaiter waiter;
+    int rc = ioctl(fd, BLKPG, &arg);
+    int savedErrno = errno;
+    ::close(fd);
+    if (rc != 0) {
+        if (error) *error = QString("BLKPG on %1 partition %2 failed: %3")
+                                .arg(partition.devicePath).arg(partition.number).arg(strerror(savedErrno));
+        return false;
+    }
+
+    // The kernel does not announce a resize on its own
+    if (operation == Operation::Resize) {
+        writeUevent(partition.partitionPath, "change");
+    }
+
+    if (!waiter.wait(baseName(partition.partitionPath), action, udevTimeoutMs)) {
+        // The kernel already has the change, only udev is slow or absent
+        LOG_WARNING("blkpg", partition.partitionPath, QString("No udev %1 event within %2 ms.").arg(action).arg(udevTimeoutMs));
+    }
+    return true;
+}
+
+bool KernelPartitions::rereadTable(const QString& devicePath, QString *error) {
+    int fd = ::open(devicePath.toUtf8().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (error) *error = QString("Cannot open %1: %2").arg(devicePath).arg(strerror(errno));
+        return false;
+    }
+
+    bool ok = fsync(fd) == 0 && ioctl(fd, BLKRRPART) == 0;
+    int savedErrno = errno;
+    ::close(fd);
+    if (!ok && error) {
+        *error = QString("Re-reading the partition table of %1 failed: %2").arg(devicePath).arg(strerror(savedErrno));
+    }
+    return ok;
+}
+
+bool KernelPartitions::refreshProperties(const QString& partitionPath, int udevTimeoutMs) {
+    UdevEventWaiter waiter;
+    if (!writeUevent(partitionPath, "change")) return false;
+    return waiter.wait(baseName(partitionPath), "change", udevTimeoutMs);
+}
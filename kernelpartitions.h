@@ -0,0 +1,40 @@
+#ifndef KERNELPARTITIONS_H
+#define KERNELPARTITIONS_H
+
+#include <QString>
+
+// Targeted updates of the kernel's partition view via the BLKPG ioctl.
+// Unlike a full table re-read (BLKRRPART/partprobe) this works while other
+// partitions of the same disk are mounted and leaves them untouched.
+namespace KernelPartitions {
+
+enum class Operation {
+    Add,
+    Delete,
+    Resize
+};
+
+struct Partition {
+    QString devicePath;    // whole disk, e.g. /dev/sda
+    QString partitionPath; // partition node, e.g. /dev/sda3
+    int number = 0;
+    long long startBytes = 0;
+    long long lengthBytes = 0;
+};
+
+// Applies one change and waits for the matching udev event of the partition
+// node, so the node exists (or is gone) when this returns true.
+bool apply(Operation operation, const Partition& partition, QString *error, int udevTimeoutMs = 5000);
+
+// Flushes the whole disk and has the kernel re-read its table (BLKRRPART).
+// Fails with EBUSY while any partition of the disk is in use, meant for
+// disks whose table was just replaced.
+bool rereadTable(const QString& devicePath, QString *error);
+
+// Asks udev to re-read the properties of a partition whose geometry did not
+// change (e.g. after a flag or type change) and waits for the event.
+bool refreshProperties(const QString& partitionPath, int udevTimeoutMs = 5000);
+
+} // namespace KernelPartitions
+
+#endif // KERNELPARTITIONS_H
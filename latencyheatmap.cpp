@@ -0,0 +1,96 @@
+#include "latencyheatmap.h"
+#include <QMouseEvent>
+#include <QPainter>
+#include <QToolTip>
+#include <cmath>
+
+LatencyHeatmap::LatencyHeatmap(QWidget *parent) : QWidget(parent) {
+    setMinimumHeight(40);
+    setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Fixed);
+    setMouseTracking(true);
+}
+
+QSize LatencyHeatmap::sizeHint() const {
+    return QSize(600, 48);
+}
+
+void LatencyHeatmap::setResult(const SurfaceScanResult& scanResult, const DeviceInfo& scannedDevice) {
+    result = scanResult;
+    device = scannedDevice;
+
+    badCells.assign(result.heatmap.size(), false);
+    for (const BadSectorRange& range : result.badRanges) {
+        if (result.heatmapCellBytes == 0 || badCells.empty()) break;
+        quint64 first = (range.offset - result.offset) / result.heatmapCellBytes;
+        quint64 last = (range.offset + range.length - 1 - result.offset) / result.heatmapCellBytes;
+        for (quint64 cell = first; cell <= last && cell < badCells.size(); ++cell) {
+            badCells[cell] = true;
+        }
+    }
+    update();
+}
+
+int LatencyHeatmap::cellAt(int x) const {
+    if (result.heatmap.empty() || width() <= 0) return -1;
+    int cell = (int)((double)x / width() * result.heatmap.size());
+    return qBound(0, cell, (int)result.heatmap.size() - 1);
+}
+
+QColor LatencyHeatmap::colorForCell(int cell) const {
+    if (badCells[cell]) return Qt::black;
+    float latency = result.heatmap[cell];
+    if (latency < 0) return QColor(235, 235, 235); // not read (cancelled)
+
+    // Log scale: 1 ms and below green, 500 ms and above red
+    double position = qBound(0.0, std::log10(qMax(latency, 1.0f)) / std::log10(500.0), 1.0);
+    return QColor::fromHsv((int)(120 * (1.0 - position)), 200, 210);
+}
+
+void LatencyHeatmap::paintEvent(QPaintEvent *) {
+    QPainter painter(this);
+    QRect bar = rect().adjusted(0, 2, -1, -3);
+    painter.fillRect(bar, palette().color(QPalette::Window));
+    if (result.heatmap.empty()) return;
+
+    const int cells = (int)result.heatmap.size();
+    for (int cell = 0; cell < cells; ++cell) {
+        int x1 = (int)((double)cell / cells * bar.width());
+        int x2 = qMax(x1 + 1, (int)((double)(cell + 1) / cells * bar.width()));
+        painter.fillRect(QRect(x1, bar.top(), x2 - x1, bar.height()), colorForCell(cell));
+    }
+
+    // Partition boundaries inside the scanned range
+    painter.setPen(QPen(Qt::white, 1, Qt::DashLine));
+    for (const PartitionInfo& part : device.partitions) {
+        if (part.isFreeSpace || part.isExtendedContainer) continue;
+        quint64 start = part.start;
+        if (start <= result.offset || start >= result.offset + result.length) continue;
+        int x = (int)((double)(start - result.offset) / result.length * bar.width());
+        painter.drawLine(x, bar.top(), x, bar.bottom());
+    }
+    painter.setPen(Qt::darkGray);
+    painter.drawRect(bar);
+}
+
+void LatencyHeatmap::mouseMoveEvent(QMouseEvent *event) {
+    int cell = cellAt(event->pos().x());
+    if (cell < 0) return;
+
+    const double MiB = 1024.0 * 1024.0;
+    quint64 start = result.offset + (quint64)cell * result.heatmapCellBytes;
+    quint64 end = qMin(start + result.heatmapCellBytes, result.offset + result.length);
+    QString where = "unallocated";
+    for (const PartitionInfo& part : device.partitions) {
+        if (part.isFreeSpace || part.isExtendedContainer) continue;
+        if ((long long)start < part.end + device.sectorSize && part.start < (long long)end) {
+            where = QString("partition %1").arg(part.number);
+            break;
+        }
+    }
+
+    QString latency = result.heatmap[cell] < 0 ? QString("not read") : QString("worst read %1 ms").arg(result.heatmap[cell], 0, 'f', 1);
+    QString text = QString("%1 - %2 MB (%3)\n%4").arg(start / MiB, 0, 'f', 1).arg(end / MiB, 0, 'f', 1).arg(where).arg(latency);
+    quint64 bad = result.badSectorsIn(start, end);
+    if (bad) text += QString("\n%1 unreadable sector(s)").arg(bad);
+    QToolTip::showText(event->globalPos(), text, this);
+}
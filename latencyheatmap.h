@@ -0,0 +1,35 @@
+#ifndef LATENCYHEATMAP_H
+#define LATENCYHEATMAP_H
+
+#include <QWidget>
+#include "diskmanager.h"
+#include "surfacescanner.h"
+
+// Strip of the range covered by a surface scan, one column per heatmap
+// cell coloured from green (fast) to red (slow reads); cells with
+// unreadable sectors are black. Partition boundaries of the device are
+// drawn on top, hovering shows the cell's offset, latency and partition.
+class LatencyHeatmap : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit LatencyHeatmap(QWidget *parent = nullptr);
+
+    void setResult(const SurfaceScanResult& result, const DeviceInfo& device);
+
+    QSize sizeHint() const override;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+
+private:
+    int cellAt(int x) const;
+    QColor colorForCell(int cell) const;
+
+    SurfaceScanResult result;
+    DeviceInfo device;
+    std::vector<bool> badCells;
+};
+
+#endif // LATENCYHEATMAP_H
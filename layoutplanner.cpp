@@ -0,0 +1,457 @@
+#include "layoutplanner.h"
+#include "logger.h"
+#include <QRegularExpression>
+#include <unistd.h>
+#include <algorithm>
+
+namespace {
+
+// GPT keeps a 34 sector header/entry array at both ends of the disk,
+// msdos only needs the MBR sector in front.
+const PedSector kGptReservedSectors = 34;
+
+// msdos stores start/length as 32-bit sector numbers.
+const PedSector kMsdosMaxSector = 0xFFFFFFFFLL;
+
+PedSector lastUsableSector(const QString& labelType, PedSector lengthSectors) {
+    if (labelType == "gpt") {
+        return lengthSectors - kGptReservedSectors - 1;
+    }
+    if (labelType == "msdos" && lengthSectors - 1 > kMsdosMaxSector) {
+        return kMsdosMaxSector;
+    }
+    return lengthSectors - 1;
+}
+
+PedSector roundUp(PedSector value, PedSector grain) {
+    return ((value + grain - 1) / grain) * grain;
+}
+
+bool isKnownFlag(const QString& token) {
+    static const QStringList knownFlags = {
+        "boot", "esp", "lvm", "raid", "hidden", "bios_grub", "msftdata",
+        "msftres", "legacy_boot", "lba", "prep", "diag", "irst"
+    };
+    return knownFlags.contains(token);
+}
+
+QString normalizeFileSystem(const QString& token) {
+    if (token == "swap" || token == "linux-swap") return "linux-swap(v1)";
+    if (token == "fat" || token == "vfat") return "fat32";
+    return token;
+}
+
+// Parse "512M", "40G", "1.5T", "2048" (MB like the create dialog), "25%", "ram", "rest"
+bool parseSize(const QString& token, LayoutEntry& entry) {
+    QString t = token.toLower();
+    if (t == "ram" || t == "mem") {
+        entry.sizeKind = LayoutEntry::Ram;
+        return true;
+    }
+    if (t == "rest" || t == "remaining" || t == "*") {
+        entry.sizeKind = LayoutEntry::Rest;
+        return true;
+    }
+
+    bool ok = false;
+    if (t.endsWith('%')) {
+        entry.sizeKind = LayoutEntry::Percent;
+        entry.percent = t.chopped(1).toDouble(&ok);
+        return ok && entry.percent > 0.0 && entry.percent <= 100.0;
+    }
+
+    // Strip an optional "iB"/"B" so 512MiB, 512MB and 512M are the same
+    if (t.endsWith("ib")) t.chop(2);
+    else if (t.endsWith('b')) t.chop(1);
+
+    double multiplier = 1024.0 * 1024.0; // plain numbers are MB, like the create dialog
+    if (t.endsWith('k')) { multiplier = 1024.0; t.chop(1); }
+    else if (t.endsWith('m')) { multiplier = 1024.0 * 1024.0; t.chop(1); }
+    else if (t.endsWith('g')) { multiplier = 1024.0 * 1024.0 * 1024.0; t.chop(1); }
+    else if (t.endsWith('t')) { multiplier = 1024.0 * 1024.0 * 1024.0 * 1024.0; t.chop(1); }
+
+    double value = t.toDouble(&ok);
+    if (!ok || value <= 0.0) return false;
+
+    entry.sizeKind = LayoutEntry::Fixed;
+    entry.sizeBytes = (long long)(value * multiplier);
+    return true;
+}
+
+} // namespace
+
+bool LayoutPlanner::parseSpec(const QString& spec, std::vector<LayoutEntry>& entries, QString* error) {
+    entries.clear();
+
+    QString normalized = spec;
+    normalized.replace('\n', ',');
+    normalized.replace(';', ',');
+
+    const QStringList items = normalized.split(',', Qt::SkipEmptyParts);
+    for (const QString& rawItem : items) {
+        QString item = rawItem.trimmed();
+        item.replace('=', ' ');
+        const QStringList tokens = item.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+        if (tokens.isEmpty()) continue;
+
+        // "all aligned to optimal_io_size": every start is aligned to the
+        // optimum alignment anyway, so the directive needs no entry.
+        const QString head = tokens.first().toLower();
+        if (head == "all" || head.startsWith("align")) continue;
+
+        if (tokens.size() < 2) {
+            if (error) *error = QString("Entry '%1' has no size.").arg(item);
+            return false;
+        }
+
+        LayoutEntry entry;
+        entry.name = tokens.at(0);
+        if (!parseSize(tokens.at(1), entry)) {
+            if (error) *error = QString("Invalid size '%1' for entry '%2'.").arg(tokens.at(1)).arg(entry.name);
+            return false;
+        }
+
+        for (int i = 2; i < tokens.size(); ++i) {
+            const QString token = tokens.at(i).toLower();
+            if (isKnownFlag(token)) {
+                entry.flags << token;
+            } else {
+                entry.fileSystem = normalizeFileSystem(token);
+            }
+        }
+
+        // Sensible defaults derived from the entry name
+        const QString lowerName = entry.name.toLower();
+        if (lowerName == "efi" || lowerName == "esp") {
+            if (entry.fileSystem.isEmpty()) entry.fileSystem = "fat32";
+            if (!entry.flags.contains("esp")) entry.flags << "esp";
+        } else if (lowerName == "swap") {
+            if (entry.fileSystem.isEmpty()) entry.fileSystem = "linux-swap(v1)";
+        } else if (lowerName == "bios" || lowerName == "bios_grub") {
+            if (!entry.flags.contains("bios_grub")) entry.flags << "bios_grub";
+        } else if (entry.fileSystem.isEmpty()) {
+            entry.fileSystem = "ext4";
+        }
+
+        entries.push_back(entry);
+    }
+
+    if (entries.empty()) {
+        if (error) *error = "The layout spec does not contain any partitions.";
+        return false;
+    }
+    return true;
+}
+
+long long LayoutPlanner::installedMemoryBytes() {
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGE_SIZE);
+    if (pages <= 0 || pageSize <= 0) return 0;
+    return (long long)pages * (long long)pageSize;
+}
+
+PedSector LayoutPlanner::alignmentGrain(PedDevice *dev, PedSector *offset) {
+    PedSector grain = 0;
+    PedSector alignOffset = 0;
+
+    // libparted derives the optimum alignment from optimal_io_size/alignment_offset
+    PedAlignment *alignment = ped_device_get_optimum_alignment(dev);
+    if (alignment) {
+        grain = alignment->grain_size;
+        alignOffset = alignment->offset;
+        ped_alignment_destroy(alignment);
+    }
+
+    // Never go below 1 MiB, but keep the grain a multiple of optimal_io_size
+    PedSector oneMiB = (1024 * 1024) / dev->sector_size;
+    if (oneMiB < 1) oneMiB = 1;
+    if (grain <= 0) grain = oneMiB;
+    if (grain < oneMiB) grain = roundUp(oneMiB, grain);
+
+    if (offset) *offset = (alignOffset >= 0) ? alignOffset % grain : 0;
+    return grain;
+}
+
+LayoutPlan LayoutPlanner::plan(PedDevice *dev, const QString& labelType, const std::vector<LayoutEntry>& entries) {
+    PedSector offset = 0;
+    PedSector grain = alignmentGrain(dev, &offset);
+    LayoutPlan result = plan(dev->length, dev->sector_size, grain, offset, labelType, entries);
+    result.devicePath = QString::fromUtf8(dev->path);
+    if (labelType == "msdos" && dev->length - 1 > kMsdosMaxSector) {
+        LOG_WARNING("plan-layout", result.devicePath, "msdos label cannot address beyond 2 TiB, limiting the layout.");
+    }
+    return result;
+}
+
+LayoutPlan LayoutPlanner::plan(PedSector lengthSectors, long long sectorSize,
+                               PedSector grainSectors, PedSector alignOffset,
+                               const QString& labelType, const std::vector<LayoutEntry>& entries) {
+    LayoutPlan result;
+    result.labelType = labelType;
+    result.sectorSize = sectorSize;
+    result.grainSectors = grainSectors > 0 ? grainSectors : 1;
+    result.alignOffset = alignOffset;
+    result.lengthSectors = lengthSectors;
+
+    const PedSector grain = result.grainSectors;
+    const bool isGpt = (labelType == "gpt");
+    const bool isMsdos = (labelType == "msdos");
+    if (!isGpt && !isMsdos) {
+        result.error = QString("Unsupported disk label '%1' (use gpt or msdos).").arg(labelType);
+        return result;
+    }
+    if (entries.empty()) {
+        result.error = "The layout does not contain any partitions.";
+        return result;
+    }
+    if (isGpt && entries.size() > 128) {
+        result.error = "GPT supports at most 128 partitions.";
+        return result;
+    }
+
+    auto alignUp = [&](PedSector s) {
+        if (s <= alignOffset) return alignOffset;
+        return alignOffset + roundUp(s - alignOffset, grain);
+    };
+    auto alignDown = [&](PedSector s) {
+        if (s <= alignOffset) return alignOffset;
+        return alignOffset + ((s - alignOffset) / grain) * grain;
+    };
+
+    const PedSector firstUsable = isGpt ? kGptReservedSectors : 1;
+    const PedSector lastUsable = lastUsableSector(labelType, lengthSectors);
+
+    const PedSector firstStart = alignUp(firstUsable);
+    const PedSector available = alignDown(lastUsable + 1) - firstStart;
+    if (available <= 0) {
+        result.error = "The device is too small for any aligned partition.";
+        return result;
+    }
+
+    // msdos has four primary slots: with more entries the fourth slot
+    // becomes an extended container and the remaining entries logical drives.
+    const size_t count = entries.size();
+    const bool useExtended = isMsdos && count > 4;
+    const size_t primaryCount = useExtended ? 3 : count;
+
+    // Pass over the sizes: everything is rounded up to whole grains so that
+    // each following start stays aligned without padding.
+    std::vector<PedSector> sizes(count, 0);
+    int restIndex = -1;
+    PedSector fixedTotal = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const LayoutEntry& entry = entries[i];
+        long long bytes = 0;
+        switch (entry.sizeKind) {
+        case LayoutEntry::Fixed:
+            bytes = entry.sizeBytes;
+            break;
+        case LayoutEntry::Ram:
+            bytes = installedMemoryBytes();
+            break;
+        case LayoutEntry::Percent:
+            bytes = (long long)((double)available * sectorSize * entry.percent / 100.0);
+            break;
+        case LayoutEntry::Rest:
+            if (restIndex >= 0) {
+                result.error = "Only one entry may use 'rest'.";
+                return result;
+            }
+            restIndex = (int)i;
+            continue;
+        }
+
+        PedSector sectors = roundUp((bytes + sectorSize - 1) / sectorSize, grain);
+        if (sectors <= 0) {
+            result.error = QString("Entry '%1' has a zero size.").arg(entry.name);
+            return result;
+        }
+        sizes[i] = sectors;
+        fixedTotal += sectors;
+    }
+
+    // Every logical drive is preceded by one grain holding its EBR
+    const PedSector ebrOverhead = useExtended ? (PedSector)(count - primaryCount) * grain : 0;
+    const PedSector needed = fixedTotal + ebrOverhead;
+    if (needed > available || (restIndex >= 0 && needed == available)) {
+        result.error = QString("The layout needs %1 MiB but only %2 MiB are usable on this device.")
+                           .arg((needed + (restIndex >= 0 ? grain : 0)) * sectorSize / (1024 * 1024))
+                           .arg(available * sectorSize / (1024 * 1024));
+        return result;
+    }
+    if (restIndex >= 0) {
+        sizes[restIndex] = available - needed;
+    }
+
+    // Placement pass
+    PedSector cursor = firstStart;
+    for (size_t i = 0; i < primaryCount; ++i) {
+        PlannedPartition part;
+        part.name = entries[i].name;
+        part.type = PED_PARTITION_NORMAL;
+        part.start = cursor;
+        part.end = cursor + sizes[i] - 1;
+        part.fileSystem = entries[i].fileSystem;
+        part.flags = entries[i].flags;
+        result.partitions.push_back(part);
+        cursor = part.end + 1;
+    }
+
+    if (useExtended) {
+        PlannedPartition extended;
+        extended.name = "extended";
+        extended.type = PED_PARTITION_EXTENDED;
+        extended.start = cursor;
+        result.partitions.push_back(extended);
+        const size_t extendedIndex = result.partitions.size() - 1;
+
+        for (size_t i = primaryCount; i < count; ++i) {
+            cursor += grain; // EBR slot
+            PlannedPartition part;
+            part.name = entries[i].name;
+            part.type = PED_PARTITION_LOGICAL;
+            part.start = cursor;
+            part.end = cursor + sizes[i] - 1;
+            part.fileSystem = entries[i].fileSystem;
+            part.flags = entries[i].flags;
+            result.partitions.push_back(part);
+            cursor = part.end + 1;
+        }
+        result.partitions[extendedIndex].end = cursor - 1;
+    }
+
+    // A trailing 'rest' entry also takes the unaligned tail of the disk
+    if (restIndex == (int)count - 1) {
+        result.partitions.back().end = lastUsable;
+        if (useExtended) {
+            for (PlannedPartition& part : result.partitions) {
+                if (part.type == PED_PARTITION_EXTENDED) part.end = lastUsable;
+            }
+        }
+    }
+
+    return result;
+}
+
+LayoutPlan LayoutPlanner::replicate(const LayoutPlan& source, PedSector targetLength, long long targetSectorSize,
+                                    PedSector grainSectors, PedSector alignOffset, bool scale) {
+    LayoutPlan result;
+    result.labelType = source.labelType;
+    result.sectorSize = targetSectorSize;
+    result.lengthSectors = targetLength;
+    result.grainSectors = grainSectors > 0 ? grainSectors : 1;
+    result.alignOffset = alignOffset;
+
+    const long long sourceBytes = source.lengthSectors * source.sectorSize;
+    const long long targetBytes = targetLength * targetSectorSize;
+
+    if (!scale) {
+        // Identical geometry only makes sense on an identical device
+        if (sourceBytes != targetBytes || source.sectorSize != targetSectorSize) {
+            result.error = QString("Target size (%1 bytes, %2 byte sectors) differs from the source (%3 bytes, %4 byte sectors).")
+                               .arg(targetBytes).arg(targetSectorSize)
+                               .arg(sourceBytes).arg(source.sectorSize);
+            return result;
+        }
+        result.partitions = source.partitions;
+        return result;
+    }
+
+    if (sourceBytes <= 0 || targetBytes <= 0) {
+        result.error = "Cannot scale a layout from or to an empty device.";
+        return result;
+    }
+
+    const PedSector grain = result.grainSectors;
+    auto alignUp = [&](PedSector s) {
+        if (s <= alignOffset) return alignOffset;
+        return alignOffset + roundUp(s - alignOffset, grain);
+    };
+    auto alignDown = [&](PedSector s) {
+        if (s <= alignOffset) return alignOffset;
+        return alignOffset + ((s - alignOffset) / grain) * grain;
+    };
+
+    const long double ratio = (long double)targetBytes / (long double)sourceBytes;
+    // Byte offset on the source -> sector on the target
+    auto scaleSector = [&](PedSector sourceSector) {
+        long double bytes = (long double)sourceSector * source.sectorSize * ratio;
+        return (PedSector)(bytes / targetSectorSize);
+    };
+
+    const PedSector sourceLast = lastUsableSector(source.labelType, source.lengthSectors);
+    const PedSector targetLast = lastUsableSector(source.labelType, targetLength);
+    const PedSector firstUsable = (source.labelType == "gpt") ? kGptReservedSectors : 1;
+
+    PedSector previousEnd = firstUsable - 1;   // last used sector outside the extended container
+    PedSector previousLogicalEnd = -1;         // last used sector inside it
+    int extendedIndex = -1;
+
+    for (const PlannedPartition& sourcePart : source.partitions) {
+        PlannedPartition part = sourcePart;
+
+        PedSector start = alignUp(scaleSector(sourcePart.start));
+        if (sourcePart.type == PED_PARTITION_LOGICAL) {
+            // Keep one grain in front of every logical drive for its EBR
+            start = std::max(start, alignUp(previousLogicalEnd + 1) + grain);
+        } else {
+            start = std::max(start, alignUp(previousEnd + 1));
+        }
+
+        // Partitions that ran up to the end of the source also do on the target
+        PedSector end;
+        if ((sourceLast - sourcePart.end) * source.sectorSize < 1024 * 1024) {
+            end = targetLast;
+        } else {
+            end = alignDown(scaleSector(sourcePart.end + 1)) - 1;
+        }
+
+        if (end <= start) {
+            result.error = QString("Partition '%1' becomes empty when scaled to this device.").arg(sourcePart.name);
+            return result;
+        }
+        if (end > targetLast) {
+            result.error = QString("Partition '%1' does not fit on this device.").arg(sourcePart.name);
+            return result;
+        }
+
+        part.start = start;
+        part.end = end;
+        result.partitions.push_back(part);
+
+        if (part.type == PED_PARTITION_EXTENDED) {
+            extendedIndex = (int)result.partitions.size() - 1;
+            previousLogicalEnd = start - 1;
+            previousEnd = end;
+        } else if (part.type == PED_PARTITION_LOGICAL) {
+            if (extendedIndex < 0 || end > result.partitions[extendedIndex].end) {
+                result.error = QString("Logical partition '%1' no longer fits into the extended container.").arg(sourcePart.name);
+                return result;
+            }
+            previousLogicalEnd = end;
+        } else {
+            previousEnd = end;
+        }
+    }
+
+    return result;
+}
+
+QString LayoutPlan::describe() const {
+    QString text = QString("Label: %1, alignment: %2 sectors (%3 KiB)\n")
+                       .arg(labelType)
+                       .arg(grainSectors)
+                       .arg(grainSectors * sectorSize / 1024);
+    for (const PlannedPartition& part : partitions) {
+        double sizeMB = (double)(part.end - part.start + 1) * sectorSize / (1024.0 * 1024.0);
+        text += QString("%1 [%2] sectors %3-%4 (%5 MB) %6 %7\n")
+                    .arg(part.name)
+                    .arg(QString::fromUtf8(ped_partition_type_get_name(part.type)))
+                    .arg(part.start)
+                    .arg(part.end)
+                    .arg(sizeMB, 0, 'f', 2)
+                    .arg(part.fileSystem)
+                    .arg(part.flags.join(","));
+    }
+    return text;
+}
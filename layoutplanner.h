@@ -0,0 +1,78 @@
+#ifndef LAYOUTPLANNER_H
+#define LAYOUTPLANNER_H
+
+#include <QString>
+#include <QStringList>
+#include <parted/parted.h>
+#include <vector>
+
+// One entry of a declarative layout spec, e.g. "EFI 512M" or "data = rest xfs"
+struct LayoutEntry {
+    enum SizeKind {
+        Fixed,   // explicit size such as 512M, 40G, 1T
+        Ram,     // size of the installed memory (typical for swap)
+        Percent, // share of the whole usable disk, e.g. 25%
+        Rest     // everything that is left after the other entries
+    };
+
+    QString name;
+    SizeKind sizeKind = Fixed;
+    long long sizeBytes = 0; // only for Fixed
+    double percent = 0.0;    // only for Percent
+    QString fileSystem;      // libparted fs name, e.g. "ext4", "fat32", "linux-swap(v1)"
+    QStringList flags;       // e.g. "esp", "boot", "swap"
+};
+
+// Exact placement of one partition as computed by the planner
+struct PlannedPartition {
+    QString name;
+    PedPartitionType type = PED_PARTITION_NORMAL; // normal, extended or logical
+    PedSector start = 0;  // first sector (inclusive)
+    PedSector end = 0;    // last sector (inclusive)
+    QString fileSystem;
+    QStringList flags;
+};
+
+// Complete layout for one device, ready to be handed to DiskManager::applyLayout()
+struct LayoutPlan {
+    QString devicePath;
+    QString labelType;          // "gpt" or "msdos"
+    long long sectorSize = 512;
+    PedSector lengthSectors = 0; // device length the plan was solved for
+    PedSector grainSectors = 1; // alignment grain every partition start is aligned to
+    PedSector alignOffset = 0;
+    std::vector<PlannedPartition> partitions;
+    QString error;              // set when the spec does not fit on the device
+
+    bool isValid() const { return error.isEmpty(); }
+    QString describe() const;   // human readable summary for confirmation dialogs
+};
+
+class LayoutPlanner {
+public:
+    // Parse a spec such as "EFI 512M, swap = RAM, root 40G, data = rest".
+    // Entries are separated by commas or new lines; each entry is
+    // "<name> [=] <size> [filesystem] [flags...]".
+    static bool parseSpec(const QString& spec, std::vector<LayoutEntry>& entries, QString* error);
+
+    // Solve sizes and alignment for a concrete device in one pass.
+    static LayoutPlan plan(PedDevice *dev, const QString& labelType, const std::vector<LayoutEntry>& entries);
+
+    // Device independent core of plan(), works on plain geometry numbers.
+    static LayoutPlan plan(PedSector lengthSectors, long long sectorSize,
+                           PedSector grainSectors, PedSector alignOffset,
+                           const QString& labelType, const std::vector<LayoutEntry>& entries);
+
+    // Map an existing layout (e.g. read from a reference disk) onto a device
+    // of the given size. With scale == false the target must match the source
+    // exactly, otherwise every partition is scaled proportionally and re-aligned.
+    static LayoutPlan replicate(const LayoutPlan& source, PedSector targetLength, long long targetSectorSize,
+                                PedSector grainSectors, PedSector alignOffset, bool scale);
+
+    // Alignment grain (in sectors) derived from optimal_io_size, at least 1 MiB.
+    static PedSector alignmentGrain(PedDevice *dev, PedSector *offset = nullptr);
+
+    static long long installedMemoryBytes();
+};
+
+#endif // LAYOUTPLANNER_H
@@ -0,0 +1,254 @@
+#include "logger.h"
+#include <QByteArray>
+#include <QDateTime>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stdio.h>
+#include <syslog.h>
+
+std::atomic<int> Log::detail::threshold(static_cast<int>(LogLevel::Info));
+
+namespace {
+
+const quint64 kRingCapacity = 8192; // power of two
+const std::chrono::milliseconds kIdleWait(20);
+
+struct LogRecord {
+    LogLevel level = LogLevel::Info;
+    qint64 timestampMs = 0;
+    const char *operation = "";
+    QString device;
+    QString message;
+};
+
+// Bounded multi-producer/single-consumer queue (Vyukov). Every slot carries
+// a sequence number telling producers and the consumer whose turn it is,
+// so neither side ever takes a lock.
+class LogRing {
+public:
+    LogRing() : m_slots(new Slot[kRingCapacity]) {
+        for (quint64 i = 0; i < kRingCapacity; ++i) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool push(LogRecord& record) {
+        quint64 position = m_head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = m_slots[position & (kRingCapacity - 1)];
+            quint64 sequence = slot.sequence.load(std::memory_order_acquire);
+            qint64 diff = (qint64)sequence - (qint64)position;
+            if (diff == 0) {
+                if (m_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot.record = std::move(record);
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                position = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer side, only called from the writer thread
+    bool pop(LogRecord& record) {
+        Slot& slot = m_slots[m_tail & (kRingCapacity - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != m_tail + 1) {
+            return false;
+        }
+        record = std::move(slot.record);
+        slot.sequence.store(m_tail + kRingCapacity, std::memory_order_release);
+        ++m_tail;
+        return true;
+    }
+
+private:
+    struct Slot {
+        std::atomic<quint64> sequence;
+        LogRecord record;
+    };
+
+    std::unique_ptr<Slot[]> m_slots;
+    alignas(64) std::atomic<quint64> m_head{0};
+    alignas(64) quint64 m_tail = 0;
+};
+
+enum class SinkKind { Stderr, Syslog, File };
+
+struct Logger {
+    LogRing ring;
+    std::atomic<quint64> dropped{0};
+    std::atomic<bool> running{false};
+    std::once_flag startOnce;
+    std::thread writer;
+    SinkKind sink = SinkKind::Stderr;
+    FILE *file = nullptr;
+
+    // exit() without Log::shutdown() (e.g. QCommandLineParser on --help)
+    // destroys the instance with the writer still running, and destroying a
+    // joinable std::thread calls std::terminate
+    ~Logger() { stop(); }
+
+    // Drains what is queued, then joins the writer and closes the sink
+    void stop() {
+        if (!running.exchange(false) || !writer.joinable()) return;
+        writer.join();
+        if (file) {
+            fclose(file);
+            file = nullptr;
+        }
+        if (sink == SinkKind::Syslog) {
+            closelog();
+        }
+    }
+};
+
+Logger& logger() {
+    static Logger instance;
+    return instance;
+}
+
+const char *levelName(LogLevel level) {
+    switch (level) {
+    case LogLevel::Trace: return "TRACE";
+    case LogLevel::Debug: return "DEBUG";
+    case LogLevel::Info: return "INFO";
+    case LogLevel::Warning: return "WARNING";
+    case LogLevel::Error: return "ERROR";
+    case LogLevel::Critical: return "CRITICAL";
+    }
+    return "INFO";
+}
+
+int syslogPriority(LogLevel level) {
+    switch (level) {
+    case LogLevel::Trace:
+    case LogLevel::Debug: return LOG_DEBUG;
+    case LogLevel::Info: return LOG_INFO;
+    case LogLevel::Warning: return LOG_WARNING;
+    case LogLevel::Error: return LOG_ERR;
+    case LogLevel::Critical: return LOG_CRIT;
+    }
+    return LOG_INFO;
+}
+
+bool parseLevel(const QString& text, LogLevel *level) {
+    static const char *const names[] = {"trace", "debug", "info", "warning", "error", "critical"};
+    for (int i = 0; i < 6; ++i) {
+        if (text.compare(names[i], Qt::CaseInsensitive) == 0) {
+            *level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void emitRecord(Logger& log, const LogRecord& record) {
+    // key=value fields stay greppable in a file and parseable in the journal
+    QByteArray fields = QString("op=%1").arg(record.operation).toUtf8();
+    if (!record.device.isEmpty()) {
+        fields += " device=" + record.device.toUtf8();
+    }
+    QByteArray message = record.message.toUtf8();
+
+    if (log.sink == SinkKind::Syslog) {
+        syslog(syslogPriority(record.level), "%s %s", fields.constData(), message.constData());
+        return;
+    }
+
+    QByteArray time = QDateTime::fromMSecsSinceEpoch(record.timestampMs).toString(Qt::ISODateWithMs).toUtf8();
+    FILE *out = log.sink == SinkKind::File ? log.file : stderr;
+    fprintf(out, "%s %-8s %s %s\n", time.constData(), levelName(record.level), fields.constData(), message.constData());
+}
+
+void drain(Logger& log) {
+    LogRecord record;
+    quint64 reportedDrops = 0;
+    for (;;) {
+        bool stopping = !log.running.load(std::memory_order_acquire);
+        int written = 0;
+        while (log.ring.pop(record)) {
+            emitRecord(log, record);
+            ++written;
+        }
+
+        quint64 dropped = log.dropped.load(std::memory_order_relaxed);
+        if (dropped != reportedDrops) {
+            LogRecord notice;
+            notice.level = LogLevel::Warning;
+            notice.timestampMs = QDateTime::currentMSecsSinceEpoch();
+            notice.operation = "logger";
+            notice.message = QString("%1 log records dropped, ring buffer was full").arg(dropped - reportedDrops);
+            emitRecord(log, notice);
+            reportedDrops = dropped;
+            ++written;
+        }
+
+        if (written > 0 && log.sink != SinkKind::Syslog) {
+            fflush(log.sink == SinkKind::File ? log.file : stderr);
+        }
+        if (stopping) break;
+        if (written == 0) std::this_thread::sleep_for(kIdleWait);
+    }
+}
+
+} // namespace
+
+void Log::setThreshold(LogLevel level) {
+    detail::threshold.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+void Log::start() {
+    Logger& log = logger();
+    std::call_once(log.startOnce, [&log]() {
+        LogLevel level;
+        if (parseLevel(qEnvironmentVariable("PARTED_EXPLORER_LOG_LEVEL"), &level)) {
+            setThreshold(level);
+        }
+
+        QString target = qEnvironmentVariable("PARTED_EXPLORER_LOG");
+        if (target == "syslog" || target == "journal") {
+            openlog("parted-explorer", LOG_PID, LOG_USER);
+            log.sink = SinkKind::Syslog;
+        } else if (!target.isEmpty() && target != "stderr") {
+            log.file = fopen(target.toUtf8().constData(), "a");
+            if (log.file) {
+                log.sink = SinkKind::File;
+            } else {
+                fprintf(stderr, "Cannot open log file %s, logging to stderr.\n", target.toUtf8().constData());
+            }
+        }
+
+        log.running.store(true, std::memory_order_release);
+        log.writer = std::thread(drain, std::ref(log));
+    });
+}
+
+void Log::shutdown() {
+    logger().stop();
+}
+
+void Log::write(LogLevel level, const char *operation, const QString& device, const QString& message) {
+    Logger& log = logger();
+    if (!log.running.load(std::memory_order_acquire)) {
+        start();
+    }
+
+    LogRecord record;
+    record.level = level;
+    record.timestampMs = QDateTime::currentMSecsSinceEpoch();
+    record.operation = operation;
+    record.device = device;
+    record.message = message;
+    if (!log.ring.push(record)) {
+        log.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+quint64 Log::droppedCount() {
+    return logger().dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,71 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <QString>
+#include <QtGlobal>
+#include <atomic>
+
+// Structured, asynchronous logging for the disk code.
+//
+// Callers only format the message and push one record into a lock-free
+// ring buffer; a background thread writes the records out. When the ring is
+// full the record is dropped and counted, a caller is never blocked.
+//
+// Runtime configuration (read by Log::start()):
+//   PARTED_EXPLORER_LOG=stderr|syslog|<file>  sink, default stderr
+//   PARTED_EXPLORER_LOG_LEVEL=trace|debug|info|warning|error|critical
+//
+// Records below LOG_COMPILE_LEVEL are removed at compile time, message
+// formatting included.
+
+enum class LogLevel : int {
+    Trace = 0,
+    Debug = 1,
+    Info = 2,
+    Warning = 3,
+    Error = 4,
+    Critical = 5
+};
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 1 // Debug, trace records are compiled out
+#endif
+
+namespace Log {
+
+namespace detail {
+extern std::atomic<int> threshold;
+}
+
+inline bool isEnabled(LogLevel level) {
+    return static_cast<int>(level) >= detail::threshold.load(std::memory_order_relaxed);
+}
+
+void setThreshold(LogLevel level);
+
+// Starts the writer thread; called lazily by the first write()
+void start();
+// Writes out everything still queued and stops the writer thread
+void shutdown();
+
+void write(LogLevel level, const char *operation, const QString& device, const QString& message);
+
+// Records lost because the ring was full
+quint64 droppedCount();
+
+} // namespace Log
+
+#define LOG_RECORD(level, operation, device, message)                              \
+    do {                                                                           \
+        if (static_cast<int>(level) >= LOG_COMPILE_LEVEL && Log::isEnabled(level)) \
+            Log::write(level, operation, device, message);                         \
+    } while (0)
+
+#define LOG_TRACE(operation, device, message) LOG_RECORD(LogLevel::Trace, operation, device, message)
+#define LOG_DEBUG(operation, device, message) LOG_RECORD(LogLevel::Debug, operation, device, message)
+#define LOG_INFO(operation, device, message) LOG_RECORD(LogLevel::Info, operation, device, message)
+#define LOG_WARNING(operation, device, message) LOG_RECORD(LogLevel::Warning, operation, device, message)
+#define LOG_ERROR(operation, device, message) LOG_RECORD(LogLevel::Error, operation, device, message)
+#define LOG_CRITICAL(operation, device, message) LOG_RECORD(LogLevel::Critical, operation, device, message)
+
+#endif // LOGGER_H
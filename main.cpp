@@ -1,11 +1,139 @@
 #include "mainwindow.h"
+#include "logger.h"
+#include "metrics.h"
+#include "stressharness.h"
+#include "topologyexport.h"
+#include "topologyindex.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QTextStream>
+#include <cstring>
+
+// --query: prints the matching rows of the current topology, tab separated.
+// Exit code 0 with matches, 1 without, 2 for an invalid expression.
+static int runQuery(const QString& expression)
+{
+    DiskManager diskManager;
+    std::vector<DeviceInfo> devices = diskManager.listAllDevices();
+    TopologyIndex index;
+    index.build(devices);
+
+    RowSet matches;
+    QString error;
+    QTextStream out(stdout);
+    if (!index.query(expression, &matches, &error)) {
+        QTextStream(stderr) << error << Qt::endl;
+        return 2;
+    }
+
+    out << "device\tnumber\ttype\tfilesystem\tstart\tsize\tflags\tmodel" << Qt::endl;
+    for (int r = 0; r < index.rowCount(); ++r) {
+        if (!matches.test(r)) continue;
+        const DeviceInfo& device = devices[index.row(r).device];
+        if (index.row(r).partition < 0) {
+            out << device.path << "\t-\tdisk\t-\t0\t" << device.size << "\t-\t" << device.model << "\n";
+            continue;
+        }
+        const PartitionInfo& part = device.partitions[index.row(r).partition];
+        out << device.path << '\t' << part.number << '\t' << part.type << '\t' << part.fileSystem << '\t'
+            << part.start << '\t' << part.size << '\t' << (part.flags.isEmpty() ? QString("-") : part.flags) << '\t'
+            << device.model << "\n";
+    }
+    out.flush();
+    return matches.count() > 0 ? 0 : 1;
+}
+
+// --export: writes the topology with exact sectors, with --watch followed by
+// change records until interrupted
+static int runExport(const QString& format, const QString& fileName, int watchSeconds)
+{
+    TopologyExportOptions options;
+    if (!TopologyWriter::parseFormat(format, &options.format)) {
+        QTextStream(stderr) << "Unknown export format " << format << ", use json or binary." << Qt::endl;
+        return 2;
+    }
+    options.watchIntervalMs = qMax(0, watchSeconds) * 1000;
+
+    // Unbuffered: each record is one write, readers of a pipe see it at once
+    QFile file;
+    bool opened;
+    if (fileName.isEmpty() || fileName == "-") {
+        opened = file.open(stdout, QIODevice::WriteOnly | QIODevice::Unbuffered);
+    } else {
+        file.setFileName(fileName);
+        opened = file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered);
+    }
+    if (!opened) {
+        QTextStream(stderr) << "Cannot write " << fileName << ": " << file.errorString() << Qt::endl;
+        return 1;
+    }
+
+    DiskManager diskManager;
+    QString error;
+    if (!TopologyExport::run(diskManager, &file, options, &error)) {
+        QTextStream(stderr) << error << Qt::endl;
+        return 1;
+    }
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
+    Log::start();
+    Metrics::configureFromEnvironment();
+
+    // The headless modes must not need a display (the stress harness still
+    // builds widgets for the tree timings)
+    for (int i = 1; i < argc; ++i) {
+        bool headless = strcmp(argv[i], "--stress") == 0 || strncmp(argv[i], "--query", 7) == 0
+                        || strncmp(argv[i], "--export", 8) == 0;
+        if (headless && !qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+        }
+    }
+
     QApplication a(argc, argv);
-    MainWindow w;
-    w.show();
-    return a.exec();
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption stressOption("stress", "Run the scale/stress harness on synthetic image files and exit.");
+    QCommandLineOption devicesOption("stress-devices", "Device count of the last stress step (default 64).", "count", "64");
+    QCommandLineOption partitionsOption("stress-partitions", "Partitions per synthetic device (default 16).", "count", "16");
+    QCommandLineOption cyclesOption("stress-cycles", "Create/resize/delete cycles per step (default 20).", "count", "20");
+    QCommandLineOption directoryOption("stress-dir", "Keep the images in this directory instead of a temporary one.", "directory");
+    QCommandLineOption noTreeOption("stress-no-tree", "Do not time the tree view.");
+    QCommandLineOption queryOption("query", "Print the partitions matching a filter expression (as in the filter bar) and exit.", "expression");
+    QCommandLineOption exportOption("export", "Write the topology with exact sector values as json (JSON Lines) or binary and exit.", "format");
+    QCommandLineOption exportFileOption("export-file", "Write the export to this file instead of stdout.", "file");
+    QCommandLineOption watchOption("watch", "With --export, keep polling every interval and write change records until interrupted.", "seconds");
+    parser.addOptions({stressOption, devicesOption, partitionsOption, cyclesOption, directoryOption, noTreeOption, queryOption,
+                       exportOption, exportFileOption, watchOption});
+    parser.process(a);
+
+    int result;
+    if (parser.isSet(exportOption)) {
+        result = runExport(parser.value(exportOption), parser.value(exportFileOption), parser.value(watchOption).toInt());
+    } else if (parser.isSet(queryOption)) {
+        result = runQuery(parser.value(queryOption));
+    } else if (parser.isSet(stressOption)) {
+        StressOptions options;
+        options.devices = parser.value(devicesOption).toInt();
+        options.partitions = parser.value(partitionsOption).toInt();
+        options.cycles = parser.value(cyclesOption).toInt();
+        options.directory = parser.value(directoryOption);
+        options.tree = !parser.isSet(noTreeOption);
+
+        QTextStream out(stdout);
+        result = StressHarness(options).run(out);
+    } else {
+        MainWindow w;
+        w.show();
+        result = a.exec();
+    }
+
+    Metrics::flush();
+    Log::shutdown();
+    return result;
 }
@@ -3,14 +3,60 @@
 #include <QMessageBox>
 #include <QHBoxLayout>
 #include <QInputDialog>
+#include <QApplication>
+#include <QStatusBar>
+#include <QFileDialog>
+#include <QProgressDialog>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QColor>
+#include <QtConcurrent>
+#include <QDialog>
+#include <QDialogButtonBox>
+#include <QLabel>
+#include <QListWidget>
+#include <QProgressBar>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QSet>
+#include "partitionimage.h"
+#include "partitionverifier.h"
+#include "rescuescanner.h"
+#include "latencyheatmap.h"
+#include "checksum.h"
+#include "metrics.h"
+#include "logger.h"
+#include "sparklinedelegate.h"
 #include <iostream>
+#include <algorithm>
+#include <functional>
 
 MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     // Setup UI elements
     resize(1000, 400);
     treeWidget = new QTreeWidget(this);
-    treeWidget->setColumnCount(7);
-    treeWidget->setHeaderLabels({"Device/Partition", "Size (GB)", "Start (MB)", "End (MB)", "Type", "File System", "Flags"});
+    treeWidget->setColumnCount(12);
+    treeWidget->setHeaderLabels({"Device/Partition", "Size (GB)", "Start (MB)", "End (MB)", "Type", "File System", "Flags",
+                                 "IOPS (r/w)", "MB/s (r/w)", "Queue", "Util %", "Activity"});
+    treeWidget->setItemDelegateForColumn(11, new SparklineDelegate(treeWidget));
+
+    // Live I/O statistics, sampled on their own thread
+    ioStatsThread = new QThread(this);
+    ioStatsSampler = new IoStatsSampler();
+    ioStatsSampler->moveToThread(ioStatsThread);
+    connect(ioStatsThread, &QThread::finished, ioStatsSampler, &QObject::deleteLater);
+    connect(ioStatsSampler, &IoStatsSampler::samplesReady, this, &MainWindow::onIoSamples);
+    ioStatsThread->start(QThread::LowPriority);
+
+    ioIntervalBox = new QComboBox(this);
+    ioIntervalBox->addItem("I/O stats off", 0);
+    ioIntervalBox->addItem("I/O every 0.5 s", 500);
+    ioIntervalBox->addItem("I/O every 1 s", 1000);
+    ioIntervalBox->addItem("I/O every 2 s", 2000);
+    ioIntervalBox->addItem("I/O every 5 s", 5000);
+    ioIntervalBox->setCurrentIndex(2);
+    connect(ioIntervalBox, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &MainWindow::onIoIntervalChanged);
+    onIoIntervalChanged(ioIntervalBox->currentIndex());
 
     refreshButton = new QPushButton("Refresh", this);
     connect(refreshButton, &QPushButton::clicked, this, &MainWindow::refreshDiskList);
@@ -27,6 +73,27 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     createDiskLabelButton = new QPushButton("Set Disk Partition Flag", this);
     connect(createDiskLabelButton, &QPushButton::clicked, this, &MainWindow::oncCreateDiskFlagClicked);
 
+    planLayoutButton = new QPushButton("Plan Layout", this);
+    connect(planLayoutButton, &QPushButton::clicked, this, &MainWindow::onPlanLayoutClicked);
+
+    replicateLayoutButton = new QPushButton("Replicate Layout", this);
+    connect(replicateLayoutButton, &QPushButton::clicked, this, &MainWindow::onReplicateLayoutClicked);
+
+    backupButton = new QPushButton("Backup Partition", this);
+    connect(backupButton, &QPushButton::clicked, this, &MainWindow::onBackupPartitionClicked);
+
+    restoreButton = new QPushButton("Restore Partition", this);
+    connect(restoreButton, &QPushButton::clicked, this, &MainWindow::onRestorePartitionClicked);
+
+    verifyButton = new QPushButton("Verify Partition", this);
+    connect(verifyButton, &QPushButton::clicked, this, &MainWindow::onVerifyPartitionClicked);
+
+    rescueButton = new QPushButton("Rescue Scan", this);
+    connect(rescueButton, &QPushButton::clicked, this, &MainWindow::onRescueScanClicked);
+
+    surfaceScanButton = new QPushButton("Surface Scan", this);
+    connect(surfaceScanButton, &QPushButton::clicked, this, &MainWindow::onSurfaceScanClicked);
+
     QWidget *centralWidget = new QWidget(this);
     QVBoxLayout *layout = new QVBoxLayout(centralWidget);
     QHBoxLayout *buttonLayout = new QHBoxLayout();
@@ -36,105 +103,443 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     buttonLayout->addWidget(deleteButton);
     buttonLayout->addWidget(resizeButton);
     buttonLayout->addWidget(createDiskLabelButton);
+    buttonLayout->addWidget(planLayoutButton);
+    buttonLayout->addWidget(replicateLayoutButton);
+    buttonLayout->addWidget(backupButton);
+    buttonLayout->addWidget(restoreButton);
+    buttonLayout->addWidget(verifyButton);
+    buttonLayout->addWidget(rescueButton);
+    buttonLayout->addWidget(surfaceScanButton);
+    buttonLayout->addWidget(ioIntervalBox);
+
+    diskMapBar = new DiskMapBar(this);
+    connect(treeWidget, &QTreeWidget::currentItemChanged, this, &MainWindow::onCurrentItemChanged);
+
+    filterEdit = new QLineEdit(this);
+    filterEdit->setClearButtonEnabled(true);
+    filterEdit->setPlaceholderText("Filter, e.g. fs:ext4 flag:boot size>100G model:samsung -type:logical");
+    connect(filterEdit, &QLineEdit::textChanged, this, &MainWindow::applyFilter);
 
     layout->addLayout(buttonLayout);
+    layout->addWidget(filterEdit);
+    layout->addWidget(diskMapBar);
     layout->addWidget(treeWidget);
     setCentralWidget(centralWidget);
     setWindowTitle("Qt Parted Explorer");
 
-    refreshDiskList(); // Initial population
-
+    // Initial population: show the topology of the last run right away and
+    // check it against the hardware in the background instead of probing
+    // every device before the window appears.
+    revalidationWatcher = new QFutureWatcher<TopologyRevalidation>(this);
+    connect(revalidationWatcher, &QFutureWatcher<TopologyRevalidation>::finished, this, &MainWindow::onRevalidationFinished);
+    replicationWatcher = new QFutureWatcher<std::vector<ReplicationResult>>(this);
+    connect(replicationWatcher, &QFutureWatcher<std::vector<ReplicationResult>>::finished, this, &MainWindow::onReplicationFinished);
+    surfaceScanWatcher = new QFutureWatcher<SurfaceScanResult>(this);
+    connect(surfaceScanWatcher, &QFutureWatcher<SurfaceScanResult>::finished, this, &MainWindow::onSurfaceScanFinished);
+
+    QString error;
+    if (TopologyCache::load(TopologyCache::defaultPath(), cachedTopology, &cacheSavedAtMs, &error)) {
+        std::vector<DeviceInfo> devices;
+        for (const CachedDevice& cached : cachedTopology) {
+            devices.push_back(cached.info);
+        }
+        showTopology(devices);
+        setTopologyStale(true);
+    } else {
+        LOG_INFO("topology-cache", QString(), error);
+        statusBar()->showMessage("Scanning devices...");
+    }
+    startRevalidation();
 }
 
-MainWindow::~MainWindow() {}
+MainWindow::~MainWindow() {
+    // The revalidation and replication use diskManager
+    revalidationWatcher->waitForFinished();
+    replicationWatcher->waitForFinished();
+    if (surfaceScanControl) surfaceScanControl->cancel();
+    surfaceScanWatcher->waitForFinished();
+    ioStatsThread->quit();
+    ioStatsThread->wait();
+}
 
 void MainWindow::refreshDiskList() {
     treeWidget->clear();
     std::vector<DeviceInfo> devices = diskManager.listAllDevices();
+    showTopology(devices);
+
+    cachedTopology = TopologyCache::withFingerprints(devices);
+    saveTopologyCache();
+
+    // Every refresh follows a scan or a disk operation, keep the exported metrics current
+    Metrics::flush();
+}
+
+void MainWindow::showTopology(const std::vector<DeviceInfo>& devices) {
+    updateTopologyIndexes(devices);
     displayDevices(devices);
+    onCurrentItemChanged(treeWidget->currentItem());
+}
+
+void MainWindow::showTopologyChanges(const std::vector<DeviceInfo>& devices, const QStringList& changedPaths) {
+    updateTopologyIndexes(devices);
+    updateDeviceItems(devices, changedPaths);
+    onCurrentItemChanged(treeWidget->currentItem());
+}
+
+void MainWindow::updateTopologyIndexes(const std::vector<DeviceInfo>& devices) {
+    freeSpaceIndex.update(devices);
+    lastDevices = devices;
+    topologyIndex.build(devices);
+}
+
+void MainWindow::waitForRevalidation() {
+    revalidationWatcher->waitForFinished();
+}
+
+void MainWindow::startRevalidation() {
+    // libparted is not thread safe: no disk operation until the check is done
+    setOperationsEnabled(false);
+    std::vector<CachedDevice> cached = cachedTopology;
+    revalidationWatcher->setFuture(QtConcurrent::run([this, cached]() {
+        return TopologyCache::revalidate(diskManager, cached);
+    }));
+}
+
+void MainWindow::onRevalidationFinished() {
+    TopologyRevalidation result = revalidationWatcher->result();
+    bool changed = !result.changed.isEmpty() || !result.removed.isEmpty() ||
+                   result.devices.size() != cachedTopology.size();
+    cachedTopology = result.devices;
+
+    // Unchanged devices keep their items, only rescanned ones are rebuilt
+    if (changed) {
+        std::vector<DeviceInfo> devices;
+        for (const CachedDevice& device : cachedTopology) {
+            devices.push_back(device.info);
+        }
+        showTopologyChanges(devices, result.changed);
+        saveTopologyCache();
+    }
+    setTopologyStale(false);
+    setOperationsEnabled(true);
+
+    statusBar()->showMessage(QString("Devices checked: %1 rescanned, %2 removed.")
+                                 .arg(result.changed.size())
+                                 .arg(result.removed.size()), 5000);
+    Metrics::flush();
+}
+
+void MainWindow::updateIoTargets(const std::vector<DeviceInfo>& devices) {
+    IoTargets targets;
+    for (const DeviceInfo& dev : devices) {
+        QString statPath = IoStatsSampler::deviceStatPath(dev.path);
+        if (statPath.isEmpty()) continue;
+        targets.insert(dev.path, statPath);
+
+        QHash<int, QString> partitionPaths = IoStatsSampler::partitionStatPaths(dev.path);
+        for (const PartitionInfo& part : dev.partitions) {
+            if (!part.isFreeSpace && partitionPaths.contains(part.number)) {
+                targets.insert(QString("%1#%2").arg(dev.path).arg(part.number), partitionPaths.value(part.number));
+            }
+        }
+    }
+    QMetaObject::invokeMethod(ioStatsSampler, "setTargets", Qt::QueuedConnection,
+                              Q_ARG(IoTargets, targets));
+}
+
+void MainWindow::onIoSamples(const QVector<IoSample>& samples) {
+    const double MB = 1024.0 * 1024.0;
+    // One repaint for the whole batch instead of one per changed cell
+    treeWidget->setUpdatesEnabled(false);
+    for (const IoSample& sample : samples) {
+        QTreeWidgetItem *item = ioItems.value(sample.key, nullptr);
+        if (!item) continue;
+        item->setText(7, QString("%1 / %2").arg(sample.readIops, 0, 'f', 0).arg(sample.writeIops, 0, 'f', 0));
+        item->setText(8, QString("%1 / %2").arg(sample.readBytesPerSec / MB, 0, 'f', 1).arg(sample.writeBytesPerSec / MB, 0, 'f', 1));
+        item->setText(9, QString::number(sample.queueDepth, 'f', 2));
+        item->setText(10, QString::number(sample.utilization, 'f', 0));
+        item->setData(11, SparklineDelegate::kHistoryRole, QVariant::fromValue(sample.history));
+    }
+    treeWidget->setUpdatesEnabled(true);
+}
+
+void MainWindow::onIoIntervalChanged(int index) {
+    int interval = ioIntervalBox->itemData(index).toInt();
+    QMetaObject::invokeMethod(ioStatsSampler, "setInterval", Qt::QueuedConnection, Q_ARG(int, interval));
+    if (interval == 0) {
+        // Clear the live columns instead of leaving the last values standing
+        for (QTreeWidgetItem *item : ioItems) {
+            for (int column = 7; column <= 10; ++column) item->setText(column, QString());
+            item->setData(11, SparklineDelegate::kHistoryRole, QVariant());
+        }
+    }
+}
+
+void MainWindow::setTopologyStale(bool stale) {
+    QString tooltip;
+    if (stale) {
+        tooltip = QString("Cached on %1, being checked against the hardware.")
+                      .arg(QDateTime::fromMSecsSinceEpoch(cacheSavedAtMs).toString(Qt::TextDate));
+    }
+
+    QList<QTreeWidgetItem*> pending;
+    for (int i = 0; i < treeWidget->topLevelItemCount(); ++i) {
+        pending << treeWidget->topLevelItem(i);
+    }
+    while (!pending.isEmpty()) {
+        QTreeWidgetItem *item = pending.takeLast();
+        for (int column = 0; column < treeWidget->columnCount(); ++column) {
+            item->setData(column, Qt::ForegroundRole, stale ? QVariant(QColor(Qt::gray)) : QVariant());
+            item->setToolTip(column, tooltip);
+        }
+        for (int child = 0; child < item->childCount(); ++child) {
+            pending << item->child(child);
+        }
+    }
+
+    setWindowTitle(stale ? "Qt Parted Explorer (cached)" : "Qt Parted Explorer");
+    if (stale) {
+        statusBar()->showMessage("Showing cached devices, checking for changes...");
+    }
+}
+
+void MainWindow::setOperationsEnabled(bool enabled) {
+    for (QPushButton *button : {refreshButton, createButton, deleteButton, resizeButton, createDiskLabelButton,
+                                planLayoutButton, replicateLayoutButton, backupButton, restoreButton, verifyButton,
+                                rescueButton}) {
+        button->setEnabled(enabled);
+    }
+}
+
+void MainWindow::saveTopologyCache() {
+    QString error;
+    if (!TopologyCache::save(TopologyCache::defaultPath(), cachedTopology, &error)) {
+        LOG_WARNING("topology-cache", QString(), error);
+    }
+}
+
+void MainWindow::onCurrentItemChanged(QTreeWidgetItem *current) {
+    QString devicePath = getSelectedDevicePath();
+    const DeviceInfo *device = nullptr;
+    for (const DeviceInfo& dev : lastDevices) {
+        if (dev.path == devicePath) device = &dev;
+    }
+
+    if (!device) {
+        diskMapBar->clearDevice();
+        statusBar()->clearMessage();
+        return;
+    }
+
+    // Redraws only if the layout of this device differs from what is shown
+    diskMapBar->setDevice(*device);
+    if (current && current->parent() != nullptr) {
+        diskMapBar->setHighlight(current->data(0, Qt::UserRole + 4).toLongLong(),
+                                 current->data(0, Qt::UserRole + 5).toLongLong());
+    } else {
+        diskMapBar->setHighlight(0, 0);
+    }
+
+    const FreeSpaceMap *freeMap = freeSpaceIndex.device(devicePath);
+    if (freeMap) {
+        const double GB = 1024.0 * 1024.0 * 1024.0;
+        const FreeExtent *largest = freeMap->largest();
+        statusBar()->showMessage(QString("%1: %2 GB free (%3 GB usable aligned) in %4 gap(s), largest %5 GB, fragmentation %6%")
+                                     .arg(devicePath)
+                                     .arg(freeMap->totalFree() / GB, 0, 'f', 2)
+                                     .arg(freeMap->totalAlignedFree() / GB, 0, 'f', 2)
+                                     .arg(freeMap->extents().size())
+                                     .arg(largest ? largest->alignedSize() / GB : 0.0, 0, 'f', 2)
+                                     .arg(freeMap->fragmentation() * 100.0, 0, 'f', 0));
+    }
 }
 
 void MainWindow::displayDevices(const std::vector<DeviceInfo>& devices) {
     // Clear existing items and reset map for the robust single-pass approach
     treeWidget->clear();
 
-    // Map to keep track of the parent QTreeWidgetItem* for extended partitions, keyed by device path/identifier
-    QMap<QString, QTreeWidgetItem*> extendedPartitionsMap;
+    ioItems.clear();
+    treeWidget->setColumnWidth(0, 300);
+    treeWidget->setColumnWidth(5, 160);
 
+    int indexRow = 0; // same order as TopologyIndex::build()
     for (const auto& dev : devices) {
-        QTreeWidgetItem *devItem = new QTreeWidgetItem(treeWidget);
-        treeWidget->setColumnWidth(0, 300);
-        treeWidget->setColumnWidth(5, 160);
+        treeWidget->addTopLevelItem(createDeviceItem(dev, indexRow));
+        indexRow += 1 + int(dev.partitions.size());
+    }
+    // Ensure all items are visible in their hierarchy
+    treeWidget->expandAll();
+    updateIoTargets(devices);
+    for (const SurfaceScanResult& result : surfaceScans) {
+        markSurfaceScan(result);
+    }
+    if (!filterEdit->text().isEmpty()) {
+        applyFilter();
+    }
+}
+
+// Replaces the items of the devices in changedPaths (and of new ones),
+// drops removed devices and keeps every other item with its expansion and
+// selection state; only their topologyIndex rows are renumbered.
+void MainWindow::updateDeviceItems(const std::vector<DeviceInfo>& devices, const QStringList& changedPaths) {
+    treeWidget->setUpdatesEnabled(false);
+
+    QSet<QString> paths;
+    for (const DeviceInfo& dev : devices) {
+        paths.insert(dev.path);
+    }
+    QHash<QString, QTreeWidgetItem*> existing;
+    for (int i = treeWidget->topLevelItemCount() - 1; i >= 0; --i) {
+        QTreeWidgetItem *item = treeWidget->topLevelItem(i);
+        QString path = item->data(0, Qt::UserRole).toString();
+        if (paths.contains(path) && !changedPaths.contains(path)) {
+            existing.insert(path, item);
+        } else {
+            removeIoItems(path);
+            delete item;
+        }
+    }
 
-        // Display the main device name and path (e.g., "Hitachi 500GB (/dev/sda)")
-        devItem->setText(0, QString("%1 (%2)").arg(dev.model).arg(dev.path));
+    int indexRow = 0; // same order as TopologyIndex::build()
+    for (int i = 0; i < int(devices.size()); ++i) {
+        const DeviceInfo& dev = devices[i];
+        QTreeWidgetItem *item = existing.value(dev.path, nullptr);
+        if (!item) {
+            item = createDeviceItem(dev, indexRow);
+            treeWidget->insertTopLevelItem(i, item);
+            expandItems(item);
+        } else {
+            if (treeWidget->indexOfTopLevelItem(item) != i) {
+                // Only when the probe order changed; moving loses the expansion
+                treeWidget->insertTopLevelItem(i, treeWidget->takeTopLevelItem(treeWidget->indexOfTopLevelItem(item)));
+                expandItems(item);
+            }
+            int shift = indexRow - item->data(0, Qt::UserRole + 6).toInt();
+            if (shift != 0) {
+                QList<QTreeWidgetItem*> pending;
+                pending << item;
+                while (!pending.isEmpty()) {
+                    QTreeWidgetItem *current = pending.takeLast();
+                    QVariant row = current->data(0, Qt::UserRole + 6);
+                    if (row.isValid()) current->setData(0, Qt::UserRole + 6, row.toInt() + shift);
+                    for (int child = 0; child < current->childCount(); ++child) {
+                        pending << current->child(child);
+                    }
+                }
+            }
+        }
+        indexRow += 1 + int(dev.partitions.size());
+    }
+    treeWidget->setUpdatesEnabled(true);
 
-        // Display size formatted to 2 decimal places in GB
-        devItem->setText(1, QString::number(dev.size / (1024.0 * 1024.0 * 1024.0), 'f', 2));
+    updateIoTargets(devices);
+    for (const SurfaceScanResult& result : surfaceScans) {
+        if (changedPaths.contains(result.devicePath)) markSurfaceScan(result);
+    }
+    if (!filterEdit->text().isEmpty()) {
+        applyFilter();
+    }
+}
 
-        // Store the main device path internally in the root item
-        devItem->setData(0, Qt::UserRole, dev.path);
-        treeWidget->addTopLevelItem(devItem);
+// The item of one device with its partitions, numbered from firstRow in
+// the order of TopologyIndex::build(); registers the rows in ioItems.
+QTreeWidgetItem *MainWindow::createDeviceItem(const DeviceInfo& dev, int firstRow) {
+    // Map to keep track of the parent QTreeWidgetItem* for extended partitions, keyed by device path/identifier
+    QMap<QString, QTreeWidgetItem*> extendedPartitionsMap;
+    int indexRow = firstRow;
 
-        // Iterate through all partitions in this device
-        for (const auto& part : dev.partitions) {
-            QTreeWidgetItem* parentItem = devItem;
+    QTreeWidgetItem *devItem = new QTreeWidgetItem();
 
-            // Determine if this is the extended container definition using string comparison
-            bool isExtendedContainer = part.type.contains("Extended", Qt::CaseInsensitive) || part.type.contains("0x05");
+    // Display the main device name and path (e.g., "Hitachi 500GB (/dev/sda)")
+    devItem->setText(0, QString("%1 (%2)").arg(dev.model).arg(dev.path));
 
-            if (isExtendedContainer) {
-                // Create the extended container item itself
-                QTreeWidgetItem *extItem = new QTreeWidgetItem(devItem);
-                extItem->setText(0, QString("Extended Partition Container"));
-                extItem->setText(1, QString::number(part.size / (1024.0 * 1024.0 * 1024.0), 'f', 2));
+    // Display size formatted to 2 decimal places in GB
+    devItem->setText(1, QString::number(dev.size / (1024.0 * 1024.0 * 1024.0), 'f', 2));
 
-                // Map this item so subsequent logical/free spaces can find their parent QWidgetItem
-                // The key should be the identifier that links logical partitions back to this container
-                extendedPartitionsMap.insert(part.devicePath, extItem);
+    // Store the main device path internally in the root item
+    devItem->setData(0, Qt::UserRole, dev.path);
+    ioItems.insert(dev.path, devItem);
+    devItem->setData(0, Qt::UserRole + 6, indexRow++);
 
-            } else if (extendedPartitionsMap.contains(part.devicePath)) {
-                // If this partition/free space belongs to an extended partition we've mapped,
-                // set the parent to the mapped container item instead of the main device item
-                parentItem = extendedPartitionsMap.value(part.devicePath);
-            }
+    // Iterate through all partitions in this device
+    for (const auto& part : dev.partitions) {
+        QTreeWidgetItem* parentItem = devItem;
 
-            // Determine the descriptive name for the current partition/free space
-            QString name;
-            if (part.isFreeSpace) {
-                name = "Free Space";
-            } else if (parentItem != devItem) {
-                // If the parent is the extended container (not the top-level device)
-                name = QString("Logical Partition %1").arg(part.number);
-            } else {
-                // Must be a primary partition
-                name = QString("Partition %1").arg(part.number);
-            }
+        // Determine if this is the extended container definition using string comparison
+        bool isExtendedContainer = part.type.contains("Extended", Qt::CaseInsensitive) || part.type.contains("0x05");
+
+        if (isExtendedContainer) {
+            // Create the extended container item itself
+            QTreeWidgetItem *extItem = new QTreeWidgetItem(devItem);
+            extItem->setText(0, QString("Extended Partition Container"));
+            extItem->setText(1, QString::number(part.size / (1024.0 * 1024.0 * 1024.0), 'f', 2));
 
-            // Create the actual partition/free space item
-            QTreeWidgetItem *partItem = new QTreeWidgetItem(parentItem);
+            // Map this item so subsequent logical/free spaces can find their parent QWidgetItem
+            // The key should be the identifier that links logical partitions back to this container
+            extendedPartitionsMap.insert(part.devicePath, extItem);
 
-            // Set display text for all columns
-            partItem->setText(0, name); // Displays just the name, without device path
-            partItem->setText(1, QString::number(part.size / (1024.0 * 1024.0 * 1024.0), 'f', 2)); // Size in GB
-            partItem->setText(2, QString::number(part.start / (1024.0 * 1024.0), 'f', 2)); // Start in MB
-            partItem->setText(3, QString::number(part.end / (1024.0 * 1024.0), 'f', 2));   // End in MB
-            partItem->setText(4, part.type);
-            partItem->setText(5, part.fileSystem);
-            partItem->setText(6, part.flags);
+        } else if (extendedPartitionsMap.contains(part.devicePath)) {
+            // If this partition/free space belongs to an extended partition we've mapped,
+            // set the parent to the mapped container item instead of the main device item
+            parentItem = extendedPartitionsMap.value(part.devicePath);
+        }
+
+        // Determine the descriptive name for the current partition/free space
+        QString name;
+        if (part.isFreeSpace) {
+            name = "Free Space";
+        } else if (parentItem != devItem) {
+            // If the parent is the extended container (not the top-level device)
+            name = QString("Logical Partition %1").arg(part.number);
+        } else {
+            // Must be a primary partition
+            name = QString("Partition %1").arg(part.number);
+        }
 
-            // Store internal data using User Roles (for reliable data retrieval later)
-            // Ensure you use consistent indices across displayDevices and getSelectedPartitionInfo
-            partItem->setData(0, Qt::UserRole + 0, part.number);        // Partition Number
-            partItem->setData(0, Qt::UserRole + 1, part.devicePath);    // Device Path (e.g., /dev/sda5)
-            partItem->setData(0, Qt::UserRole + 2, part.isFreeSpace);   // Is Free Space Flag
-            partItem->setData(0, Qt::UserRole + 3, part.size);          // Raw Size (bytes/double)
-            partItem->setData(0, Qt::UserRole + 4, part.start);        // Raw Start (bytes/MB/double)
-            partItem->setData(0, Qt::UserRole + 5, part.end);          // Raw End (bytes/MB/double)
+        // Create the actual partition/free space item
+        QTreeWidgetItem *partItem = new QTreeWidgetItem(parentItem);
+
+        // Set display text for all columns
+        partItem->setText(0, name); // Displays just the name, without device path
+        partItem->setText(1, QString::number(part.size / (1024.0 * 1024.0 * 1024.0), 'f', 2)); // Size in GB
+        partItem->setText(2, QString::number(part.start / (1024.0 * 1024.0), 'f', 2)); // Start in MB
+        partItem->setText(3, QString::number(part.end / (1024.0 * 1024.0), 'f', 2));   // End in MB
+        partItem->setText(4, part.type);
+        partItem->setText(5, part.fileSystem);
+        partItem->setText(6, part.flags);
+
+        // Store internal data using User Roles (for reliable data retrieval later)
+        // Ensure you use consistent indices across displayDevices and getSelectedPartitionInfo
+        partItem->setData(0, Qt::UserRole + 0, part.number);        // Partition Number
+        partItem->setData(0, Qt::UserRole + 1, part.devicePath);    // Device Path (e.g., /dev/sda5)
+        partItem->setData(0, Qt::UserRole + 2, part.isFreeSpace);   // Is Free Space Flag
+        partItem->setData(0, Qt::UserRole + 3, part.size);          // Raw Size (bytes/double)
+        partItem->setData(0, Qt::UserRole + 4, part.start);        // Raw Start (bytes/MB/double)
+        partItem->setData(0, Qt::UserRole + 5, part.end);          // Raw End (bytes/MB/double)
+        partItem->setData(0, Qt::UserRole + 6, indexRow++);        // Row in topologyIndex
+        if (!part.isFreeSpace) {
+            ioItems.insert(QString("%1#%2").arg(dev.path).arg(part.number), partItem);
         }
     }
-    // Ensure all items are visible in their hierarchy
-    treeWidget->expandAll();
+    return devItem;
+}
+
+void MainWindow::removeIoItems(const QString& devicePath) {
+    const QString partitionPrefix = devicePath + "#";
+    for (auto it = ioItems.begin(); it != ioItems.end();) {
+        if (it.key() == devicePath || it.key().startsWith(partitionPrefix)) {
+            it = ioItems.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void MainWindow::expandItems(QTreeWidgetItem *item) {
+    item->setExpanded(true);
+    for (int child = 0; child < item->childCount(); ++child) {
+        if (item->child(child)->childCount() > 0) expandItems(item->child(child));
+    }
 }
 
 
@@ -183,33 +588,85 @@ QString MainWindow::getSelectedDevicePath() {
 
 
 void MainWindow::onCreatePartitionClicked() {
-    // Requires selecting a "Free Space" partition
+    const long long MiB = 1024 * 1024;
     PartitionInfo pInfo = getSelectedPartitionInfo();
+    QString devicePath = pInfo.devicePath.isEmpty() ? getSelectedDevicePath() : pInfo.devicePath;
+    const FreeSpaceMap *freeMap = freeSpaceIndex.device(devicePath);
+    QString suggestedType = "primary";
+
+    bool ok;
+    int desiredSizeMB = 0;
+
     if (pInfo.devicePath.isEmpty() || !pInfo.isFreeSpace) {
-        QMessageBox::warning(this, "Error", "Please select a 'Free Space' entry to create a new partition.");
-        return;
+        // No gap selected: ask for the size and offer the best fitting gaps of the device
+        if (!freeMap || !freeMap->largest()) {
+            QMessageBox::warning(this, "Error", "Please select a 'Free Space' entry or a device with free space to create a new partition.");
+            return;
+        }
+
+        long long largestMB = freeMap->largest()->alignedSize() / MiB;
+        desiredSizeMB = QInputDialog::getInt(
+            this,
+            "Create Partition",
+            QString("Enter desired size in MB (Largest aligned gap: %1 MB):").arg(largestMB),
+            largestMB,
+            1,
+            largestMB,
+            1,
+            &ok
+            );
+        if (!ok) return;
+
+        std::vector<const FreeExtent*> fits = freeMap->candidates((long long)desiredSizeMB * MiB);
+        QStringList choices;
+        for (const FreeExtent *gap : fits) {
+            choices << QString("%1 MB free at %2 MB%3")
+                           .arg(gap->alignedSize() / MiB)
+                           .arg(gap->alignedStart / MiB)
+                           .arg(gap->insideExtended ? " (inside extended, logical only)" : "");
+        }
+        QString choice = QInputDialog::getItem(this, "Create Partition", "Free space to use (best fit first):", choices, 0, false, &ok);
+        if (!ok || choice.isEmpty()) return;
+
+        const FreeExtent *gap = fits[choices.indexOf(choice)];
+        pInfo.devicePath = devicePath;
+        pInfo.isFreeSpace = true;
+        pInfo.start = gap->alignedStart / MiB;
+        pInfo.end = gap->alignedEnd / MiB;
+        if (gap->insideExtended) suggestedType = "logical";
+    } else if (freeMap) {
+        // Use the aligned part of the selected gap
+        long long rawStart = treeWidget->currentItem()->data(0, Qt::UserRole + 4).toLongLong();
+        for (const FreeExtent& gap : freeMap->extents()) {
+            if (gap.start == rawStart && gap.alignedSize() >= MiB) {
+                pInfo.start = gap.alignedStart / MiB;
+                pInfo.end = gap.alignedEnd / MiB;
+                if (gap.insideExtended) suggestedType = "logical";
+            }
+        }
     }
 
-    bool ok;
-    // Calculate total available free space size for the prompt (e.g., convert sectors to MB)
-    long long totalFreeSpaceMB = (pInfo.end - pInfo.start); // (1024 * 1024);
-    qDebug() << "pInfo.start: " << pInfo.start << "pInfo.end: " << pInfo.end << "totalFreeSpaceMB: "<< totalFreeSpaceMB;
+    if (desiredSizeMB == 0) {
+        // Calculate total available free space size for the prompt (e.g., convert sectors to MB)
+        long long totalFreeSpaceMB = (pInfo.end - pInfo.start); // (1024 * 1024);
+        qDebug() << "pInfo.start: " << pInfo.start << "pInfo.end: " << pInfo.end << "totalFreeSpaceMB: "<< totalFreeSpaceMB;
 
-    // 1. Get the desired size from the user
-    int desiredSizeMB = QInputDialog::getInt(
-        this,
-        "Create Partition",
-        QString("Enter desired size in MB (Max available: %1 MB):").arg(totalFreeSpaceMB),
-        totalFreeSpaceMB, // Default value
-        1,              // Minimum size
-        totalFreeSpaceMB, // Maximum size
-        1,              // Step
-        &ok
-        );
+        // 1. Get the desired size from the user
+        desiredSizeMB = QInputDialog::getInt(
+            this,
+            "Create Partition",
+            QString("Enter desired size in MB (Max available: %1 MB):").arg(totalFreeSpaceMB),
+            totalFreeSpaceMB, // Default value
+            1,              // Minimum size
+            totalFreeSpaceMB, // Maximum size
+            1,              // Step
+            &ok
+            );
 
-    if (!ok) {
-        // User cancelled the input dialog
-        return;
+        if (!ok) {
+            // User cancelled the input dialog
+            return;
+        }
     }
 
     // 2. Get the Partition type from the user
@@ -219,7 +676,7 @@ void MainWindow::onCreatePartitionClicked() {
         "Enter Partition Type (e.g., primary, extended, logical):<br>"
         "<span style=\"color:grey;\">Note: A logical partition must be created within <br>the extended partition.</span>",
         QLineEdit::Normal,
-        "primary",
+        suggestedType,
         &ok
         );
     if (!ok || PartitionType.isEmpty()) return;
@@ -276,7 +733,7 @@ void MainWindow::onCreatePartitionClicked() {
         // Assuming diskManager.createPartition uses start and end sectors
         //qDebug() << "fsType: " << fsType;
         if (diskManager.createPartition(pInfo.devicePath, pInfo.start, newEndMB, fsType, PartitionType)) {
-            QMessageBox::information(this, "Success", "Partition created. You may need to run 'partprobe' in terminal to update OS view.");
+            QMessageBox::information(this, "Success", "Partition created.");
             refreshDiskList();
         } else {
             QMessageBox::critical(this, "Failed", "Failed to create partition. Check root privileges and console output.");
@@ -297,8 +754,12 @@ void MainWindow::onDeletePartitionClicked() {
         return;
     }
 
+    if (!offerBackup(pInfo, "deleting")) {
+        return;
+    }
+
     if (diskManager.deletePartition(pInfo.devicePath, pInfo.number)) {
-        QMessageBox::information(this, "Success", "Partition deleted. You may need to run 'partprobe' in terminal to update OS view.");
+        QMessageBox::information(this, "Success", "Partition deleted.");
         refreshDiskList();
     } else {
         QMessageBox::critical(this, "Failed", "Failed to delete partition. Ensure it is unmounted and check root privileges.");
@@ -319,6 +780,11 @@ void MainWindow::onResizePartitionClicked() {
     qDebug() << "currentSizeGB: " << pInfo.start << "####" << pInfo.end;
     double newSizeMB = QInputDialog::getDouble(this, "Resize Partition", QString("Enter new size in MB (Current: %1 MB):").arg(currentSizeMB, 0, 'f', 2), currentSizeMB, 1.0, 100000.0, 2, &ok);
 
+    // Shrinking cuts off data at the end of the partition
+    if (ok && newSizeMB < currentSizeMB && !offerBackup(pInfo, "shrinking")) {
+        return;
+    }
+
     if (ok) {
         long long newEndBytes = pInfo.start + newSizeMB; // * 1024 * 1024 * 1024;
         if (diskManager.resizePartition(pInfo.devicePath, pInfo.number, newEndBytes)) {
@@ -373,5 +839,757 @@ void MainWindow::oncCreateDiskFlagClicked() {
     }
 }
 
+void MainWindow::onPlanLayoutClicked() {
+    // Works on a whole device, so the device row (or any of its partitions) must be selected
+    QString devicePath = getSelectedDevicePath();
+    if (devicePath.isEmpty()) {
+        QMessageBox::warning(this, "Error", "Please select a device to plan a partition layout for.");
+        return;
+    }
 
+    bool ok;
+    QString labelType = QInputDialog::getItem(
+        this,
+        "Plan Layout",
+        "Disk label type:",
+        QStringList() << "gpt" << "msdos",
+        0,
+        false,
+        &ok
+        );
+    if (!ok) return;
+
+    // 1. Get the declarative spec from the user
+    QString spec = QInputDialog::getMultiLineText(
+        this,
+        "Plan Layout",
+        "Enter one partition per line: name, size and optional file system/flags.<br>"
+        "<span style=\"color:grey;\">Sizes: 512M, 40G, 25%, RAM or rest. "
+        "Starts are aligned to the device's optimal I/O size.</span>",
+        "EFI 512M\nswap = RAM\nroot 40G\ndata = rest",
+        &ok
+        );
+    if (!ok || spec.trimmed().isEmpty()) return;
+
+    std::vector<LayoutEntry> entries;
+    QString error;
+    if (!LayoutPlanner::parseSpec(spec, entries, &error)) {
+        QMessageBox::warning(this, tr("Invalid Layout"), error);
+        return;
+    }
+
+    PedDevice *dev = diskManager.getDeviceFromPath(devicePath);
+    if (dev == nullptr) {
+        QMessageBox::critical(this, "Failed", "Device not found.");
+        return;
+    }
+
+    // 2. Solve sizes and alignment, then let the user confirm the exact sectors
+    LayoutPlan plan = LayoutPlanner::plan(dev, labelType, entries);
+    if (!plan.isValid()) {
+        QMessageBox::critical(this, "Failed", plan.error);
+        return;
+    }
 
+    if (QMessageBox::question(this, "Confirm Layout",
+                              QString("This replaces the whole partition table of %1:\n\n%2\nAll data on the device will be lost. Continue?")
+                                  .arg(devicePath).arg(plan.describe()),
+                              QMessageBox::Yes | QMessageBox::No) == QMessageBox::No) {
+        return;
+    }
+
+    // 3. Apply everything with a single commit
+    if (diskManager.applyLayout(plan)) {
+        QMessageBox::information(this, "Success", "Layout applied.");
+        refreshDiskList();
+    } else {
+        QMessageBox::critical(this, "Failed", "Failed to apply layout. Check root privileges and console output.");
+    }
+}
+
+void MainWindow::onReplicateLayoutClicked() {
+    // The selected device is the reference disk
+    QString sourcePath = getSelectedDevicePath();
+    if (sourcePath.isEmpty()) {
+        QMessageBox::warning(this, "Error", "Please select the reference device whose layout should be replicated.");
+        return;
+    }
+
+    // Only listed as a hint: the target list starts empty so accepting the
+    // dialog can never relabel a disk (e.g. the system disk) by default
+    QStringList candidates;
+    for (int i = 0; i < treeWidget->topLevelItemCount(); ++i) {
+        QString path = treeWidget->topLevelItem(i)->data(0, Qt::UserRole).toString();
+        if (!path.isEmpty() && path != sourcePath) {
+            candidates << path;
+        }
+    }
+
+    bool ok;
+    QString targetText = QInputDialog::getMultiLineText(
+        this,
+        "Replicate Layout",
+        QString("Target devices for the layout of %1, one per line:<br>"
+                "<span style=\"color:grey;\">Other devices: %2<br>"
+                "Note: The partition table of every target is replaced, busy targets are skipped.</span>")
+            .arg(sourcePath, candidates.isEmpty() ? QString("none") : candidates.join(", ")),
+        QString(),
+        &ok
+        );
+    if (!ok) return;
+
+    QStringList targets;
+    for (const QString& line : targetText.split('\n', Qt::SkipEmptyParts)) {
+        QString path = line.trimmed();
+        if (!path.isEmpty() && !targets.contains(path)) {
+            targets << path;
+        }
+    }
+    if (targets.isEmpty()) return;
+
+    QString mode = QInputDialog::getItem(
+        this,
+        "Replicate Layout",
+        "When a target differs in size from the reference:",
+        QStringList() << "Scale partitions proportionally" << "Fail",
+        0,
+        false,
+        &ok
+        );
+    if (!ok) return;
+    bool scale = mode.startsWith("Scale");
+
+    if (QMessageBox::question(this, "Confirm Replicate",
+                              QString("Replace the partition tables of %1 device(s) with the layout of %2? This will erase all data on them!")
+                                  .arg(targets.size()).arg(sourcePath),
+                              QMessageBox::Yes | QMessageBox::No) == QMessageBox::No) {
+        return;
+    }
+
+    // libparted is not thread safe: no other disk operation until it is done
+    setOperationsEnabled(false);
+    statusBar()->showMessage(QString("Replicating the layout of %1 onto %2 device(s)...").arg(sourcePath).arg(targets.size()));
+    replicationWatcher->setFuture(QtConcurrent::run([this, sourcePath, targets, scale]() {
+        return diskManager.replicateLayout(sourcePath, targets, scale);
+    }));
+}
+
+void MainWindow::onReplicationFinished() {
+    std::vector<ReplicationResult> results = replicationWatcher->result();
+    statusBar()->clearMessage();
+    setOperationsEnabled(true);
+
+    // Per-target report
+    int failed = 0;
+    QString report;
+    for (const ReplicationResult& result : results) {
+        if (!result.success) ++failed;
+        report += QString("%1: %2 - %3 (%4 ms)\n")
+                      .arg(result.devicePath)
+                      .arg(result.success ? "OK" : "FAILED")
+                      .arg(result.message)
+                      .arg(result.elapsedMs);
+    }
+
+    if (failed == 0) {
+        QMessageBox::information(this, "Success", report);
+    } else {
+        QMessageBox::warning(this, "Replicate Layout", QString("%1 of %2 targets failed:\n\n%3").arg(failed).arg(results.size()).arg(report));
+    }
+    refreshDiskList();
+}
+
+void MainWindow::onBackupPartitionClicked() {
+    PartitionInfo pInfo = getSelectedPartitionInfo();
+    if (pInfo.devicePath.isEmpty() || pInfo.isFreeSpace || pInfo.number <= 0) {
+        QMessageBox::warning(this, "Error", "Please select an active partition to back up.");
+        return;
+    }
+    backupPartition(pInfo);
+}
+
+// Asks whether to back up before a destructive operation.
+// Returns false if the operation should not go ahead.
+bool MainWindow::offerBackup(const PartitionInfo& pInfo, const QString& operation) {
+    QMessageBox::StandardButton answer = QMessageBox::question(
+        this,
+        "Backup",
+        QString("Create a backup image of Partition %1 before %2 it?").arg(pInfo.number).arg(operation),
+        QMessageBox::Yes | QMessageBox::No | QMessageBox::Cancel);
+
+    if (answer == QMessageBox::Cancel) return false;
+    if (answer == QMessageBox::No) return true;
+    return backupPartition(pInfo);
+}
+
+bool MainWindow::backupPartition(const PartitionInfo& pInfo) {
+    QString partPath = diskManager.partitionDevicePath(pInfo.devicePath, pInfo.number);
+    if (partPath.isEmpty()) {
+        QMessageBox::critical(this, "Failed", "Could not determine the device node of the partition.");
+        return false;
+    }
+
+    QString imagePath = QFileDialog::getSaveFileName(
+        this, "Save Partition Image",
+        QString("%1.pimg").arg(partPath.section('/', -1)),
+        "Partition images (*.pimg);;All files (*)");
+    if (imagePath.isEmpty()) return false;
+
+    QProgressDialog progressDialog(QString("Backing up %1...").arg(partPath), "Cancel", 0, 1000, this);
+    progressDialog.setWindowModality(Qt::WindowModal);
+    progressDialog.setMinimumDuration(0);
+
+    // Compression runs on the thread pool, the callback keeps the dialog responsive
+    auto progress = [&progressDialog](quint64 done, quint64 total) {
+        progressDialog.setValue(total ? (int)(done * 1000 / total) : 1000);
+        QCoreApplication::processEvents();
+        return !progressDialog.wasCanceled();
+    };
+
+    QString error;
+    ImageBackupOptions options;
+    if (!PartitionImage::backup(partPath, imagePath, options, &error, progress)) {
+        QMessageBox::critical(this, "Failed", QString("Backup failed: %1").arg(error));
+        return false;
+    }
+    progressDialog.setValue(1000);
+    QMessageBox::information(this, "Success", QString("Partition %1 saved to %2.").arg(partPath).arg(imagePath));
+    return true;
+}
+
+void MainWindow::onRestorePartitionClicked() {
+    PartitionInfo pInfo = getSelectedPartitionInfo();
+    if (pInfo.devicePath.isEmpty() || pInfo.isFreeSpace || pInfo.number <= 0) {
+        QMessageBox::warning(this, "Error", "Please select the partition to restore into.");
+        return;
+    }
+
+    QString partPath = diskManager.partitionDevicePath(pInfo.devicePath, pInfo.number);
+    if (partPath.isEmpty()) {
+        QMessageBox::critical(this, "Failed", "Could not determine the device node of the partition.");
+        return;
+    }
+
+    QString imagePath = QFileDialog::getOpenFileName(
+        this, "Open Partition Image", QString(), "Partition images (*.pimg);;All files (*)");
+    if (imagePath.isEmpty()) return;
+
+    if (QMessageBox::question(this, "Confirm Restore", QString("Overwrite %1 with the contents of %2? This will erase all data!").arg(partPath).arg(imagePath), QMessageBox::Yes | QMessageBox::No) == QMessageBox::No) {
+        return;
+    }
+
+    QProgressDialog progressDialog(QString("Restoring %1...").arg(partPath), "Cancel", 0, 1000, this);
+    progressDialog.setWindowModality(Qt::WindowModal);
+    progressDialog.setMinimumDuration(0);
+
+    auto progress = [&progressDialog](quint64 done, quint64 total) {
+        progressDialog.setValue(total ? (int)(done * 1000 / total) : 1000);
+        QCoreApplication::processEvents();
+        return !progressDialog.wasCanceled();
+    };
+
+    QString error;
+    if (!PartitionImage::restore(imagePath, partPath, &error, progress)) {
+        QMessageBox::critical(this, "Failed", QString("Restore failed: %1").arg(error));
+        return;
+    }
+    progressDialog.setValue(1000);
+
+    // Read the target back and compare it with the chunk checksums of the image
+    VerifyResult verify;
+    runInBackground(QString("Verifying %1...").arg(partPath),
+                    [&]() { verify = PartitionVerifier::verifyImage(imagePath, partPath); });
+
+    if (verify.success) {
+        QMessageBox::information(this, "Success", QString("%1 restored from %2 and verified (%3 MB read in %4 ms).")
+                                     .arg(partPath).arg(imagePath)
+                                     .arg(verify.bytesRead / (1024 * 1024)).arg(verify.elapsedMs));
+    } else if (!verify.error.isEmpty()) {
+        QMessageBox::warning(this, "Restore", QString("%1 restored, but verification failed: %2").arg(partPath).arg(verify.error));
+    } else if (QMessageBox::question(this, "Restore",
+                                     QString("%1 chunk(s) of %2 differ from the image. Rewrite them?")
+                                         .arg(verify.mismatchedChunks.size()).arg(partPath),
+                                     QMessageBox::Yes | QMessageBox::No) == QMessageBox::Yes) {
+        int repaired = 0;
+        for (quint64 chunk : verify.mismatchedChunks) {
+            if (PartitionImage::restoreChunk(imagePath, partPath, chunk, &error)) ++repaired;
+        }
+        QMessageBox::information(this, "Restore", QString("%1 of %2 chunk(s) rewritten.").arg(repaired).arg(verify.mismatchedChunks.size()));
+    }
+    refreshDiskList();
+}
+
+void MainWindow::runInBackground(const QString& label, const std::function<void()>& work) {
+    // Long reads (hashing, verification) keep the window responsive behind a busy dialog
+    QProgressDialog busy(label, QString(), 0, 0, this);
+    busy.setWindowModality(Qt::WindowModal);
+    busy.setMinimumDuration(0);
+    QFutureWatcher<void> watcher;
+    connect(&watcher, &QFutureWatcher<void>::finished, &busy, &QDialog::accept);
+    watcher.setFuture(QtConcurrent::run(work));
+    busy.exec();
+    watcher.waitForFinished();
+}
+
+void MainWindow::onVerifyPartitionClicked() {
+    PartitionInfo pInfo = getSelectedPartitionInfo();
+    if (pInfo.devicePath.isEmpty() || pInfo.isFreeSpace || pInfo.number <= 0) {
+        QMessageBox::warning(this, "Error", "Please select an active partition to verify.");
+        return;
+    }
+
+    QString partPath = diskManager.partitionDevicePath(pInfo.devicePath, pInfo.number);
+    if (partPath.isEmpty()) {
+        QMessageBox::critical(this, "Failed", "Could not determine the device node of the partition.");
+        return;
+    }
+
+    // A new digest file records the current state, an existing one is verified against
+    QString digestPath = QFileDialog::getSaveFileName(
+        this, "Partition Digest File",
+        QString("%1.digests").arg(partPath.section('/', -1)),
+        "Digest files (*.digests);;All files (*)",
+        nullptr,
+        QFileDialog::DontConfirmOverwrite);
+    if (digestPath.isEmpty()) return;
+
+    QString error;
+    ChunkDigests digests;
+    if (!QFileInfo::exists(digestPath)) {
+        bool hashed = false;
+        runInBackground(QString("Reading %1...").arg(partPath), [&]() {
+            hashed = PartitionVerifier::hash(partPath, 0, 0, PartitionVerifier::kDefaultChunkSize, digests, &error) &&
+                     digests.save(digestPath, &error);
+        });
+        if (hashed) {
+            // Writes to the partition mark their chunks dirty in the file from now on
+            PartitionVerifier::registerDigests(pInfo.devicePath, partPath, digestPath);
+            QMessageBox::information(this, "Verify", QString("Recorded %1 chunk digests of %2 (crc32c: %3).")
+                                         .arg(digests.chunkCount()).arg(partPath).arg(Checksum::crc32cImplementation()));
+        } else {
+            QMessageBox::critical(this, "Failed", error);
+        }
+        return;
+    }
+
+    if (!digests.load(digestPath, &error)) {
+        QMessageBox::critical(this, "Failed", error);
+        return;
+    }
+    PartitionVerifier::registerDigests(pInfo.devicePath, partPath, digestPath);
+
+    // Chunks written since the digests were taken are re-read and recorded,
+    // nothing else is read. Without dirty chunks everything is compared.
+    quint64 dirtyChunks = digests.dirtyCount();
+    if (dirtyChunks > 0) {
+        VerifyResult refreshed;
+        runInBackground(QString("Reading the dirty chunks of %1...").arg(partPath), [&]() {
+            refreshed = PartitionVerifier::refresh(partPath, digests);
+            if (refreshed.success) digests.save(digestPath, &error);
+        });
+        if (!refreshed.success) {
+            QMessageBox::critical(this, "Failed", refreshed.error);
+        } else {
+            QMessageBox::information(this, "Verify", QString("%1 dirty chunk(s) of %2 re-read in %3 ms, %4 of them changed. "
+                                                             "The digests are up to date, verify again for a full check.")
+                                         .arg(dirtyChunks).arg(partPath).arg(refreshed.elapsedMs)
+                                         .arg(refreshed.mismatchedChunks.size()));
+        }
+        return;
+    }
+
+    VerifyResult result;
+    runInBackground(QString("Reading %1...").arg(partPath), [&]() { result = PartitionVerifier::verify(partPath, digests); });
+
+    if (!result.error.isEmpty()) {
+        QMessageBox::critical(this, "Failed", result.error);
+    } else if (result.success) {
+        QMessageBox::information(this, "Verify", QString("%1 matches %2 (%3 MB in %4 ms).")
+                                     .arg(partPath).arg(digestPath)
+                                     .arg(result.bytesRead / (1024 * 1024)).arg(result.elapsedMs));
+    } else {
+        QMessageBox::warning(this, "Verify", QString("%1 of %2 chunks of %3 differ from the recorded digests.")
+                                 .arg(result.mismatchedChunks.size()).arg(digests.chunkCount()).arg(partPath));
+    }
+}
+
+void MainWindow::onRescueScanClicked() {
+    const long long MiB = 1024 * 1024;
+    QString devicePath = getSelectedDevicePath();
+    const DeviceInfo *device = nullptr;
+    for (const DeviceInfo& dev : lastDevices) {
+        if (dev.path == devicePath) device = &dev;
+    }
+    if (!device) {
+        QMessageBox::warning(this, "Error", "Please select the device to scan for lost partitions.");
+        return;
+    }
+
+    // Lost partitions usually sit in what the table now calls free space;
+    // a device without a readable table is scanned completely.
+    RescueScanOptions options;
+    options.sectorSize = device->sectorSize;
+    const FreeSpaceMap *freeMap = freeSpaceIndex.device(devicePath);
+    bool hasTable = freeMap && !device->partitions.empty();
+    if (hasTable) {
+        QStringList scopes = {"Unallocated space only", "Whole device"};
+        bool ok;
+        QString scope = QInputDialog::getItem(this, "Rescue Scan", "Search for lost partitions in:", scopes, 0, false, &ok);
+        if (!ok) return;
+        if (scope == scopes.first()) {
+            for (const FreeExtent& extent : freeMap->extents()) {
+                // Gaps inside and outside the extended partition can touch
+                if (!options.ranges.empty() && options.ranges.back().second == extent.start) {
+                    options.ranges.back().second = extent.end;
+                } else {
+                    options.ranges.push_back(std::make_pair((qint64)extent.start, (qint64)extent.end));
+                }
+            }
+            if (options.ranges.empty()) {
+                QMessageBox::information(this, "Rescue Scan", QString("%1 has no unallocated space.").arg(devicePath));
+                return;
+            }
+        }
+    }
+
+    QProgressDialog progressDialog(QString("Scanning %1 for lost partitions...").arg(devicePath), "Cancel", 0, 1000, this);
+    progressDialog.setWindowModality(Qt::WindowModal);
+    progressDialog.setMinimumDuration(0);
+
+    auto progress = [&progressDialog](quint64 done, quint64 total) {
+        progressDialog.setValue(total ? (int)(done * 1000 / total) : 1000);
+        QCoreApplication::processEvents();
+        return !progressDialog.wasCanceled();
+    };
+
+    RescueScanResult result = RescueScanner::scan(devicePath, options, progress);
+    progressDialog.setValue(1000);
+    if (result.candidates.empty()) {
+        QString message = !result.error.isEmpty() ? result.error
+                        : result.cancelled        ? QString("Scan cancelled, no lost partitions found so far.")
+                                                  : QString("No lost partitions found on %1.").arg(devicePath);
+        QMessageBox::information(this, "Rescue Scan", message);
+        return;
+    }
+
+    // Candidates that overlap a partition of the current table can be looked
+    // at, but not recreated
+    auto overlapsExisting = [device](const RescueCandidate& candidate) {
+        for (const PartitionInfo& part : device->partitions) {
+            if (part.isFreeSpace || part.isExtendedContainer) continue;
+            long long end = part.end + device->sectorSize; // end is the start of the last sector
+            if (candidate.start < end && part.start < candidate.end()) return true;
+        }
+        return false;
+    };
+
+    QDialog dialog(this);
+    dialog.setWindowTitle("Rescue Scan");
+    QVBoxLayout *layout = new QVBoxLayout(&dialog);
+    QString summary = QString("%1 MB scanned in %2 ms.").arg(result.bytesScanned / MiB).arg(result.elapsedMs);
+    if (result.cancelled) summary += " The scan was cancelled, the list may be incomplete.";
+    if (!result.error.isEmpty()) summary += " " + result.error;
+    layout->addWidget(new QLabel(summary + "\nCheck the partitions to recreate. Their contents are not touched.", &dialog));
+
+    bool anyGpt = std::any_of(result.candidates.begin(), result.candidates.end(),
+                              [](const RescueCandidate& candidate) { return candidate.source.contains("GPT"); });
+    QListWidget *list = new QListWidget(&dialog);
+    for (const RescueCandidate& candidate : result.candidates) {
+        QString text = QString("%1 MB - %2 MB  %3 GB  %4%5  (%6)")
+                           .arg(candidate.start / MiB).arg(candidate.end() / MiB)
+                           .arg(QString::number(candidate.length / double(1024 * MiB), 'f', 2))
+                           .arg(candidate.fileSystem.isEmpty() ? "unknown" : candidate.fileSystem)
+                           .arg(candidate.label.isEmpty() ? QString() : QString(" '%1'").arg(candidate.label))
+                           .arg(candidate.source);
+        QListWidgetItem *item = new QListWidgetItem(text, list);
+        if (overlapsExisting(candidate)) {
+            item->setText(text + "  [overlaps an existing partition]");
+            item->setFlags(item->flags() & ~(Qt::ItemIsUserCheckable | Qt::ItemIsEnabled));
+        } else {
+            item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
+            // Logical partitions cannot live on the GPT label the rest is recreated with
+            bool recreatable = !(candidate.logical && anyGpt);
+            item->setCheckState(candidate.confidence > 1 && recreatable ? Qt::Checked : Qt::Unchecked);
+        }
+    }
+    layout->addWidget(list);
+
+    QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, &dialog);
+    buttons->button(QDialogButtonBox::Ok)->setText("Recreate");
+    connect(buttons, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+    connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+    layout->addWidget(buttons);
+    dialog.resize(800, 300);
+    if (dialog.exec() != QDialog::Accepted) return;
+
+    QStringList failed;
+    int recreated = 0;
+    const QString labelType = anyGpt ? "gpt" : "msdos";
+
+    // An accidental delete of the extended partition takes the container with
+    // it: recreate it from the first EBR to the end of the last logical one
+    bool hasExtended = std::any_of(device->partitions.begin(), device->partitions.end(),
+                                   [](const PartitionInfo& part) { return part.isExtendedContainer; });
+    qint64 extendedStart = -1;
+    qint64 extendedEnd = -1;
+    for (int i = 0; i < list->count(); ++i) {
+        const RescueCandidate& candidate = result.candidates[i];
+        if (list->item(i)->checkState() != Qt::Checked || !candidate.logical || candidate.ebrOffset < 0) continue;
+        extendedStart = extendedStart < 0 ? candidate.ebrOffset : qMin(extendedStart, candidate.ebrOffset);
+        extendedEnd = qMax(extendedEnd, candidate.end());
+    }
+    if (!hasExtended && extendedStart >= 0) {
+        long long startSector = extendedStart / device->sectorSize;
+        long long endSector = (extendedEnd + device->sectorSize - 1) / device->sectorSize - 1;
+        if (diskManager.recreatePartition(devicePath, startSector, endSector, QString(), PED_PARTITION_EXTENDED,
+                                          QString(), labelType)) {
+            ++recreated;
+        } else {
+            failed << QString("Extended partition at sectors %1-%2 for the logical partitions").arg(startSector).arg(endSector);
+        }
+    }
+
+    for (int i = 0; i < list->count(); ++i) {
+        if (list->item(i)->checkState() != Qt::Checked) continue;
+        const RescueCandidate& candidate = result.candidates[i];
+        long long startSector = candidate.start / device->sectorSize;
+        long long endSector = (candidate.end() + device->sectorSize - 1) / device->sectorSize - 1;
+        if (diskManager.recreatePartition(devicePath, startSector, endSector, candidate.fileSystem,
+                                          candidate.logical ? PED_PARTITION_LOGICAL : PED_PARTITION_NORMAL,
+                                          candidate.label, labelType)) {
+            ++recreated;
+        } else {
+            failed << list->item(i)->text();
+        }
+    }
+
+    refreshDiskList();
+    if (failed.isEmpty()) {
+        QMessageBox::information(this, "Rescue Scan", QString("%1 partition(s) recreated.").arg(recreated));
+    } else {
+        QMessageBox::warning(this, "Rescue Scan", QString("%1 partition(s) recreated, these failed:\n%2")
+                                 .arg(recreated).arg(failed.join("\n")));
+    }
+}
+
+void MainWindow::onSurfaceScanClicked() {
+    QString devicePath = getSelectedDevicePath();
+    const DeviceInfo *device = nullptr;
+    for (const DeviceInfo& dev : lastDevices) {
+        if (dev.path == devicePath) device = &dev;
+    }
+    if (!device) {
+        QMessageBox::warning(this, "Error", "Please select a device or partition to scan.");
+        return;
+    }
+
+    // The selected partition or gap, otherwise the whole device. Offsets stay
+    // device relative so the results map onto every partition.
+    SurfaceScanOptions options;
+    options.sectorSize = device->sectorSize;
+    QString scope = devicePath;
+    QTreeWidgetItem *current = treeWidget->currentItem();
+    if (current && current->parent() != nullptr && current->data(0, Qt::UserRole + 3).isValid()) {
+        options.offset = current->data(0, Qt::UserRole + 4).toLongLong();
+        options.length = current->data(0, Qt::UserRole + 5).toLongLong() + device->sectorSize - options.offset;
+        scope = QString("%1 %2").arg(devicePath).arg(current->text(0));
+    }
+
+    surfaceScanControl = std::make_shared<SurfaceScanControl>();
+    std::shared_ptr<SurfaceScanControl> control = surfaceScanControl;
+    surfaceScanButton->setEnabled(false);
+
+    // Modeless: a scan of a large disk runs for hours and the rest of the
+    // window stays usable meanwhile
+    surfaceScanDialog = new QDialog(this);
+    surfaceScanDialog->setWindowTitle("Surface Scan");
+    surfaceScanDialog->setAttribute(Qt::WA_DeleteOnClose);
+    QVBoxLayout *layout = new QVBoxLayout(surfaceScanDialog);
+    QLabel *status = new QLabel(QString("Reading %1...").arg(scope), surfaceScanDialog);
+    QProgressBar *progressBar = new QProgressBar(surfaceScanDialog);
+    progressBar->setRange(0, 1000);
+    layout->addWidget(status);
+    layout->addWidget(progressBar);
+
+    QHBoxLayout *controls = new QHBoxLayout();
+    QComboBox *rateBox = new QComboBox(surfaceScanDialog);
+    rateBox->addItem("Unlimited", 0);
+    for (int mbPerSecond : {400, 200, 100, 50, 20}) {
+        rateBox->addItem(QString("%1 MB/s").arg(mbPerSecond), mbPerSecond);
+    }
+    QPushButton *pauseButton = new QPushButton("Pause", surfaceScanDialog);
+    QPushButton *cancelButton = new QPushButton("Cancel", surfaceScanDialog);
+    controls->addWidget(new QLabel("Limit:", surfaceScanDialog));
+    controls->addWidget(rateBox);
+    controls->addStretch();
+    controls->addWidget(pauseButton);
+    controls->addWidget(cancelButton);
+    layout->addLayout(controls);
+
+    connect(rateBox, QOverload<int>::of(&QComboBox::currentIndexChanged), surfaceScanDialog, [control, rateBox](int index) {
+        control->setRateLimit((quint64)rateBox->itemData(index).toInt() * 1024 * 1024);
+    });
+    connect(pauseButton, &QPushButton::clicked, surfaceScanDialog, [control, pauseButton]() {
+        if (control->isPaused()) {
+            control->resume();
+            pauseButton->setText("Pause");
+        } else {
+            control->pause();
+            pauseButton->setText("Resume");
+        }
+    });
+    connect(cancelButton, &QPushButton::clicked, surfaceScanDialog, [control]() { control->cancel(); });
+    connect(surfaceScanDialog, &QDialog::rejected, surfaceScanDialog, [control]() { control->cancel(); });
+
+    QTimer *timer = new QTimer(surfaceScanDialog);
+    std::shared_ptr<QElapsedTimer> clock = std::make_shared<QElapsedTimer>();
+    clock->start();
+    connect(timer, &QTimer::timeout, surfaceScanDialog, [control, progressBar, status, scope, clock]() {
+        quint64 done = control->bytesDone();
+        quint64 total = control->bytesTotal();
+        progressBar->setValue(total ? (int)(done * 1000 / total) : 0);
+        double seconds = clock->elapsed() / 1000.0;
+        status->setText(QString("%1: %2 of %3 MB, %4 MB/s average, %5 unreadable sector(s)%6")
+                            .arg(scope)
+                            .arg(done / (1024 * 1024)).arg(total / (1024 * 1024))
+                            .arg(seconds > 0 ? done / (1024.0 * 1024.0) / seconds : 0.0, 0, 'f', 0)
+                            .arg(control->badSectors())
+                            .arg(control->isPaused() ? " - paused" : ""));
+    });
+    timer->start(250);
+    surfaceScanDialog->show();
+
+    surfaceScanWatcher->setFuture(QtConcurrent::run([devicePath, options, control]() {
+        return SurfaceScanner::scan(devicePath, options, *control);
+    }));
+}
+
+void MainWindow::onSurfaceScanFinished() {
+    SurfaceScanResult result = surfaceScanWatcher->result();
+    surfaceScanControl.reset();
+    surfaceScanButton->setEnabled(true);
+    if (surfaceScanDialog) {
+        surfaceScanDialog->close();
+        surfaceScanDialog = nullptr;
+    }
+    Metrics::flush();
+
+    if (!result.error.isEmpty()) {
+        QMessageBox::critical(this, "Surface Scan", result.error);
+        return;
+    }
+    surfaceScans.insert(result.devicePath, result);
+    markSurfaceScan(result);
+
+    DeviceInfo device;
+    for (const DeviceInfo& dev : lastDevices) {
+        if (dev.path == result.devicePath) device = dev;
+    }
+
+    // Per partition summary of what was read
+    QStringList lines;
+    lines << QString("%1: %2 MB read in %3 s%4, %5 unreadable sector(s), %6 block(s) slower than the threshold.")
+                 .arg(result.devicePath)
+                 .arg(result.bytesScanned / (1024 * 1024))
+                 .arg(result.elapsedMs / 1000.0, 0, 'f', 1)
+                 .arg(result.cancelled ? " (cancelled)" : "")
+                 .arg(result.badSectorCount())
+                 .arg(result.slowBlocks.size());
+    if (!result.direct) lines << "O_DIRECT was not available, cached data may hide slow or bad sectors.";
+    for (const PartitionInfo& part : device.partitions) {
+        if (part.isFreeSpace || part.isExtendedContainer) continue;
+        quint64 end = part.end + device.sectorSize;
+        float worst = result.worstLatencyIn(part.start, end);
+        if (worst < 0) continue; // not in the scanned range
+        lines << QString("Partition %1: %2 unreadable sector(s), worst read %3 ms")
+                     .arg(part.number).arg(result.badSectorsIn(part.start, end)).arg(worst, 0, 'f', 1);
+    }
+    for (const BadSectorRange& range : result.badRanges) {
+        if (lines.size() > 40) {
+            lines << "...";
+            break;
+        }
+        lines << QString("Unreadable: sectors %1-%2").arg(range.offset / result.sectorSize)
+                     .arg((range.offset + range.length) / result.sectorSize - 1);
+    }
+
+    QDialog dialog(this);
+    dialog.setWindowTitle("Surface Scan");
+    QVBoxLayout *layout = new QVBoxLayout(&dialog);
+    LatencyHeatmap *heatmap = new LatencyHeatmap(&dialog);
+    heatmap->setResult(result, device);
+    layout->addWidget(heatmap);
+    QLabel *summary = new QLabel(lines.join("\n"), &dialog);
+    summary->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    layout->addWidget(summary);
+    QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Close, &dialog);
+    connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+    layout->addWidget(buttons);
+    dialog.resize(800, 200);
+    dialog.exec();
+}
+
+// Colours the device and partition rows the scan found problems in
+void MainWindow::markSurfaceScan(const SurfaceScanResult& result) {
+    for (const DeviceInfo& dev : lastDevices) {
+        if (dev.path != result.devicePath) continue;
+
+        if (QTreeWidgetItem *devItem = ioItems.value(dev.path)) {
+            devItem->setToolTip(0, QString("Surface scan: %1 unreadable sector(s), %2 slow block(s)")
+                                       .arg(result.badSectorCount()).arg(result.slowBlocks.size()));
+            if (result.badSectorCount()) devItem->setForeground(0, Qt::red);
+        }
+        for (const PartitionInfo& part : dev.partitions) {
+            QTreeWidgetItem *item = ioItems.value(QString("%1#%2").arg(dev.path).arg(part.number));
+            if (!item || part.isFreeSpace) continue;
+            quint64 end = part.end + dev.sectorSize;
+            float worst = result.worstLatencyIn(part.start, end);
+            if (worst < 0) continue;
+            quint64 bad = result.badSectorsIn(part.start, end);
+            item->setToolTip(0, QString("Surface scan: %1 unreadable sector(s), worst read %2 ms")
+                                    .arg(bad).arg(worst, 0, 'f', 1));
+            if (bad) item->setForeground(0, Qt::red);
+        }
+    }
+}
+
+// Hides the rows that do not match the filter; items are never rebuilt
+void MainWindow::applyFilter() {
+    QElapsedTimer timer;
+    timer.start();
+    RowSet matches;
+    QString error;
+    if (!topologyIndex.query(filterEdit->text(), &matches, &error)) {
+        statusBar()->showMessage(error); // keep the last valid filter while typing
+        return;
+    }
+    qint64 queryUs = timer.nsecsElapsed() / 1000;
+
+    // Device and extended container rows stay visible while a row below matches
+    std::function<bool(QTreeWidgetItem*)> update = [&](QTreeWidgetItem *item) {
+        bool visible = false;
+        for (int i = 0; i < item->childCount(); ++i) {
+            visible = update(item->child(i)) || visible;
+        }
+        QVariant row = item->data(0, Qt::UserRole + 6);
+        if (row.isValid() && row.toInt() < matches.size()) {
+            visible = visible || matches.test(row.toInt());
+        } else if (item->childCount() == 0) {
+            visible = true;
+        }
+        if (item->isHidden() == visible) item->setHidden(!visible);
+        return visible;
+    };
+
+    treeWidget->setUpdatesEnabled(false);
+    for (int i = 0; i < treeWidget->topLevelItemCount(); ++i) {
+        update(treeWidget->topLevelItem(i));
+    }
+    treeWidget->setUpdatesEnabled(true);
+
+    if (!filterEdit->text().isEmpty()) {
+        statusBar()->showMessage(QString("%1 of %2 rows match (query %3 µs, total %4 µs)")
+                                     .arg(matches.count()).arg(matches.size())
+                                     .arg(queryUs).arg(timer.nsecsElapsed() / 1000));
+    }
+}
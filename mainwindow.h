@@ -4,7 +4,21 @@
 #include <QMainWindow>
 #include <QTreeWidget>
 #include <QPushButton>
+#include <QFutureWatcher>
+#include <QComboBox>
+#include <QDialog>
+#include <QLineEdit>
+#include <QPointer>
+#include <QThread>
 #include "diskmanager.h"
+#include "diskmapbar.h"
+#include "freespacemap.h"
+#include "topologycache.h"
+#include "iostats.h"
+#include "surfacescanner.h"
+#include "topologyindex.h"
+#include <functional>
+#include <memory>
 
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -13,12 +27,32 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+    // Shows a scanned topology in the tree, the map bar and the indexes
+    // (also timed by the --stress harness)
+    void showTopology(const std::vector<DeviceInfo>& devices);
+    // Blocks until the background check of the cached topology is done
+    void waitForRevalidation();
+
 private slots:
     void refreshDiskList();
     void onCreatePartitionClicked();
     void onDeletePartitionClicked();
     void onResizePartitionClicked();
     void oncCreateDiskFlagClicked();
+    void onPlanLayoutClicked();
+    void onReplicateLayoutClicked();
+    void onReplicationFinished();
+    void onBackupPartitionClicked();
+    void onRestorePartitionClicked();
+    void onVerifyPartitionClicked();
+    void onRescueScanClicked();
+    void onSurfaceScanClicked();
+    void onSurfaceScanFinished();
+    void applyFilter();
+    void onCurrentItemChanged(QTreeWidgetItem *current);
+    void onRevalidationFinished();
+    void onIoSamples(const QVector<IoSample>& samples);
+    void onIoIntervalChanged(int index);
 
 private:
     DiskManager diskManager;
@@ -28,9 +62,48 @@ private:
     QPushButton *deleteButton;
     QPushButton *resizeButton;
     QPushButton *createDiskLabelButton;
+    QPushButton *planLayoutButton;
+    QPushButton *replicateLayoutButton;
+    QPushButton *backupButton;
+    QPushButton *restoreButton;
+    QPushButton *verifyButton;
+    QPushButton *rescueButton;
+    QPushButton *surfaceScanButton;
+    DiskMapBar *diskMapBar;
+    FreeSpaceIndex freeSpaceIndex;
+    std::vector<DeviceInfo> lastDevices; // result of the last scan
+    std::vector<CachedDevice> cachedTopology; // lastDevices with their fingerprints
+    QFutureWatcher<TopologyRevalidation> *revalidationWatcher;
+    QFutureWatcher<std::vector<ReplicationResult>> *replicationWatcher;
+    qint64 cacheSavedAtMs = 0;
+    QComboBox *ioIntervalBox;
+    QThread *ioStatsThread;
+    IoStatsSampler *ioStatsSampler;        // lives on ioStatsThread
+    QHash<QString, QTreeWidgetItem*> ioItems; // sampler key -> row, kept by createDeviceItem/removeIoItems
+    QFutureWatcher<SurfaceScanResult> *surfaceScanWatcher;
+    std::shared_ptr<SurfaceScanControl> surfaceScanControl; // of the running scan
+    QPointer<QDialog> surfaceScanDialog; // null once the dialog deleted itself on close
+    QHash<QString, SurfaceScanResult> surfaceScans; // last result per device, marked in the tree
+    QLineEdit *filterEdit;
+    TopologyIndex topologyIndex; // rows of lastDevices, items carry their row in Qt::UserRole + 6
 
     void displayDevices(const std::vector<DeviceInfo>& devices);
+    void showTopologyChanges(const std::vector<DeviceInfo>& devices, const QStringList& changedPaths);
+    void updateTopologyIndexes(const std::vector<DeviceInfo>& devices);
+    void updateDeviceItems(const std::vector<DeviceInfo>& devices, const QStringList& changedPaths);
+    QTreeWidgetItem *createDeviceItem(const DeviceInfo& dev, int firstRow);
+    void removeIoItems(const QString& devicePath);
+    void expandItems(QTreeWidgetItem *item);
+    void startRevalidation();
+    void setTopologyStale(bool stale);
+    void setOperationsEnabled(bool enabled);
+    void saveTopologyCache();
+    void updateIoTargets(const std::vector<DeviceInfo>& devices);
+    void markSurfaceScan(const SurfaceScanResult& result);
     PartitionInfo getSelectedPartitionInfo();
     QString getSelectedDevicePath();
+    bool backupPartition(const PartitionInfo& pInfo);
+    bool offerBackup(const PartitionInfo& pInfo, const QString& operation);
+    void runInBackground(const QString& label, const std::function<void()>& work);
 };
 #endif // MAINWINDOW_H
@@ -0,0 +1,231 @@
+#include "metrics.h"
+#include "logger.h"
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QTextStream>
+#include <chrono>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+std::atomic<bool> Metrics::detail::enabled(false);
+
+namespace {
+
+// Bucket i counts calls that took at most 2^i microseconds, the last one is +Inf
+const int kBucketCount = 26;
+const size_t kMaxTraceEvents = 500000;
+
+struct Series {
+    quint64 buckets[kBucketCount] = {};
+    quint64 count = 0;
+    quint64 errors = 0;
+    qint64 sumNs = 0;
+    qint64 maxNs = 0;
+};
+
+struct TraceEvent {
+    const char *name;
+    QString device;
+    qint64 startNs;
+    qint64 durationNs;
+    int thread;
+    bool ok;
+};
+
+// One series per operation and device, calls without a device share ""
+typedef std::pair<std::string, QString> SeriesKey;
+
+struct State {
+    QMutex mutex;
+    std::map<SeriesKey, Series> series;
+    std::vector<TraceEvent> events;
+    bool traceEnabled = false;
+    QString prometheusPath;
+    QString jsonPath;
+    QString tracePath;
+};
+
+State& state() {
+    static State instance;
+    return instance;
+}
+
+const std::chrono::steady_clock::time_point processStart = std::chrono::steady_clock::now();
+
+// Small sequential ids read better in a trace viewer than pthread ids
+int threadId() {
+    static std::atomic<int> nextId(1);
+    thread_local int id = nextId.fetch_add(1);
+    return id;
+}
+
+int bucketFor(qint64 durationNs) {
+    qint64 us = (durationNs + 999) / 1000;
+    int bucket = 0;
+    while (bucket < kBucketCount - 1 && (1LL << bucket) < us) {
+        ++bucket;
+    }
+    return bucket;
+}
+
+QString jsonEscape(const QString& text) {
+    QString escaped = text;
+    escaped.replace("\\", "\\\\");
+    escaped.replace("\"", "\\\"");
+    return escaped;
+}
+
+// Prometheus label values escape the same characters as JSON strings (plus newlines)
+QString seriesLabels(const SeriesKey& key) {
+    QString device = jsonEscape(key.second);
+    device.replace("\n", "\\n");
+    return QString("op=\"%1\",device=\"%2\"").arg(jsonEscape(QString::fromStdString(key.first)), device);
+}
+
+} // namespace
+
+void Metrics::setEnabled(bool on) {
+    detail::enabled.store(on, std::memory_order_relaxed);
+}
+
+void Metrics::setTraceEnabled(bool on) {
+    QMutexLocker locker(&state().mutex);
+    state().traceEnabled = on;
+}
+
+void Metrics::configureFromEnvironment() {
+    State& s = state();
+    s.prometheusPath = qEnvironmentVariable("PARTED_EXPLORER_METRICS");
+    s.jsonPath = qEnvironmentVariable("PARTED_EXPLORER_METRICS_JSON");
+    s.tracePath = qEnvironmentVariable("PARTED_EXPLORER_TRACE");
+
+    setTraceEnabled(!s.tracePath.isEmpty());
+    setEnabled(!s.prometheusPath.isEmpty() || !s.jsonPath.isEmpty() || !s.tracePath.isEmpty());
+}
+
+qint64 Metrics::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - processStart).count();
+}
+
+void Metrics::record(const char *name, const QString& device, qint64 startNs, qint64 durationNs, bool ok) {
+    State& s = state();
+    QMutexLocker locker(&s.mutex);
+
+    Series& series = s.series[SeriesKey(name, device)];
+    series.buckets[bucketFor(durationNs)]++;
+    series.count++;
+    series.sumNs += durationNs;
+    if (durationNs > series.maxNs) series.maxNs = durationNs;
+    if (!ok) series.errors++;
+
+    if (s.traceEnabled && s.events.size() < kMaxTraceEvents) {
+        s.events.push_back(TraceEvent{name, device, startNs, durationNs, threadId(), ok});
+    }
+}
+
+void Metrics::reset() {
+    QMutexLocker locker(&state().mutex);
+    state().series.clear();
+    state().events.clear();
+}
+
+bool Metrics::writePrometheus(const QString& path) {
+    // QSaveFile renames into place, the textfile collector never sees half a file
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) return false;
+    QTextStream out(&file);
+
+    QMutexLocker locker(&state().mutex);
+    out << "# HELP parted_explorer_call_duration_seconds Duration of DiskManager, libparted and I/O calls.\n";
+    out << "# TYPE parted_explorer_call_duration_seconds histogram\n";
+    for (const auto& entry : state().series) {
+        const QString labels = seriesLabels(entry.first);
+        const Series& series = entry.second;
+        quint64 cumulative = 0;
+        for (int i = 0; i < kBucketCount; ++i) {
+            cumulative += series.buckets[i];
+            QString le = (i == kBucketCount - 1) ? QString("+Inf") : QString::number((1LL << i) / 1e6, 'g', 10);
+            out << "parted_explorer_call_duration_seconds_bucket{" << labels << ",le=\"" << le << "\"} " << cumulative << "\n";
+        }
+        out << "parted_explorer_call_duration_seconds_sum{" << labels << "} " << QString::number(series.sumNs / 1e9, 'g', 12) << "\n";
+        out << "parted_explorer_call_duration_seconds_count{" << labels << "} " << series.count << "\n";
+    }
+    out << "# HELP parted_explorer_call_errors_total Calls that returned a failure.\n";
+    out << "# TYPE parted_explorer_call_errors_total counter\n";
+    for (const auto& entry : state().series) {
+        out << "parted_explorer_call_errors_total{" << seriesLabels(entry.first) << "} " << entry.second.errors << "\n";
+    }
+    out.flush();
+    return file.commit();
+}
+
+bool Metrics::writeJson(const QString& path) {
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) return false;
+    QTextStream out(&file);
+
+    QMutexLocker locker(&state().mutex);
+    out << "{\"bucket_upper_bounds_us\":[";
+    for (int i = 0; i < kBucketCount - 1; ++i) {
+        out << (i ? "," : "") << (1LL << i);
+    }
+    out << "],\"calls\":[";
+    bool first = true;
+    for (const auto& entry : state().series) {
+        const Series& series = entry.second;
+        out << (first ? "" : ",") << "{\"op\":\"" << jsonEscape(QString::fromStdString(entry.first.first)) << "\""
+            << ",\"device\":\"" << jsonEscape(entry.first.second) << "\""
+            << ",\"count\":" << series.count << ",\"errors\":" << series.errors
+            << ",\"sum_us\":" << series.sumNs / 1000 << ",\"max_us\":" << series.maxNs / 1000 << ",\"buckets\":[";
+        for (int i = 0; i < kBucketCount; ++i) {
+            out << (i ? "," : "") << series.buckets[i];
+        }
+        out << "]}";
+        first = false;
+    }
+    out << "]}\n";
+    out.flush();
+    return file.commit();
+}
+
+bool Metrics::writeChromeTrace(const QString& path) {
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) return false;
+    QTextStream out(&file);
+
+    QMutexLocker locker(&state().mutex);
+    const qint64 pid = getpid();
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const TraceEvent& event : state().events) {
+        out << (first ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"cat\":\"disk\",\"ph\":\"X\""
+            << ",\"ts\":" << QString::number(event.startNs / 1000.0, 'f', 3)
+            << ",\"dur\":" << QString::number(event.durationNs / 1000.0, 'f', 3)
+            << ",\"pid\":" << pid << ",\"tid\":" << event.thread
+            << ",\"args\":{\"device\":\"" << jsonEscape(event.device) << "\",\"ok\":" << (event.ok ? "true" : "false") << "}}";
+        first = false;
+    }
+    out << "]}\n";
+    out.flush();
+    return file.commit();
+}
+
+void Metrics::flush() {
+    if (!enabled()) return;
+    State& s = state();
+    if (!s.prometheusPath.isEmpty() && !writePrometheus(s.prometheusPath)) {
+        LOG_WARNING("metrics", QString(), QString("Failed to write metrics to %1").arg(s.prometheusPath));
+    }
+    if (!s.jsonPath.isEmpty() && !writeJson(s.jsonPath)) {
+        LOG_WARNING("metrics", QString(), QString("Failed to write metrics to %1").arg(s.jsonPath));
+    }
+    if (!s.tracePath.isEmpty() && !writeChromeTrace(s.tracePath)) {
+        LOG_WARNING("metrics", QString(), QString("Failed to write trace to %1").arg(s.tracePath));
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QString>
+#include <atomic>
+
+// Lightweight timing of DiskManager entry points and libparted/I/O calls.
+//
+// Disabled by default; every probe then costs one relaxed atomic load.
+// Enabled through the environment (see configureFromEnvironment()):
+//   PARTED_EXPLORER_METRICS=<file>       Prometheus textfile (node_exporter format)
+//   PARTED_EXPLORER_METRICS_JSON=<file>  same data as JSON
+//   PARTED_EXPLORER_TRACE=<file>         Chrome trace (chrome://tracing, Perfetto)
+namespace Metrics {
+
+namespace detail {
+extern std::atomic<bool> enabled;
+}
+
+inline bool enabled() {
+    return detail::enabled.load(std::memory_order_relaxed);
+}
+
+void setEnabled(bool on);
+void setTraceEnabled(bool on);
+void configureFromEnvironment();
+
+qint64 nowNs();
+void record(const char *name, const QString& device, qint64 startNs, qint64 durationNs, bool ok);
+
+bool writePrometheus(const QString& path);
+bool writeJson(const QString& path);
+bool writeChromeTrace(const QString& path);
+// Writes every output configured through the environment
+void flush();
+void reset();
+
+// Times the enclosing scope. Functions with many early "return false" paths
+// start with ok = false and report the real outcome through finish().
+class ScopedTrace {
+public:
+    explicit ScopedTrace(const char *name, const QString& device = QString(), bool ok = true)
+        : m_name(name), m_ok(ok), m_active(enabled()) {
+        if (m_active) {
+            m_device = device;
+            m_start = nowNs();
+        }
+    }
+
+    ~ScopedTrace() {
+        if (m_active) record(m_name, m_device, m_start, nowNs() - m_start, m_ok);
+    }
+
+    void setOk(bool ok) { m_ok = ok; }
+    bool finish(bool ok) { m_ok = ok; return ok; }
+
+    ScopedTrace(const ScopedTrace&) = delete;
+    ScopedTrace& operator=(const ScopedTrace&) = delete;
+
+private:
+    const char *m_name;
+    QString m_device;
+    qint64 m_start = 0;
+    bool m_ok;
+    bool m_active;
+};
+
+// Times a single call; a null/false/0 result counts as a failure
+template <typename Function>
+auto traced(const char *name, const QString& device, Function&& function) -> decltype(function()) {
+    if (!enabled()) return function();
+    qint64 start = nowNs();
+    auto result = function();
+    record(name, device, start, nowNs() - start, static_cast<bool>(result));
+    return result;
+}
+
+} // namespace Metrics
+
+#endif // METRICS_H
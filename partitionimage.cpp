@@ -0,0 +1,582 @@
+#include "partitionimage.h"
+#include "checksum.h"
+#include "logger.h"
+#include "metrics.h"
+#include "partitionverifier.h"
+#include <QFuture>
+#include <QThread>
+#include <QtConcurrent>
+#include <ext2fs/ext2fs.h>
+#include <zstd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <algorithm>
+
+namespace {
+
+const char kImageMagic[8] = {'P', 'E', 'X', 'I', 'M', 'G', '0', '1'};
+const char kIndexMagic[8] = {'P', 'E', 'X', 'I', 'D', 'X', '0', '1'};
+const quint32 kChunkMagic = 0x4B4E4843; // "CHNK"
+const quint32 kImageVersion = 1;
+const quint32 kCompressionZstd = 1;
+
+// On-disk structures, little-endian
+#pragma pack(push, 1)
+struct ImageHeader {
+    char magic[8];
+    quint32 version;
+    quint32 chunkSize;
+    quint64 sourceSize;
+    quint64 chunkCount;
+    quint32 compression;
+    quint32 reserved[5];
+};
+
+// Precedes every stored payload so an image can also be walked without its index
+struct ChunkHeader {
+    quint32 magic;
+    quint32 kind;
+    quint64 chunk;
+    quint32 payloadSize;
+    quint32 rawSize;
+    quint32 crc32c;
+    quint32 reserved;
+};
+
+struct ImageTrailer {
+    quint64 indexOffset;
+    quint64 chunkCount;
+    quint32 indexCrc32c;
+    quint32 reserved;
+    char magic[8];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(ImageIndexEntry) == 24, "ImageIndexEntry is written to disk as is");
+
+// One chunk travelling through the read -> (de)compress -> write pipeline
+struct WorkChunk {
+    quint64 chunk = 0;
+    ImageIndexEntry entry = {};
+    std::vector<char> raw;
+    std::vector<char> payload;
+    bool failed = false;
+    QString error;
+};
+
+void setError(QString *error, const char *operation, const QString& device, const QString& message) {
+    LOG_ERROR(operation, device, message);
+    if (error) *error = message;
+}
+
+bool readFully(int fd, void *buffer, size_t length, quint64 offset) {
+    char *p = static_cast<char *>(buffer);
+    while (length > 0) {
+        ssize_t n = pread(fd, p, length, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool writeFully(int fd, const void *buffer, size_t length, quint64 offset) {
+    const char *p = static_cast<const char *>(buffer);
+    while (length > 0) {
+        ssize_t n = pwrite(fd, p, length, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Opens a restore target for writing. A block device is opened with O_EXCL,
+// which fails with EBUSY while it is mounted or held by another user
+// (device mapper, md, swap), so a restore never overwrites a live file system.
+int openTarget(const QString& path, QString *error) {
+    QByteArray name = path.toUtf8();
+    int flags = O_WRONLY | O_CLOEXEC;
+    struct stat st;
+    if (stat(name.constData(), &st) == 0 && S_ISBLK(st.st_mode)) {
+        flags |= O_EXCL;
+    }
+    int fd = ::open(name.constData(), flags);
+    if (fd < 0 && errno == EBUSY) {
+        setError(error, "restore", path, QString("%1 is mounted or in use, refusing to restore onto it.").arg(path));
+    } else if (fd < 0) {
+        setError(error, "restore", path, QString("Cannot open %1: %2").arg(path).arg(strerror(errno)));
+    }
+    return fd;
+}
+
+bool isAllZero(const std::vector<char>& data) {
+    if (data.empty()) return true;
+    return data[0] == 0 && memcmp(data.data(), data.data() + 1, data.size() - 1) == 0;
+}
+
+// Block bitmap of an ext2/3/4 file system, used to skip chunks it does not use
+class ExtBlockBitmap {
+public:
+    ~ExtBlockBitmap() {
+        if (m_fs) ext2fs_close_free(&m_fs);
+    }
+
+    bool open(const QString& path) {
+        if (ext2fs_open(path.toUtf8().constData(), 0, 0, 0, unix_io_manager, &m_fs)) {
+            m_fs = nullptr; // not an ext file system
+            return false;
+        }
+        if (ext2fs_read_block_bitmap(m_fs)) {
+            ext2fs_close_free(&m_fs);
+            return false;
+        }
+        m_blockSize = m_fs->blocksize;
+        m_firstDataBlock = m_fs->super->s_first_data_block;
+        m_blockCount = ext2fs_blocks_count(m_fs->super);
+        return true;
+    }
+
+    // True if no block in the byte range is in use by the file system
+    bool isUnallocated(quint64 offset, quint64 length) const {
+        if (!m_fs || length == 0) return false;
+        blk64_t first = offset / m_blockSize;
+        blk64_t last = (offset + length - 1) / m_blockSize;
+        if (first <= m_firstDataBlock) return false; // boot block and primary superblock
+        if (first >= m_blockCount) return true;      // past the end of the file system
+        if (last >= m_blockCount) last = m_blockCount - 1;
+        return ext2fs_test_block_bitmap_range2(m_fs->block_map, first, (unsigned int)(last - first + 1));
+    }
+
+private:
+    ext2_filsys m_fs = nullptr;
+    quint64 m_blockSize = 0;
+    blk64_t m_firstDataBlock = 0;
+    blk64_t m_blockCount = 0;
+};
+
+} // namespace
+
+qint64 PartitionImage::deviceSize(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return -1;
+    if (S_ISBLK(st.st_mode)) {
+        quint64 bytes = 0;
+        if (ioctl(fd, BLKGETSIZE64, &bytes) != 0) return -1;
+        return (qint64)bytes;
+    }
+    return (qint64)st.st_size;
+}
+
+// --- Reader ---
+
+PartitionImageReader::PartitionImageReader() : m_fd(-1), m_sourceSize(0), m_chunkSize(0) {}
+
+PartitionImageReader::~PartitionImageReader() {
+    close();
+}
+
+void PartitionImageReader::close() {
+    if (m_fd >= 0) ::close(m_fd);
+    m_fd = -1;
+    m_index.clear();
+}
+
+bool PartitionImageReader::open(const QString& imagePath, QString *error) {
+    close();
+    m_path = imagePath;
+    m_fd = ::open(imagePath.toUtf8().constData(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0) {
+        setError(error, "image", imagePath, QString("Cannot open image %1: %2").arg(imagePath).arg(strerror(errno)));
+        return false;
+    }
+
+    ImageHeader header;
+    if (!readFully(m_fd, &header, sizeof(header), 0) ||
+        memcmp(header.magic, kImageMagic, sizeof(kImageMagic)) != 0 ||
+        header.version != kImageVersion || header.chunkSize == 0) {
+        setError(error, "image", imagePath, QString("%1 is not a partition image.").arg(imagePath));
+        close();
+        return false;
+    }
+
+    // The index sits in front of the trailer at the very end of the file
+    struct stat st;
+    ImageTrailer trailer;
+    if (fstat(m_fd, &st) != 0 || (quint64)st.st_size < sizeof(header) + sizeof(trailer) ||
+        !readFully(m_fd, &trailer, sizeof(trailer), st.st_size - sizeof(trailer)) ||
+        memcmp(trailer.magic, kIndexMagic, sizeof(kIndexMagic)) != 0 ||
+        trailer.chunkCount != header.chunkCount) {
+        setError(error, "image", imagePath, QString("Image %1 is incomplete (missing chunk index).").arg(imagePath));
+        close();
+        return false;
+    }
+
+    // The restore writes each entry's rawSize at chunk * chunkSize and pads
+    // zero chunks from a chunkSize buffer, so the index must tile the source
+    // exactly before anything trusts it
+    const quint64 expectedChunks = (header.sourceSize + header.chunkSize - 1) / header.chunkSize;
+    if (trailer.chunkCount != expectedChunks ||
+        trailer.chunkCount > ((quint64)st.st_size - sizeof(trailer)) / sizeof(ImageIndexEntry)) {
+        setError(error, "image", imagePath, QString("Chunk index of %1 does not match the image size.").arg(imagePath));
+        close();
+        return false;
+    }
+
+    m_index.resize(trailer.chunkCount);
+    size_t indexBytes = m_index.size() * sizeof(ImageIndexEntry);
+    if (!readFully(m_fd, m_index.data(), indexBytes, trailer.indexOffset) ||
+        Checksum::crc32c(m_index.data(), indexBytes) != trailer.indexCrc32c) {
+        setError(error, "image", imagePath, QString("Chunk index of %1 is corrupted.").arg(imagePath));
+        close();
+        return false;
+    }
+
+    for (quint64 c = 0; c < m_index.size(); ++c) {
+        const quint64 expectedSize = std::min<quint64>(header.chunkSize, header.sourceSize - c * header.chunkSize);
+        if (m_index[c].rawSize != expectedSize) {
+            setError(error, "image", imagePath, QString("Chunk %1 of %2 has an invalid size.").arg(c).arg(imagePath));
+            close();
+            return false;
+        }
+    }
+
+    m_sourceSize = header.sourceSize;
+    m_chunkSize = header.chunkSize;
+    return true;
+}
+
+bool PartitionImageReader::readPayload(quint64 chunk, std::vector<char>& payload, QString *error) const {
+    const ImageIndexEntry& e = m_index[chunk];
+    payload.resize(e.payloadSize);
+    if (e.payloadSize == 0) return true;
+    if (!readFully(m_fd, payload.data(), e.payloadSize, e.payloadOffset)) {
+        setError(error, "image", m_path, QString("Failed to read chunk %1 from the image.").arg(chunk));
+        return false;
+    }
+    return true;
+}
+
+bool PartitionImageReader::unpack(const ImageIndexEntry& entry, const std::vector<char>& payload,
+                                  std::vector<char>& data, QString *error) {
+    switch ((ImageChunkKind)entry.kind) {
+    case ImageChunkKind::Zero:
+    case ImageChunkKind::Unallocated:
+        data.assign(entry.rawSize, 0);
+        return true;
+    case ImageChunkKind::Stored:
+        if (payload.size() != entry.rawSize) {
+            setError(error, "image", QString(), "Stored chunk has the wrong size.");
+            return false;
+        }
+        data = payload;
+        break;
+    case ImageChunkKind::Compressed: {
+        data.resize(entry.rawSize);
+        size_t n = ZSTD_decompress(data.data(), data.size(), payload.data(), payload.size());
+        if (ZSTD_isError(n) || n != entry.rawSize) {
+            setError(error, "image", QString(), QString("Failed to decompress chunk: %1").arg(ZSTD_isError(n) ? ZSTD_getErrorName(n) : "short chunk"));
+            return false;
+        }
+        break;
+    }
+    default:
+        setError(error, "image", QString(), QString("Unknown chunk kind %1.").arg(entry.kind));
+        return false;
+    }
+
+    if (Checksum::crc32c(data.data(), data.size()) != entry.crc32c) {
+        setError(error, "image", QString(), "Chunk checksum mismatch, the image is corrupted.");
+        return false;
+    }
+    return true;
+}
+
+bool PartitionImageReader::readChunk(quint64 chunk, std::vector<char>& data, QString *error) const {
+    if (chunk >= m_index.size()) {
+        setError(error, "image", m_path, QString("Chunk %1 is out of range.").arg(chunk));
+        return false;
+    }
+    std::vector<char> payload;
+    return readPayload(chunk, payload, error) && unpack(m_index[chunk], payload, data, error);
+}
+
+// --- Backup ---
+
+bool PartitionImage::backup(const QString& sourcePath, const QString& imagePath,
+                            const ImageBackupOptions& options, QString *error,
+                            const ImageProgressCallback& progress) {
+    Metrics::ScopedTrace trace("PartitionImage::backup", sourcePath, false);
+    int in = ::open(sourcePath.toUtf8().constData(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        setError(error, "backup", sourcePath, QString("Cannot open %1: %2").arg(sourcePath).arg(strerror(errno)));
+        return false;
+    }
+    qint64 size = deviceSize(in);
+    if (size <= 0) {
+        setError(error, "backup", sourcePath, QString("Cannot determine the size of %1.").arg(sourcePath));
+        ::close(in);
+        return false;
+    }
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    int out = ::open(imagePath.toUtf8().constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out < 0) {
+        setError(error, "backup", sourcePath, QString("Cannot create %1: %2").arg(imagePath).arg(strerror(errno)));
+        ::close(in);
+        return false;
+    }
+
+    ExtBlockBitmap bitmap;
+    const bool haveBitmap = options.skipUnallocated && bitmap.open(sourcePath);
+    if (haveBitmap) {
+        LOG_INFO("backup", sourcePath, "ext2/3/4 found, unallocated blocks are not stored.");
+    }
+
+    const quint32 chunkSize = std::max<quint32>(options.chunkSize, 64 * 1024);
+    const quint64 chunkCount = ((quint64)size + chunkSize - 1) / chunkSize;
+    const size_t inFlight = options.threads > 0 ? options.threads * 2 : QThread::idealThreadCount() * 2;
+    const int level = options.compressionLevel;
+
+    ImageHeader header = {};
+    memcpy(header.magic, kImageMagic, sizeof(kImageMagic));
+    header.version = kImageVersion;
+    header.chunkSize = chunkSize;
+    header.sourceSize = size;
+    header.chunkCount = chunkCount;
+    header.compression = kCompressionZstd;
+
+    std::vector<ImageIndexEntry> index(chunkCount);
+    quint64 position = 0;
+    bool ok = writeFully(out, &header, sizeof(header), position);
+    position += sizeof(header);
+
+    // Stage 1: sequential reads, skipping what the file system does not use
+    auto readBatch = [&](quint64 firstChunk, std::vector<WorkChunk>& batch) {
+        batch.clear();
+        for (quint64 c = firstChunk; c < chunkCount && batch.size() < inFlight; ++c) {
+            WorkChunk work;
+            work.chunk = c;
+            quint64 offset = c * chunkSize;
+            work.entry.rawSize = (quint32)std::min<quint64>(chunkSize, size - offset);
+            if (haveBitmap && bitmap.isUnallocated(offset, work.entry.rawSize)) {
+                work.entry.kind = (quint32)ImageChunkKind::Unallocated;
+            } else {
+                work.raw.resize(work.entry.rawSize);
+                if (!readFully(in, work.raw.data(), work.raw.size(), offset)) {
+                    setError(error, "backup", sourcePath, QString("Read error on %1 at offset %2.").arg(sourcePath).arg(offset));
+                    return false;
+                }
+            }
+            batch.push_back(std::move(work));
+        }
+        return true;
+    };
+
+    // Stage 2: checksum and compress, one chunk per pool thread
+    auto pack = [level](WorkChunk& work) {
+        if (work.entry.kind == (quint32)ImageChunkKind::Unallocated) return;
+        work.entry.crc32c = Checksum::crc32c(work.raw.data(), work.raw.size());
+        if (isAllZero(work.raw)) {
+            work.entry.kind = (quint32)ImageChunkKind::Zero;
+        } else {
+            work.payload.resize(ZSTD_compressBound(work.raw.size()));
+            size_t n = ZSTD_compress(work.payload.data(), work.payload.size(), work.raw.data(), work.raw.size(), level);
+            if (ZSTD_isError(n) || n >= work.raw.size()) {
+                work.entry.kind = (quint32)ImageChunkKind::Stored;
+                work.payload.swap(work.raw);
+            } else {
+                work.entry.kind = (quint32)ImageChunkKind::Compressed;
+                work.payload.resize(n);
+            }
+        }
+        work.entry.payloadSize = (quint32)work.payload.size();
+        std::vector<char>().swap(work.raw);
+    };
+
+    std::vector<WorkChunk> current;
+    std::vector<WorkChunk> next;
+    ok = ok && readBatch(0, current);
+    quint64 nextChunk = current.size();
+    quint64 done = 0;
+
+    while (ok && !current.empty()) {
+        QFuture<void> packing = QtConcurrent::map(current, pack);
+        bool readOk = readBatch(nextChunk, next); // overlaps with compression
+        packing.waitForFinished();
+        if (!readOk) {
+            ok = false;
+            break;
+        }
+        nextChunk += next.size();
+
+        // Stage 3: append in chunk order
+        for (WorkChunk& work : current) {
+            if (work.entry.payloadSize > 0) {
+                ChunkHeader chunkHeader = {kChunkMagic, work.entry.kind, work.chunk, work.entry.payloadSize,
+                                           work.entry.rawSize, work.entry.crc32c, 0};
+                ok = writeFully(out, &chunkHeader, sizeof(chunkHeader), position);
+                position += sizeof(chunkHeader);
+                work.entry.payloadOffset = position;
+                ok = ok && writeFully(out, work.payload.data(), work.payload.size(), position);
+                position += work.payload.size();
+                if (!ok) {
+                    setError(error, "backup", sourcePath, QString("Write error on %1: %2").arg(imagePath).arg(strerror(errno)));
+                    break;
+                }
+            }
+            index[work.chunk] = work.entry;
+            done += work.entry.rawSize;
+        }
+
+        if (ok && progress && !progress(done, size)) {
+            setError(error, "backup", sourcePath, "Backup cancelled.");
+            ok = false;
+        }
+        current.swap(next);
+    }
+
+    if (ok) {
+        ImageTrailer trailer = {};
+        trailer.indexOffset = position;
+        trailer.chunkCount = chunkCount;
+        trailer.indexCrc32c = Checksum::crc32c(index.data(), index.size() * sizeof(ImageIndexEntry));
+        memcpy(trailer.magic, kIndexMagic, sizeof(kIndexMagic));
+        ok = writeFully(out, index.data(), index.size() * sizeof(ImageIndexEntry), position);
+        position += index.size() * sizeof(ImageIndexEntry);
+        ok = ok && writeFully(out, &trailer, sizeof(trailer), position) && fsync(out) == 0;
+        if (!ok) setError(error, "backup", sourcePath, QString("Failed to finish %1: %2").arg(imagePath).arg(strerror(errno)));
+    }
+
+    ::close(in);
+    ::close(out);
+    if (!ok) {
+        unlink(imagePath.toUtf8().constData()); // never leave a truncated image behind
+    } else {
+        LOG_INFO("backup", sourcePath, QString("Written to %1: %2 bytes for %3 bytes of data.").arg(imagePath).arg(position).arg(size));
+    }
+    return trace.finish(ok);
+}
+
+// --- Restore ---
+
+bool PartitionImage::restore(const QString& imagePath, const QString& targetPath, QString *error,
+                             const ImageProgressCallback& progress) {
+    Metrics::ScopedTrace trace("PartitionImage::restore", targetPath, false);
+    PartitionImageReader reader;
+    if (!reader.open(imagePath, error)) return false;
+
+    int out = openTarget(targetPath, error);
+    if (out < 0) return false;
+    qint64 targetSize = deviceSize(out);
+    if (targetSize < (qint64)reader.sourceSize()) {
+        setError(error, "restore", targetPath, QString("%1 is smaller than the image (%2 < %3 bytes).").arg(targetPath).arg(targetSize).arg(reader.sourceSize()));
+        ::close(out);
+        return false;
+    }
+
+    // Before the first write, so an interrupted restore is dirty as well
+    PartitionVerifier::markWritten(targetPath, 0, reader.sourceSize());
+
+    const quint64 chunkCount = reader.chunkCount();
+    const quint64 chunkSize = reader.chunkSize();
+    const size_t inFlight = QThread::idealThreadCount() * 2;
+    const std::vector<char> zeros(chunkSize, 0);
+
+    auto readBatch = [&](quint64 firstChunk, std::vector<WorkChunk>& batch) {
+        batch.clear();
+        for (quint64 c = firstChunk; c < chunkCount && batch.size() < inFlight; ++c) {
+            WorkChunk work;
+            work.chunk = c;
+            work.entry = reader.entry(c);
+            if (!reader.readPayload(c, work.payload, error)) return false;
+            batch.push_back(std::move(work));
+        }
+        return true;
+    };
+
+    auto unpack = [](WorkChunk& work) {
+        ImageChunkKind kind = (ImageChunkKind)work.entry.kind;
+        if (kind == ImageChunkKind::Zero || kind == ImageChunkKind::Unallocated) return;
+        work.failed = !PartitionImageReader::unpack(work.entry, work.payload, work.raw, &work.error);
+        std::vector<char>().swap(work.payload);
+    };
+
+    std::vector<WorkChunk> current;
+    std::vector<WorkChunk> next;
+    bool ok = readBatch(0, current);
+    quint64 nextChunk = current.size();
+    quint64 done = 0;
+
+    while (ok && !current.empty()) {
+        QFuture<void> unpacking = QtConcurrent::map(current, unpack);
+        bool readOk = readBatch(nextChunk, next); // overlaps with decompression
+        unpacking.waitForFinished();
+        if (!readOk) {
+            ok = false;
+            break;
+        }
+        nextChunk += next.size();
+
+        for (const WorkChunk& work : current) {
+            if (work.failed) {
+                setError(error, "restore", targetPath, QString("Chunk %1: %2").arg(work.chunk).arg(work.error));
+                ok = false;
+                break;
+            }
+            quint64 offset = work.chunk * chunkSize;
+            ImageChunkKind kind = (ImageChunkKind)work.entry.kind;
+            bool written = true;
+            if (kind == ImageChunkKind::Zero) {
+                written = writeFully(out, zeros.data(), work.entry.rawSize, offset);
+            } else if (kind != ImageChunkKind::Unallocated) {
+                written = writeFully(out, work.raw.data(), work.raw.size(), offset);
+            }
+            if (!written) {
+                setError(error, "restore", targetPath, QString("Write error on %1 at offset %2: %3").arg(targetPath).arg(offset).arg(strerror(errno)));
+                ok = false;
+                break;
+            }
+            done += work.entry.rawSize;
+        }
+
+        if (ok && progress && !progress(done, reader.sourceSize())) {
+            setError(error, "restore", targetPath, "Restore cancelled, the target is only partially restored.");
+            ok = false;
+        }
+        current.swap(next);
+    }
+
+    if (ok && fsync(out) != 0) {
+        setError(error, "restore", targetPath, QString("Failed to flush %1: %2").arg(targetPath).arg(strerror(errno)));
+        ok = false;
+    }
+    ::close(out);
+    return trace.finish(ok);
+}
+
+bool PartitionImage::restoreChunk(const QString& imagePath, const QString& targetPath,
+                                  quint64 chunk, QString *error) {
+    Metrics::ScopedTrace trace("PartitionImage::restoreChunk", targetPath, false);
+    PartitionImageReader reader;
+    std::vector<char> data;
+    if (!reader.open(imagePath, error) || !reader.readChunk(chunk, data, error)) return false;
+    if (reader.entry(chunk).kind == (quint32)ImageChunkKind::Unallocated) return trace.finish(true);
+
+    int out = openTarget(targetPath, error);
+    if (out < 0) return false;
+    PartitionVerifier::markWritten(targetPath, chunk * reader.chunkSize(), data.size());
+    bool ok = writeFully(out, data.data(), data.size(), chunk * reader.chunkSize()) && fsync(out) == 0;
+    if (!ok) setError(error, "restore", targetPath, QString("Failed to write chunk %1 to %2.").arg(chunk).arg(targetPath));
+    ::close(out);
+    return trace.finish(ok);
+}
@@ -0,0 +1,91 @@
+#ifndef PARTITIONIMAGE_H
+#define PARTITIONIMAGE_H
+
+#include <QString>
+#include <QtGlobal>
+#include <functional>
+#include <vector>
+
+// Streaming, chunked and compressed image of a partition (or any block device/file).
+//
+// Layout on disk:
+//   ImageHeader
+//   for every stored chunk: ChunkHeader + payload (zstd frame or raw bytes)
+//   index table (one ImageIndexEntry per chunk of the source)
+//   ImageTrailer (points back to the index table)
+//
+// Chunks are compressed independently, so backup and restore can spread the
+// work over all cores and a single chunk can be restored on its own.
+
+// Returns false to cancel the running backup/restore
+typedef std::function<bool(quint64 bytesDone, quint64 bytesTotal)> ImageProgressCallback;
+
+enum class ImageChunkKind : quint32 {
+    Compressed = 0,  // zstd frame
+    Stored = 1,      // raw bytes, data did not compress
+    Zero = 2,        // all zero, nothing stored
+    Unallocated = 3  // not used by the file system, nothing stored and not restored
+};
+
+struct ImageIndexEntry {
+    quint64 payloadOffset;  // file offset of the payload, 0 if nothing is stored
+    quint32 payloadSize;
+    quint32 rawSize;
+    quint32 crc32c;         // checksum of the raw (uncompressed) bytes
+    quint32 kind;           // ImageChunkKind
+};
+
+struct ImageBackupOptions {
+    quint32 chunkSize = 4 * 1024 * 1024;
+    int compressionLevel = 3;
+    int threads = 0;              // sizes the pipeline (2 chunks in flight per thread), 0 = core count
+    bool skipUnallocated = true;  // use ext2/3/4 block bitmaps when possible
+};
+
+// Random access to an existing image
+class PartitionImageReader {
+public:
+    PartitionImageReader();
+    ~PartitionImageReader();
+
+    bool open(const QString& imagePath, QString *error);
+    void close();
+
+    quint64 sourceSize() const { return m_sourceSize; }
+    quint32 chunkSize() const { return m_chunkSize; }
+    quint64 chunkCount() const { return m_index.size(); }
+    const ImageIndexEntry& entry(quint64 chunk) const { return m_index[chunk]; }
+
+    // Reads, decompresses and checksums one chunk. Zero/unallocated chunks
+    // come back as zero filled buffers.
+    bool readChunk(quint64 chunk, std::vector<char>& data, QString *error) const;
+    bool readPayload(quint64 chunk, std::vector<char>& payload, QString *error) const;
+    static bool unpack(const ImageIndexEntry& entry, const std::vector<char>& payload,
+                       std::vector<char>& data, QString *error);
+
+private:
+    int m_fd;
+    QString m_path; // for log records
+    quint64 m_sourceSize;
+    quint32 m_chunkSize;
+    std::vector<ImageIndexEntry> m_index;
+};
+
+class PartitionImage {
+public:
+    static bool backup(const QString& sourcePath, const QString& imagePath,
+                       const ImageBackupOptions& options, QString *error,
+                       const ImageProgressCallback& progress = ImageProgressCallback());
+
+    static bool restore(const QString& imagePath, const QString& targetPath, QString *error,
+                        const ImageProgressCallback& progress = ImageProgressCallback());
+
+    // Restore a single chunk, e.g. to repair one region after a failed verify
+    static bool restoreChunk(const QString& imagePath, const QString& targetPath,
+                             quint64 chunk, QString *error);
+
+    // Size of a block device or regular file in bytes, -1 on error
+    static qint64 deviceSize(int fd);
+};
+
+#endif // PARTITIONIMAGE_H
@@ -0,0 +1,389 @@
+#include "partitionverifier.h"
+#include "partitionimage.h"
+#include "checksum.h"
+#include "logger.h"
+#include "metrics.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QtConcurrent>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+namespace {
+
+const quint32 kDigestMagic = 0x50584447; // "PXDG"
+const quint32 kDigestVersion = 1;
+
+// One chunk to hash
+struct HashJob {
+    quint64 chunk = 0;
+    quint64 offset = 0;
+    quint32 length = 0;
+    quint32 crc = 0;
+    bool ok = false;
+};
+
+bool readFully(int fd, char *buffer, size_t length, quint64 offset) {
+    while (length > 0) {
+        ssize_t n = pread(fd, buffer, length, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buffer += n;
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+int openForReading(const QString& path, QString *error) {
+    int fd = ::open(path.toUtf8().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (error) *error = QString("Cannot open %1: %2").arg(path).arg(strerror(errno));
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return fd;
+}
+
+std::vector<HashJob> jobsFor(const ChunkDigests& digests, bool onlyDirty) {
+    std::vector<HashJob> jobs;
+    const quint64 end = digests.rangeOffset + digests.rangeLength;
+    for (quint64 c = 0; c < digests.chunkCount(); ++c) {
+        if (onlyDirty && !digests.dirty[c]) continue;
+        HashJob job;
+        job.chunk = c;
+        job.offset = digests.rangeOffset + c * digests.chunkSize;
+        job.length = (quint32)std::min<quint64>(digests.chunkSize, end - job.offset);
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+// Hash all jobs in parallel: every pool thread reads whole chunks with one
+// large pread and runs crc32c over them while the others are still reading.
+bool runJobs(std::vector<HashJob>& jobs, int fd, quint64 *bytesRead, QString *error) {
+    QtConcurrent::blockingMap(jobs, [fd](HashJob& job) {
+        thread_local std::vector<char> buffer;
+        buffer.resize(job.length);
+        job.ok = readFully(fd, buffer.data(), job.length, job.offset);
+        if (job.ok) {
+            job.crc = Checksum::crc32c(buffer.data(), job.length);
+        }
+    });
+
+    for (const HashJob& job : jobs) {
+        if (!job.ok) {
+            if (error) *error = QString("Read error at offset %1.").arg(job.offset);
+            return false;
+        }
+        if (bytesRead) *bytesRead += job.length;
+    }
+    return true;
+}
+
+bool resolveLength(int fd, quint64 offset, quint64& length, QString *error) {
+    qint64 size = PartitionImage::deviceSize(fd);
+    if (size < 0 || offset > (quint64)size) {
+        if (error) *error = "Offset is beyond the end of the device.";
+        return false;
+    }
+    if (length == 0 || offset + length > (quint64)size) {
+        length = size - offset;
+    }
+    return true;
+}
+
+void initDigests(ChunkDigests& digests, quint64 offset, quint64 length, quint32 chunkSize) {
+    digests.rangeOffset = offset;
+    digests.rangeLength = length;
+    digests.chunkSize = chunkSize > 0 ? chunkSize : PartitionVerifier::kDefaultChunkSize;
+    quint64 count = (length + digests.chunkSize - 1) / digests.chunkSize;
+    digests.digests.assign(count, 0);
+    digests.dirty.assign(count, false);
+}
+
+// Which digest files describe which partition, so write paths can find them
+struct RegisteredDigests {
+    QString devicePath;
+    QString partitionPath;
+    QString digestPath;
+};
+
+QMutex registryMutex; // writes are reported from worker threads too
+
+QString registryPath() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/digests.ini";
+}
+
+std::vector<RegisteredDigests> readRegistry() {
+    std::vector<RegisteredDigests> entries;
+    QSettings settings(registryPath(), QSettings::IniFormat);
+    int count = settings.beginReadArray("digests");
+    for (int i = 0; i < count; ++i) {
+        settings.setArrayIndex(i);
+        RegisteredDigests entry;
+        entry.devicePath = settings.value("device").toString();
+        entry.partitionPath = settings.value("partition").toString();
+        entry.digestPath = settings.value("file").toString();
+        // Digest files deleted by the user drop out
+        if (QFileInfo::exists(entry.digestPath)) entries.push_back(entry);
+    }
+    settings.endArray();
+    return entries;
+}
+
+void writeRegistry(const std::vector<RegisteredDigests>& entries) {
+    QDir().mkpath(QFileInfo(registryPath()).absolutePath());
+    QSettings settings(registryPath(), QSettings::IniFormat);
+    settings.remove("digests");
+    settings.beginWriteArray("digests", int(entries.size()));
+    for (size_t i = 0; i < entries.size(); ++i) {
+        settings.setArrayIndex(int(i));
+        settings.setValue("device", entries[i].devicePath);
+        settings.setValue("partition", entries[i].partitionPath);
+        settings.setValue("file", entries[i].digestPath);
+    }
+    settings.endArray();
+}
+
+// Marks [offset, offset + length) dirty in one digest file, length 0 up to the end
+void markFile(const QString& digestPath, quint64 offset, quint64 length) {
+    ChunkDigests digests;
+    QString error;
+    if (!digests.load(digestPath, &error)) {
+        LOG_WARNING("verify", digestPath, error);
+        return;
+    }
+    if (length == 0) {
+        quint64 end = digests.rangeOffset + digests.rangeLength;
+        if (offset >= end) return;
+        length = end - offset;
+    }
+    quint64 before = digests.dirtyCount();
+    digests.markDirty(offset, length);
+    if (digests.dirtyCount() != before && !digests.save(digestPath, &error)) {
+        LOG_WARNING("verify", digestPath, error);
+    }
+}
+
+} // namespace
+
+// --- ChunkDigests ---
+
+quint64 ChunkDigests::dirtyCount() const {
+    return std::count(dirty.begin(), dirty.end(), true);
+}
+
+void ChunkDigests::markDirty(quint64 offset, quint64 length) {
+    const quint64 end = rangeOffset + rangeLength;
+    if (length == 0 || chunkSize == 0 || offset >= end || offset + length <= rangeOffset) return;
+
+    quint64 first = (std::max(offset, rangeOffset) - rangeOffset) / chunkSize;
+    quint64 last = (std::min(offset + length, end) - 1 - rangeOffset) / chunkSize;
+    for (quint64 c = first; c <= last && c < dirty.size(); ++c) {
+        dirty[c] = true;
+    }
+}
+
+bool ChunkDigests::save(const QString& path, QString *error) const {
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if (error) *error = QString("Cannot write %1: %2").arg(path).arg(file.errorString());
+        return false;
+    }
+    QDataStream out(&file);
+    out << kDigestMagic << kDigestVersion << rangeOffset << rangeLength << chunkSize << (quint64)digests.size();
+    for (size_t i = 0; i < digests.size(); ++i) {
+        out << digests[i] << (quint8)(dirty[i] ? 1 : 0);
+    }
+    return out.status() == QDataStream::Ok;
+}
+
+bool ChunkDigests::load(const QString& path, QString *error) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (error) *error = QString("Cannot read %1: %2").arg(path).arg(file.errorString());
+        return false;
+    }
+    QDataStream in(&file);
+    quint32 magic = 0;
+    quint32 version = 0;
+    quint64 count = 0;
+    in >> magic >> version >> rangeOffset >> rangeLength >> chunkSize >> count;
+    if (magic != kDigestMagic || version != kDigestVersion || chunkSize == 0 ||
+        count != (rangeLength + chunkSize - 1) / chunkSize) {
+        if (error) *error = QString("%1 is not a digest file.").arg(path);
+        return false;
+    }
+
+    digests.assign(count, 0);
+    dirty.assign(count, false);
+    for (quint64 i = 0; i < count; ++i) {
+        quint8 isDirty = 0;
+        in >> digests[i] >> isDirty;
+        dirty[i] = isDirty != 0;
+    }
+    if (in.status() != QDataStream::Ok) {
+        if (error) *error = QString("%1 is truncated.").arg(path);
+        return false;
+    }
+    return true;
+}
+
+// --- PartitionVerifier ---
+
+void PartitionVerifier::registerDigests(const QString& devicePath, const QString& partitionPath, const QString& digestPath) {
+    QMutexLocker locker(&registryMutex);
+    QString file = QFileInfo(digestPath).absoluteFilePath();
+    std::vector<RegisteredDigests> entries = readRegistry();
+    for (const RegisteredDigests& entry : entries) {
+        if (entry.digestPath == file && entry.partitionPath == partitionPath) return;
+    }
+    // A digest file describes one partition, a re-recorded file moves
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [&file](const RegisteredDigests& entry) { return entry.digestPath == file; }),
+                  entries.end());
+    entries.push_back(RegisteredDigests{devicePath, partitionPath, file});
+    writeRegistry(entries);
+}
+
+void PartitionVerifier::markWritten(const QString& partitionPath, quint64 offset, quint64 length) {
+    QMutexLocker locker(&registryMutex);
+    for (const RegisteredDigests& entry : readRegistry()) {
+        if (entry.partitionPath == partitionPath) {
+            markFile(entry.digestPath, offset, length);
+            LOG_DEBUG("verify", partitionPath, QString("Write at %1 (+%2) marked in %3.").arg(offset).arg(length).arg(entry.digestPath));
+        }
+    }
+}
+
+void PartitionVerifier::markDeviceWritten(const QString& devicePath) {
+    QMutexLocker locker(&registryMutex);
+    for (const RegisteredDigests& entry : readRegistry()) {
+        if (entry.devicePath == devicePath) {
+            markFile(entry.digestPath, 0, 0);
+            LOG_DEBUG("verify", entry.partitionPath, QString("New table on %1 marked in %2.").arg(devicePath, entry.digestPath));
+        }
+    }
+}
+
+bool PartitionVerifier::hash(const QString& path, quint64 offset, quint64 length, quint32 chunkSize,
+                             ChunkDigests& digests, QString *error) {
+    Metrics::ScopedTrace trace("PartitionVerifier::hash", path, false);
+    int fd = openForReading(path, error);
+    if (fd < 0) return false;
+
+    bool ok = resolveLength(fd, offset, length, error);
+    if (ok) {
+        initDigests(digests, offset, length, chunkSize);
+        std::vector<HashJob> jobs = jobsFor(digests, false);
+        ok = runJobs(jobs, fd, nullptr, error);
+        for (const HashJob& job : jobs) {
+            digests.digests[job.chunk] = job.crc;
+        }
+    }
+    ::close(fd);
+    return trace.finish(ok);
+}
+
+VerifyResult PartitionVerifier::verify(const QString& path, const ChunkDigests& digests) {
+    Metrics::ScopedTrace trace("PartitionVerifier::verify", path, false);
+    VerifyResult result;
+    QElapsedTimer timer;
+    timer.start();
+
+    int fd = openForReading(path, &result.error);
+    if (fd < 0) return result;
+
+    std::vector<HashJob> jobs = jobsFor(digests, false);
+    if (runJobs(jobs, fd, &result.bytesRead, &result.error)) {
+        for (const HashJob& job : jobs) {
+            if (job.crc != digests.digests[job.chunk]) {
+                result.mismatchedChunks.push_back(job.chunk);
+            }
+        }
+        result.success = result.mismatchedChunks.empty();
+    }
+    ::close(fd);
+
+    result.elapsedMs = timer.elapsed();
+    trace.setOk(result.success);
+    return result;
+}
+
+VerifyResult PartitionVerifier::refresh(const QString& path, ChunkDigests& digests) {
+    Metrics::ScopedTrace trace("PartitionVerifier::refresh", path, false);
+    VerifyResult result;
+    QElapsedTimer timer;
+    timer.start();
+
+    int fd = openForReading(path, &result.error);
+    if (fd < 0) return result;
+
+    std::vector<HashJob> jobs = jobsFor(digests, true);
+    if (runJobs(jobs, fd, &result.bytesRead, &result.error)) {
+        for (const HashJob& job : jobs) {
+            if (job.crc != digests.digests[job.chunk]) {
+                result.mismatchedChunks.push_back(job.chunk);
+                digests.digests[job.chunk] = job.crc;
+            }
+            digests.dirty[job.chunk] = false;
+        }
+        result.success = true;
+    }
+    ::close(fd);
+
+    result.elapsedMs = timer.elapsed();
+    LOG_DEBUG("verify", path, QString("Refreshed %1 dirty chunks, %2 changed.").arg(jobs.size()).arg(result.mismatchedChunks.size()));
+    trace.setOk(result.success);
+    return result;
+}
+
+VerifyResult PartitionVerifier::verifyImage(const QString& imagePath, const QString& targetPath) {
+    Metrics::ScopedTrace trace("PartitionVerifier::verifyImage", targetPath, false);
+    VerifyResult result;
+    QElapsedTimer timer;
+    timer.start();
+
+    PartitionImageReader reader;
+    if (!reader.open(imagePath, &result.error)) return result;
+
+    int fd = openForReading(targetPath, &result.error);
+    if (fd < 0) return result;
+
+    // Image chunks already carry a CRC32C of their raw bytes, so only the
+    // target has to be read. Unallocated chunks were never restored.
+    std::vector<HashJob> jobs;
+    for (quint64 c = 0; c < reader.chunkCount(); ++c) {
+        if (reader.entry(c).kind == (quint32)ImageChunkKind::Unallocated) continue;
+        HashJob job;
+        job.chunk = c;
+        job.offset = c * reader.chunkSize();
+        job.length = reader.entry(c).rawSize;
+        jobs.push_back(job);
+    }
+
+    if (runJobs(jobs, fd, &result.bytesRead, &result.error)) {
+        for (const HashJob& job : jobs) {
+            if (job.crc != reader.entry(job.chunk).crc32c) {
+                result.mismatchedChunks.push_back(job.chunk);
+            }
+        }
+        result.success = result.mismatchedChunks.empty();
+    }
+    ::close(fd);
+
+    result.elapsedMs = timer.elapsed();
+    trace.setOk(result.success);
+    return result;
+}
@@ -0,0 +1,64 @@
+#ifndef PARTITIONVERIFIER_H
+#define PARTITIONVERIFIER_H
+
+#include <QString>
+#include <QtGlobal>
+#include <vector>
+
+// Per-chunk CRC32C digests of a byte range of a partition or device.
+// Chunks touched by a later write are marked dirty, so a refresh only has
+// to re-read those instead of the whole range.
+struct ChunkDigests {
+    quint64 rangeOffset = 0;
+    quint64 rangeLength = 0;
+    quint32 chunkSize = 0;
+    std::vector<quint32> digests;
+    std::vector<bool> dirty;
+
+    quint64 chunkCount() const { return digests.size(); }
+    quint64 dirtyCount() const;
+    void markDirty(quint64 offset, quint64 length);
+
+    bool save(const QString& path, QString *error) const;
+    bool load(const QString& path, QString *error);
+};
+
+struct VerifyResult {
+    bool success = false;                 // all compared chunks matched
+    std::vector<quint64> mismatchedChunks;
+    quint64 bytesRead = 0;
+    qint64 elapsedMs = 0;
+    QString error;                        // set when the data could not be read at all
+};
+
+class PartitionVerifier {
+public:
+    static constexpr quint32 kDefaultChunkSize = 8 * 1024 * 1024;
+
+    // Hash [offset, offset + length) of path; length 0 means up to the end.
+    static bool hash(const QString& path, quint64 offset, quint64 length, quint32 chunkSize,
+                     ChunkDigests& digests, QString *error);
+
+    // Re-read every chunk and compare against the stored digests.
+    static VerifyResult verify(const QString& path, const ChunkDigests& digests);
+
+    // Re-read only the dirty chunks, store their new digests and clear the
+    // dirty marks. mismatchedChunks lists the chunks whose content changed;
+    // success only reports whether all dirty chunks could be read.
+    static VerifyResult refresh(const QString& path, ChunkDigests& digests);
+
+    // Compare a restored target against the chunk checksums of a partition image.
+    static VerifyResult verifyImage(const QString& imagePath, const QString& targetPath);
+
+    // Remembers that digestPath holds the digests of partitionPath, so the
+    // writes reported below mark the chunks they touch dirty in it.
+    static void registerDigests(const QString& devicePath, const QString& partitionPath, const QString& digestPath);
+    // Called by every path that writes partition data: marks
+    // [offset, offset + length) dirty in the digest files of partitionPath,
+    // length 0 up to the end.
+    static void markWritten(const QString& partitionPath, quint64 offset, quint64 length);
+    // A new partition table: every registered partition of the device is dirty
+    static void markDeviceWritten(const QString& devicePath);
+};
+
+#endif // PARTITIONVERIFIER_H
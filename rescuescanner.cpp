@@ -0,0 +1,437 @@
+#include "rescuescanner.h"
+#include "checksum.h"
+#include "logger.h"
+#include "metrics.h"
+#include <QElapsedTimer>
+#include <QThread>
+#include <QtConcurrent>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+namespace {
+
+const qint64 kSectorStep = 512;
+// Furthest byte any probe reads, relative to the sector it checks (swap signature ends at 4096)
+const qint64 kProbeWindow = 4096;
+const qint64 kDirectAlignment = 4096;
+
+inline quint16 le16(const unsigned char *p) { return p[0] | (p[1] << 8); }
+inline quint32 le32(const unsigned char *p) { return le16(p) | ((quint32)le16(p + 2) << 16); }
+inline quint64 le64(const unsigned char *p) { return le32(p) | ((quint64)le32(p + 4) << 32); }
+inline quint32 be32(const unsigned char *p) { return ((quint32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+inline quint64 be64(const unsigned char *p) { return ((quint64)be32(p) << 32) | be32(p + 4); }
+
+QString latin1Field(const unsigned char *p, int size) {
+    return QString::fromLatin1(reinterpret_cast<const char *>(p), strnlen(reinterpret_cast<const char *>(p), size)).trimmed();
+}
+
+bool isPowerOfTwo(quint64 value) {
+    return value && !(value & (value - 1));
+}
+
+// --- Signature probes: 'p' is the first byte of a possible partition ---
+
+bool probeExt(const unsigned char *p, qint64 available, RescueCandidate *c) {
+    if (available < 2048) return false;
+    const unsigned char *sb = p + 1024;
+    if (le16(sb + 56) != 0xEF53) return false;
+
+    quint32 logBlockSize = le32(sb + 24);
+    if (logBlockSize > 6) return false;
+    qint64 blockSize = 1024LL << logBlockSize;
+    if (le32(sb + 20) != (blockSize == 1024 ? 1u : 0u)) return false; // s_first_data_block
+    if (le16(sb + 90) != 0) return false; // backup superblocks carry their group number
+
+    quint32 compat = le32(sb + 92);
+    quint32 incompat = le32(sb + 96);
+    quint64 blocks = le32(sb + 4);
+    if (incompat & 0x80) blocks |= (quint64)le32(sb + 0x150) << 32; // 64bit
+    if (blocks == 0) return false;
+
+    c->length = blocks * blockSize;
+    c->fileSystem = (incompat & (0x40 | 0x80 | 0x200)) ? "ext4" : (compat & 0x4) ? "ext3" : "ext2";
+    c->label = latin1Field(sb + 120, 16);
+    return true;
+}
+
+bool probeXfs(const unsigned char *p, qint64 available, RescueCandidate *c) {
+    if (available < 512 || memcmp(p, "XFSB", 4) != 0) return false;
+    quint32 blockSize = be32(p + 4);
+    quint64 blocks = be64(p + 8);
+    if (blockSize < 512 || blockSize > 65536 || !isPowerOfTwo(blockSize) || blocks == 0) return false;
+
+    c->length = blocks * blockSize;
+    c->fileSystem = "xfs";
+    c->label = latin1Field(p + 108, 12);
+    return true;
+}
+
+bool probeNtfs(const unsigned char *p, qint64 available, RescueCandidate *c) {
+    if (available < 512 || memcmp(p + 3, "NTFS    ", 8) != 0 || le16(p + 510) != 0xAA55) return false;
+    quint32 bytesPerSector = le16(p + 11);
+    quint64 sectors = le64(p + 40);
+    if (bytesPerSector < 512 || bytesPerSector > 4096 || !isPowerOfTwo(bytesPerSector) || sectors == 0) return false;
+
+    c->length = (sectors + 1) * bytesPerSector; // the backup boot sector follows the volume
+    c->fileSystem = "ntfs";
+    return true;
+}
+
+bool probeFat(const unsigned char *p, qint64 available, RescueCandidate *c) {
+    if (available < 512 || le16(p + 510) != 0xAA55 || (p[0] != 0xEB && p[0] != 0xE9)) return false;
+    quint32 bytesPerSector = le16(p + 11);
+    if (bytesPerSector < 512 || bytesPerSector > 4096 || !isPowerOfTwo(bytesPerSector)) return false;
+    if (!isPowerOfTwo(p[13]) || le16(p + 14) == 0 || p[16] < 1 || p[16] > 2) return false;
+
+    quint64 sectors = le16(p + 19) ? le16(p + 19) : le32(p + 32);
+    if (sectors == 0) return false;
+    if (memcmp(p + 82, "FAT32   ", 8) == 0) {
+        c->fileSystem = "fat32";
+        c->label = latin1Field(p + 71, 11);
+    } else if (memcmp(p + 54, "FAT1", 4) == 0) {
+        c->fileSystem = "fat16";
+        c->label = latin1Field(p + 43, 11);
+    } else {
+        return false;
+    }
+    if (c->label == "NO NAME") c->label.clear();
+    c->length = sectors * bytesPerSector;
+    return true;
+}
+
+bool probeSwap(const unsigned char *p, qint64 available, RescueCandidate *c) {
+    if (available < 4096 || memcmp(p + 4086, "SWAPSPACE2", 10) != 0) return false;
+    quint32 lastPage = le32(p + 1028);
+    if (le32(p + 1024) != 1 || lastPage == 0) return false;
+
+    c->length = ((qint64)lastPage + 1) * 4096;
+    c->fileSystem = "linux-swap(v1)";
+    c->label = latin1Field(p + 1052, 16);
+    return true;
+}
+
+// Extended boot record of an msdos logical partition: no boot code, one
+// data entry, optionally a link to the next EBR, nothing else.
+bool probeEbr(const unsigned char *p, qint64 available, qint64 offset, int sectorSize, RescueCandidate *c) {
+    static const unsigned char zeros[446] = {};
+    if (available < 512 || offset == 0 || le16(p + 510) != 0xAA55) return false;
+    if (memcmp(p, zeros, 446) != 0 || memcmp(p + 446 + 32, zeros, 32) != 0) return false;
+
+    const unsigned char *entry = p + 446;
+    quint8 type = entry[4];
+    quint32 relativeStart = le32(entry + 8);
+    quint32 sectors = le32(entry + 12);
+    if (type == 0 || type == 0x05 || type == 0x0F || type == 0x85 || type == 0xEE) return false;
+    if (relativeStart == 0 || sectors == 0) return false;
+
+    c->start = offset + (qint64)relativeStart * sectorSize;
+    c->length = (qint64)sectors * sectorSize;
+    c->logical = true;
+    c->ebrOffset = offset;
+    c->source = QString("msdos EBR at byte %1").arg(offset);
+    c->confidence = 2;
+    return true;
+}
+
+struct GptHeaderHit {
+    qint64 offset = 0;
+    int sectorSize = 0;
+    quint64 entriesLba = 0;
+    quint32 entryCount = 0;
+    quint32 entrySize = 0;
+    quint32 entriesCrc = 0;
+};
+
+// Primary (LBA 1) or backup (last LBA) GPT header; only headers sitting where
+// they say they are count, which also tells the sector size of the table.
+// The header CRC must match, a stale or torn header is not trusted.
+bool probeGpt(const unsigned char *p, qint64 available, qint64 offset, GptHeaderHit *hit) {
+    if (available < 512 || memcmp(p, "EFI PART", 8) != 0) return false;
+    quint32 headerSize = le32(p + 12);
+    quint64 myLba = le64(p + 24);
+    if (headerSize < 92 || headerSize > 512) return false;
+
+    // Computed with the CRC field itself zeroed
+    unsigned char header[512];
+    memcpy(header, p, headerSize);
+    memset(header + 16, 0, 4);
+    if (Checksum::crc32(header, headerSize) != le32(p + 16)) return false;
+
+    for (int sectorSize : {512, 4096}) {
+        if (myLba * sectorSize == (quint64)offset) {
+            hit->offset = offset;
+            hit->sectorSize = sectorSize;
+            hit->entriesLba = le64(p + 72);
+            hit->entryCount = le32(p + 80);
+            hit->entrySize = le32(p + 84);
+            hit->entriesCrc = le32(p + 88);
+            return hit->entryCount > 0 && hit->entryCount <= 1024 &&
+                   hit->entrySize >= 128 && hit->entrySize <= 1024 && isPowerOfTwo(hit->entrySize);
+        }
+    }
+    return false;
+}
+
+// Page aligned buffer for O_DIRECT reads, one per pool thread
+struct AlignedBuffer {
+    char *data = nullptr;
+    size_t size = 0;
+
+    ~AlignedBuffer() { free(data); }
+
+    bool reserve(size_t bytes) {
+        if (bytes <= size) return true;
+        free(data);
+        data = nullptr;
+        size = 0;
+        if (posix_memalign(reinterpret_cast<void **>(&data), kDirectAlignment, bytes) != 0) return false;
+        size = bytes;
+        return true;
+    }
+};
+
+struct ScanJob {
+    qint64 offset = 0; // first sector to check
+    qint64 length = 0;
+    std::vector<RescueCandidate> candidates;
+    std::vector<GptHeaderHit> gptHeaders;
+    bool ok = true;
+};
+
+// Reads [offset, offset + length) into buffer; returns the bytes read (short at the device end) or -1
+qint64 readRange(int fd, char *buffer, qint64 length, qint64 offset) {
+    qint64 done = 0;
+    while (done < length) {
+        ssize_t n = pread(fd, buffer + done, length - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+void scanJob(ScanJob& job, int directFd, int bufferedFd, int sectorSize) {
+    thread_local AlignedBuffer buffer;
+
+    // O_DIRECT wants aligned offsets and sizes, the extra window lets probes
+    // near the end of the chunk see the bytes they need
+    qint64 readStart = job.offset & ~(kDirectAlignment - 1);
+    qint64 readLength = ((job.offset + job.length + kProbeWindow - readStart) + kDirectAlignment - 1) & ~(kDirectAlignment - 1);
+    if (!buffer.reserve(readLength)) {
+        job.ok = false;
+        return;
+    }
+
+    qint64 got = directFd >= 0 ? readRange(directFd, buffer.data, readLength, readStart) : -1;
+    if (got < 0) {
+        got = readRange(bufferedFd, buffer.data, readLength, readStart);
+        if (got < 0) {
+            job.ok = false;
+            return;
+        }
+    }
+
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(buffer.data);
+    qint64 first = (job.offset + kSectorStep - 1) & ~(kSectorStep - 1);
+    for (qint64 pos = first; pos < job.offset + job.length; pos += kSectorStep) {
+        qint64 index = pos - readStart;
+        qint64 available = got - index;
+        if (available < 512) break;
+        const unsigned char *p = data + index;
+
+        // Each probe starts with a fixed-offset compare, so a sector
+        // without any signature costs a handful of loads.
+        RescueCandidate candidate;
+        if (probeExt(p, available, &candidate) || probeXfs(p, available, &candidate) ||
+            probeNtfs(p, available, &candidate) || probeFat(p, available, &candidate) ||
+            probeSwap(p, available, &candidate)) {
+            candidate.start = pos;
+            candidate.source = QString("%1 signature").arg(candidate.fileSystem);
+            candidate.confidence = 1;
+            job.candidates.push_back(candidate);
+            continue;
+        }
+
+        RescueCandidate logical;
+        if (probeEbr(p, available, pos, sectorSize, &logical)) {
+            job.candidates.push_back(logical);
+            continue;
+        }
+
+        GptHeaderHit gpt;
+        if (probeGpt(p, available, pos, &gpt)) {
+            job.gptHeaders.push_back(gpt);
+        }
+    }
+}
+
+void addGptEntries(int fd, const QString& devicePath, const GptHeaderHit& header, std::vector<RescueCandidate>& candidates) {
+    std::vector<unsigned char> table((size_t)header.entryCount * header.entrySize);
+    qint64 got = readRange(fd, reinterpret_cast<char *>(table.data()), table.size(), header.entriesLba * header.sectorSize);
+    if (got != (qint64)table.size()) return;
+    // A header left over from an earlier label usually points at an array
+    // that has since been overwritten
+    if (Checksum::crc32(table.data(), table.size()) != header.entriesCrc) {
+        LOG_DEBUG("rescue-scan", devicePath, QString("GPT header at byte %1 has a bad partition array CRC, ignored.").arg(header.offset));
+        return;
+    }
+
+    static const unsigned char zeros[16] = {};
+    for (quint32 i = 0; i < header.entryCount; ++i) {
+        const unsigned char *entry = table.data() + (size_t)i * header.entrySize;
+        if (memcmp(entry, zeros, 16) == 0) continue; // unused entry
+        quint64 firstLba = le64(entry + 32);
+        quint64 lastLba = le64(entry + 40);
+        if (lastLba < firstLba) continue;
+
+        ushort name[36];
+        for (int c = 0; c < 36; ++c) name[c] = le16(entry + 56 + 2 * c);
+        int nameLength = 0;
+        while (nameLength < 36 && name[nameLength]) ++nameLength;
+
+        RescueCandidate candidate;
+        candidate.start = (qint64)firstLba * header.sectorSize;
+        candidate.length = (qint64)(lastLba - firstLba + 1) * header.sectorSize;
+        candidate.label = QString::fromUtf16(name, nameLength);
+        candidate.source = QString("GPT entry %1 (header at byte %2)").arg(i + 1).arg(header.offset);
+        candidate.confidence = 3;
+        candidates.push_back(candidate);
+    }
+}
+
+// Folds hits with the same start into one candidate (table bounds, file
+// system from the signature), then keeps the most trustworthy set of
+// candidates that do not overlap each other.
+std::vector<RescueCandidate> reconcile(std::vector<RescueCandidate> hits, qint64 deviceSize, int sectorSize,
+                                       const std::vector<std::pair<qint64, qint64>>& ranges) {
+    std::sort(hits.begin(), hits.end(), [](const RescueCandidate& a, const RescueCandidate& b) {
+        return a.start != b.start ? a.start < b.start : a.confidence > b.confidence;
+    });
+
+    std::vector<RescueCandidate> merged;
+    for (const RescueCandidate& hit : hits) {
+        if (hit.length <= 0 || hit.end() > deviceSize) continue;
+        // Probes step by 512 bytes; on a 4Kn device a partition can only
+        // start on a sector boundary
+        if (hit.start % sectorSize != 0) continue;
+        bool fits = std::any_of(ranges.begin(), ranges.end(), [&hit](const std::pair<qint64, qint64>& range) {
+            return hit.start >= range.first && hit.end() <= range.second;
+        });
+        if (!fits) continue;
+
+        if (!merged.empty() && merged.back().start == hit.start) {
+            RescueCandidate& best = merged.back();
+            if (best.fileSystem.isEmpty() && !hit.fileSystem.isEmpty()) {
+                // A table entry confirmed by the file system found at its start
+                best.fileSystem = hit.fileSystem;
+                if (best.label.isEmpty()) best.label = hit.label;
+                best.source += ", " + hit.source;
+                best.confidence += 1;
+            }
+            continue;
+        }
+        merged.push_back(hit);
+    }
+
+    std::stable_sort(merged.begin(), merged.end(), [](const RescueCandidate& a, const RescueCandidate& b) {
+        return a.confidence > b.confidence;
+    });
+    std::vector<RescueCandidate> accepted;
+    for (const RescueCandidate& candidate : merged) {
+        bool overlaps = std::any_of(accepted.begin(), accepted.end(), [&candidate](const RescueCandidate& other) {
+            return candidate.start < other.end() && other.start < candidate.end();
+        });
+        if (!overlaps) accepted.push_back(candidate);
+    }
+    std::sort(accepted.begin(), accepted.end(), [](const RescueCandidate& a, const RescueCandidate& b) {
+        return a.start < b.start;
+    });
+    return accepted;
+}
+
+} // namespace
+
+RescueScanResult RescueScanner::scan(const QString& devicePath, const RescueScanOptions& options,
+                                     const ImageProgressCallback& progress) {
+    Metrics::ScopedTrace trace("RescueScanner::scan", devicePath, false);
+    RescueScanResult result;
+    QElapsedTimer timer;
+    timer.start();
+
+    int bufferedFd = ::open(devicePath.toUtf8().constData(), O_RDONLY | O_CLOEXEC);
+    if (bufferedFd < 0) {
+        result.error = QString("Cannot open %1: %2").arg(devicePath).arg(strerror(errno));
+        return result;
+    }
+    // Regular image files on some file systems refuse O_DIRECT, they use the buffered fd
+    int directFd = ::open(devicePath.toUtf8().constData(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    posix_fadvise(bufferedFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    qint64 deviceSize = PartitionImage::deviceSize(bufferedFd);
+    std::vector<std::pair<qint64, qint64>> ranges = options.ranges;
+    if (ranges.empty()) {
+        ranges.push_back(std::make_pair(0, deviceSize));
+    }
+
+    const qint64 chunkSize = qMax<qint64>(options.chunkSize, 1024 * 1024) & ~(kDirectAlignment - 1);
+    std::vector<ScanJob> jobs;
+    quint64 totalBytes = 0;
+    for (const auto& range : ranges) {
+        qint64 end = qMin(range.second, deviceSize);
+        for (qint64 offset = range.first; offset < end; offset += chunkSize) {
+            ScanJob job;
+            job.offset = offset;
+            job.length = qMin(chunkSize, end - offset);
+            totalBytes += job.length;
+            jobs.push_back(job);
+        }
+    }
+
+    std::atomic<quint64> bytesDone(0);
+    std::atomic<bool> cancelled(false);
+    const int sectorSize = options.sectorSize > 0 ? options.sectorSize : 512;
+
+    // The calling thread only reports progress while the pool reads
+    QFuture<void> future = QtConcurrent::map(jobs, [&](ScanJob& job) {
+        if (cancelled.load(std::memory_order_relaxed)) return;
+        scanJob(job, directFd, bufferedFd, sectorSize);
+        bytesDone.fetch_add(job.length, std::memory_order_relaxed);
+    });
+    while (!future.isFinished()) {
+        if (progress && !progress(bytesDone.load(std::memory_order_relaxed), totalBytes)) {
+            cancelled.store(true);
+        }
+        QThread::msleep(50);
+    }
+    future.waitForFinished();
+
+    std::vector<RescueCandidate> hits;
+    for (const ScanJob& job : jobs) {
+        if (!job.ok && result.error.isEmpty()) {
+            result.error = QString("Read error at byte %1, the candidates may be incomplete.").arg(job.offset);
+        }
+        hits.insert(hits.end(), job.candidates.begin(), job.candidates.end());
+        for (const GptHeaderHit& header : job.gptHeaders) {
+            addGptEntries(bufferedFd, devicePath, header, hits);
+        }
+    }
+
+    if (directFd >= 0) ::close(directFd);
+    ::close(bufferedFd);
+
+    result.cancelled = cancelled.load();
+    result.candidates = reconcile(hits, deviceSize, sectorSize, ranges);
+    result.bytesScanned = bytesDone.load();
+    result.elapsedMs = timer.elapsed();
+    LOG_INFO("rescue-scan", devicePath, QString("Scanned %1 bytes in %2 ms: %3 signatures, %4 candidates.")
+                                            .arg(result.bytesScanned).arg(result.elapsedMs)
+                                            .arg(hits.size()).arg(result.candidates.size()));
+    trace.finish(!result.cancelled && result.error.isEmpty());
+    return result;
+}
@@ -0,0 +1,50 @@
+#ifndef RESCUESCANNER_H
+#define RESCUESCANNER_H
+
+#include "partitionimage.h"
+#include <QString>
+#include <QtGlobal>
+#include <utility>
+#include <vector>
+
+// A partition that probably existed, reconstructed from what is left on the
+// disk: file system superblocks/boot sectors, GPT headers and msdos EBRs.
+struct RescueCandidate {
+    qint64 start = 0;      // bytes
+    qint64 length = 0;     // bytes
+    QString fileSystem;    // libparted name (ext4, xfs, ntfs, fat32, linux-swap(v1), ...), may be empty
+    QString label;         // volume label or GPT partition name
+    QString source;        // what the candidate was reconstructed from
+    bool logical = false;  // described by an msdos EBR
+    qint64 ebrOffset = -1; // bytes, where that EBR was found
+    int confidence = 0;    // table entry confirmed by a signature > table entry > signature only
+
+    qint64 end() const { return start + length; }
+};
+
+struct RescueScanOptions {
+    quint32 chunkSize = 16 * 1024 * 1024;
+    int sectorSize = 512; // logical sector size of the device
+    // Byte ranges [start, end) to search, e.g. the free gaps of the device;
+    // empty means the whole device. Candidates must fit into one range.
+    std::vector<std::pair<qint64, qint64>> ranges;
+};
+
+struct RescueScanResult {
+    std::vector<RescueCandidate> candidates; // sorted by start, never overlapping
+    quint64 bytesScanned = 0;
+    qint64 elapsedMs = 0;
+    bool cancelled = false;
+    QString error;
+};
+
+class RescueScanner {
+public:
+    // Reads the ranges in large chunks on the global thread pool (O_DIRECT where possible,
+    // so a multi-TB scan does not flush the page cache) and checks every
+    // 512 byte sector for the known signatures.
+    static RescueScanResult scan(const QString& devicePath, const RescueScanOptions& options,
+                                 const ImageProgressCallback& progress = ImageProgressCallback());
+};
+
+#endif // RESCUESCANNER_H
@@ -0,0 +1,51 @@
+#include "sparklinedelegate.h"
+#include <QPainter>
+#include <QPainterPath>
+#include <QVector>
+#include <algorithm>
+
+SparklineDelegate::SparklineDelegate(QObject *parent) : QStyledItemDelegate(parent) {}
+
+void SparklineDelegate::paint(QPainter *painter, const QStyleOptionViewItem& option, const QModelIndex& index) const {
+    QVariant data = index.data(kHistoryRole);
+    if (!data.canConvert<QVector<float>>()) {
+        QStyledItemDelegate::paint(painter, option, index);
+        return;
+    }
+    const QVector<float> history = data.value<QVector<float>>();
+
+    // Background and selection as for any other cell, then the line on top
+    QStyleOptionViewItem background = option;
+    initStyleOption(&background, index);
+    background.text.clear();
+    QStyledItemDelegate::paint(painter, background, index);
+
+    if (history.size() < 2) return;
+    float peak = *std::max_element(history.constBegin(), history.constEnd());
+    if (peak <= 0.0f) peak = 1.0f;
+
+    QRectF area = QRectF(option.rect).adjusted(3, 3, -3, -3);
+    double step = area.width() / (history.size() - 1);
+    QPainterPath line;
+    for (int i = 0; i < history.size(); ++i) {
+        QPointF point(area.left() + i * step, area.bottom() - area.height() * history[i] / peak);
+        if (i == 0) {
+            line.moveTo(point);
+        } else {
+            line.lineTo(point);
+        }
+    }
+
+    painter->save();
+    painter->setRenderHint(QPainter::Antialiasing);
+    QColor color = (option.state & QStyle::State_Selected) ? option.palette.highlightedText().color()
+                                                            : QColor(86, 140, 200);
+    painter->setPen(QPen(color, 1.2));
+    painter->drawPath(line);
+    painter->restore();
+}
+
+QSize SparklineDelegate::sizeHint(const QStyleOptionViewItem& option, const QModelIndex& index) const {
+    QSize size = QStyledItemDelegate::sizeHint(option, index);
+    return QSize(qMax(size.width(), 120), size.height());
+}
@@ -0,0 +1,20 @@
+#ifndef SPARKLINEDELEGATE_H
+#define SPARKLINEDELEGATE_H
+
+#include <QStyledItemDelegate>
+
+// Paints a QVector<float> stored under kHistoryRole as a small line chart,
+// scaled to its own maximum. Items without history paint normally.
+class SparklineDelegate : public QStyledItemDelegate {
+    Q_OBJECT
+
+public:
+    static const int kHistoryRole = Qt::UserRole + 20;
+
+    explicit SparklineDelegate(QObject *parent = nullptr);
+
+    void paint(QPainter *painter, const QStyleOptionViewItem& option, const QModelIndex& index) const override;
+    QSize sizeHint(const QStyleOptionViewItem& option, const QModelIndex& index) const override;
+};
+
+#endif // SPARKLINEDELEGATE_H
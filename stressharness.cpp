@@ -0,0 +1,288 @@
+#include "stressharness.h"
+#include "diskmanager.h"
+#include "logger.h"
+#include "mainwindow.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+#include <malloc.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+namespace {
+
+#ifdef STRESS_COUNT_ALLOCATIONS
+std::atomic<quint64> allocations{0};
+#endif
+
+const qint64 MiB = 1024 * 1024;
+const int kCycleSpaceMiB = 64; // left free at the end of every image for the cycles
+const int kCyclePartitionMiB = 16;
+
+// Resident set size and its peak from /proc/self/status, in kB
+void readRss(quint64 *rssKb, quint64 *peakKb) {
+    *rssKb = *peakKb = 0;
+    QFile status("/proc/self/status");
+    if (!status.open(QIODevice::ReadOnly)) return;
+    for (const QByteArray& line : status.readAll().split('\n')) {
+        if (line.startsWith("VmRSS:")) *rssKb = line.mid(6).trimmed().split(' ').first().toULongLong();
+        if (line.startsWith("VmHWM:")) *peakKb = line.mid(6).trimmed().split(' ').first().toULongLong();
+    }
+}
+
+// Bytes handed out by malloc, which is what Qt containers and libparted use
+quint64 heapInUse() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return (quint32)mallinfo().uordblks;
+#endif
+}
+
+bool isGpt(int index) {
+    return index % 2 == 0;
+}
+
+} // namespace
+
+#ifdef STRESS_COUNT_ALLOCATIONS
+// Counts the operator new calls of the whole process for the --stress
+// report. Every allocation on every thread pays for the atomic increment,
+// so it is only built in on request (see DiskChanger.pro).
+void *operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *memory = malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *memory) noexcept {
+    free(memory);
+}
+
+void operator delete[](void *memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+    free(memory);
+}
+
+void operator delete[](void *memory, std::size_t) noexcept {
+    free(memory);
+}
+#endif
+
+StressHarness::StressHarness(const StressOptions& options) : m_options(options) {
+    m_options.devices = qMax(1, m_options.devices);
+    m_options.partitions = qMax(1, m_options.partitions);
+}
+
+qint64 StressHarness::allocationCount() {
+#ifdef STRESS_COUNT_ALLOCATIONS
+    return allocations.load(std::memory_order_relaxed);
+#else
+    return -1;
+#endif
+}
+
+double StressHarness::Latencies::percentileMs(double percentile) {
+    if (samples.empty()) return 0.0;
+    std::sort(samples.begin(), samples.end());
+    size_t index = std::min(samples.size() - 1, (size_t)(percentile / 100.0 * samples.size()));
+    return samples[index] / 1e6;
+}
+
+bool StressHarness::createImage(const QString& directory, int index, QString *path, QString *error) {
+    const bool gpt = isGpt(index);
+    const int partitions = qMin(m_options.partitions, gpt ? 127 : 60);
+    *path = QDir(directory).filePath(QString("stress-%1.img").arg(index, 4, 10, QChar('0')));
+
+    // Sparse: only the label sectors are ever written
+    QFile image(*path);
+    if (!image.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+        !image.resize((qint64)(2 * partitions + 2 + kCycleSpaceMiB) * MiB)) {
+        *error = QString("Cannot create %1: %2").arg(*path).arg(image.errorString());
+        return false;
+    }
+    image.close();
+
+    PedDevice *dev = ped_device_get(path->toUtf8().constData());
+    PedDisk *disk = dev ? ped_disk_new_fresh(dev, ped_disk_type_get(gpt ? "gpt" : "msdos")) : nullptr;
+    if (!disk) {
+        *error = QString("Cannot label %1.").arg(*path);
+        return false;
+    }
+
+    // One 1 MiB partition every 2 MiB; on msdos the fourth slot onwards are
+    // logical partitions, the gaps leave room for their EBRs
+    const PedSector mib = MiB / dev->sector_size;
+    const char *fileSystems[] = {"ext4", "linux-swap(v1)", "fat32", "xfs"};
+    bool ok = true;
+    for (int i = 0; i < partitions && ok; ++i) {
+        PedPartitionType type = PED_PARTITION_NORMAL;
+        if (!gpt && i >= 3) {
+            if (!ped_disk_extended_partition(disk)) {
+                PedPartition *extended = ped_partition_new(disk, PED_PARTITION_EXTENDED, NULL,
+                                                           2 * i * mib, (2 * partitions + 1) * mib - 1);
+                if (!extended) {
+                    ok = false;
+                    break;
+                }
+                PedConstraint *constraint = ped_constraint_exact(&extended->geom);
+                ok = ped_disk_add_partition(disk, extended, constraint);
+                ped_constraint_destroy(constraint);
+                if (!ok) break;
+            }
+            type = PED_PARTITION_LOGICAL;
+        }
+        PedSector start = (1 + 2 * i) * mib;
+        PedPartition *part = ped_partition_new(disk, type, ped_file_system_type_get(fileSystems[i % 4]),
+                                               start, start + mib - 1);
+        if (!part) {
+            ok = false;
+            break;
+        }
+        PedConstraint *constraint = ped_constraint_exact(&part->geom);
+        ok = ped_disk_add_partition(disk, part, constraint);
+        ped_constraint_destroy(constraint);
+    }
+
+    ok = ok && ped_disk_commit_to_dev(disk);
+    ped_disk_destroy(disk);
+    if (!ok) *error = QString("Cannot write the partition table of %1.").arg(*path);
+    return ok;
+}
+
+void StressHarness::runCycles(const QStringList& images, Latencies& create, Latencies& resize, Latencies& remove) {
+    DiskManager diskManager;
+    QElapsedTimer timer;
+
+    // GPT images only: their table always has a free entry for the cycle
+    QStringList targets;
+    for (int i = 0; i < images.size(); ++i) {
+        if (isGpt(i)) targets << images[i];
+    }
+    const int partitions = qMin(m_options.partitions, 127);
+    const long long startMB = 2 * partitions + 2;
+
+    for (int cycle = 0; cycle < m_options.cycles && !targets.isEmpty(); ++cycle) {
+        const QString& path = targets[cycle % targets.size()];
+
+        timer.start();
+        bool created = diskManager.createPartition(path, startMB, startMB + kCyclePartitionMiB / 2, QString(), "primary");
+        create.add(timer.nsecsElapsed());
+        if (!created) continue;
+
+        int number = 0;
+        for (const PartitionInfo& part : diskManager.scanDevice(path).partitions) {
+            if (!part.isFreeSpace && part.start >= startMB * MiB) number = part.number;
+        }
+        if (number <= 0) continue;
+
+        timer.start();
+        diskManager.resizePartition(path, number, startMB + kCyclePartitionMiB);
+        resize.add(timer.nsecsElapsed());
+
+        timer.start();
+        diskManager.deletePartition(path, number);
+        remove.add(timer.nsecsElapsed());
+    }
+}
+
+int StressHarness::run(QTextStream& out) {
+    QTemporaryDir temporary;
+    QString directory = m_options.directory;
+    if (directory.isEmpty()) {
+        if (!temporary.isValid()) {
+            out << "Cannot create a temporary directory: " << temporary.errorString() << Qt::endl;
+            return 1;
+        }
+        directory = temporary.path();
+    } else if (!QDir().mkpath(directory)) {
+        out << "Cannot create " << directory << Qt::endl;
+        return 1;
+    }
+
+    // Every operation on an image file logs the BLKPG fallback
+    if (!qEnvironmentVariableIsSet("PARTED_EXPLORER_LOG_LEVEL")) {
+        Log::setThreshold(LogLevel::Error);
+    }
+
+    MainWindow *window = nullptr;
+    if (m_options.tree) {
+        // Let the start-up revalidation of the real devices finish first, it
+        // would otherwise race the images into the topology cache
+        window = new MainWindow();
+        window->waitForRevalidation();
+        QCoreApplication::processEvents();
+    }
+
+    out << "devices partitions  scan ms  per dev ms  tree ms  create p50/p99 ms  resize p50 ms  delete p50 ms"
+           "  rss MB  peak MB  heap MB  new calls" << Qt::endl;
+
+    DiskManager diskManager;
+    QStringList images;
+    int count = 1;
+    for (;;) {
+        while (images.size() < count) {
+            QString path, error;
+            if (!createImage(directory, images.size(), &path, &error)) {
+                out << error << Qt::endl;
+                delete window;
+                return 1;
+            }
+            images << path;
+        }
+
+        qint64 allocationsBefore = allocationCount();
+        QElapsedTimer timer;
+
+        // The images are in libparted's device list since they were labelled,
+        // so this is the same path a refresh takes
+        timer.start();
+        std::vector<DeviceInfo> devices = diskManager.listAllDevices();
+        qint64 scanNs = timer.nsecsElapsed();
+        size_t partitionRows = 0;
+        for (const DeviceInfo& device : devices) {
+            partitionRows += device.partitions.size();
+        }
+
+        qint64 treeNs = 0;
+        if (window) {
+            timer.start();
+            window->showTopology(devices);
+            QCoreApplication::processEvents();
+            treeNs = timer.nsecsElapsed();
+        }
+
+        Latencies create, resize, remove;
+        runCycles(images, create, resize, remove);
+
+        quint64 rssKb, peakKb;
+        readRss(&rssKb, &peakKb);
+        out << QString("%1 %2 %3 %4 %5 %6/%7 %8 %9 %10 %11 %12 %13")
+                   .arg(devices.size(), 7).arg(partitionRows, 10)
+                   .arg(scanNs / 1e6, 8, 'f', 1).arg(scanNs / 1e6 / qMax<size_t>(1, devices.size()), 11, 'f', 2)
+                   .arg(treeNs / 1e6, 8, 'f', 1)
+                   .arg(create.percentileMs(50), 11, 'f', 1).arg(create.percentileMs(99), -6, 'f', 1)
+                   .arg(resize.percentileMs(50), 14, 'f', 1).arg(remove.percentileMs(50), 14, 'f', 1)
+                   .arg(rssKb / 1024.0, 7, 'f', 1).arg(peakKb / 1024.0, 8, 'f', 1)
+                   .arg(heapInUse() / double(MiB), 8, 'f', 1)
+                   .arg(allocationsBefore < 0 ? QString("-") : QString::number(allocationCount() - allocationsBefore), 10)
+            << Qt::endl;
+
+        if (count == m_options.devices) break;
+        count = qMin(count * 2, m_options.devices);
+    }
+
+    delete window;
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef STRESSHARNESS_H
+#define STRESSHARNESS_H
+
+#include <QString>
+#include <QTextStream>
+#include <QtGlobal>
+#include <vector>
+
+struct StressOptions {
+    QString directory;   // where the images are created, empty = a temporary directory
+    int devices = 64;    // device count of the last step; steps double from 1
+    int partitions = 16; // per device, at most 127 on GPT and 60 on msdos
+    int cycles = 20;     // create/resize/delete cycles per step
+    bool tree = true;    // also time filling the tree of a MainWindow
+};
+
+// Builds synthetic topologies from sparse image files labelled through
+// libparted (GPT, and msdos with extended/logical partitions) and measures
+// scanning, the tree view and partition operations while the device count
+// grows. Prints one line per step.
+class StressHarness {
+public:
+    explicit StressHarness(const StressOptions& options);
+
+    // Returns the exit code of the --stress mode
+    int run(QTextStream& out);
+
+    // operator new calls of the whole process so far, -1 unless built with
+    // STRESS_COUNT_ALLOCATIONS
+    static qint64 allocationCount();
+
+private:
+    struct Latencies {
+        std::vector<qint64> samples; // ns
+        void add(qint64 ns) { samples.push_back(ns); }
+        double percentileMs(double percentile);
+    };
+
+    bool createImage(const QString& directory, int index, QString *path, QString *error);
+    void runCycles(const QStringList& images, Latencies& create, Latencies& resize, Latencies& remove);
+
+    StressOptions m_options;
+};
+
+#endif // STRESSHARNESS_H
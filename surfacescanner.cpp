@@ -0,0 +1,256 @@
+#include "surfacescanner.h"
+#include "partitionimage.h"
+#include "logger.h"
+#include "metrics.h"
+#include <QMutexLocker>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+namespace {
+
+const quint32 kNotRead = 0xFFFFFFFFu;
+const size_t kDirectAlignment = 4096;
+
+qint64 nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Reads the whole range, EINTR and partial reads retried. Callers clamp the
+// range to the device end, so hitting EOF (n == 0) counts as a failed read.
+bool readBlock(int fd, char *buffer, quint64 length, quint64 offset) {
+    quint64 done = 0;
+    while (done < length) {
+        ssize_t n = pread(fd, buffer + done, length - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+void raiseToAtLeast(std::atomic<quint32>& cell, quint32 value) {
+    quint32 current = cell.load(std::memory_order_relaxed);
+    while ((current == kNotRead || current < value) &&
+           !cell.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+} // namespace
+
+quint64 SurfaceScanResult::badSectorCount() const {
+    return badSectorsIn(0, ~0ULL);
+}
+
+quint64 SurfaceScanResult::badSectorsIn(quint64 start, quint64 end) const {
+    quint64 bytes = 0;
+    for (const BadSectorRange& range : badRanges) {
+        quint64 from = std::max(start, range.offset);
+        quint64 to = std::min(end, range.offset + range.length);
+        if (from < to) bytes += to - from;
+    }
+    return sectorSize ? (bytes + sectorSize - 1) / sectorSize : 0;
+}
+
+float SurfaceScanResult::worstLatencyIn(quint64 start, quint64 end) const {
+    float worst = -1;
+    for (size_t i = 0; i < heatmap.size(); ++i) {
+        quint64 cellStart = offset + i * heatmapCellBytes;
+        if (cellStart < end && start < cellStart + heatmapCellBytes) worst = std::max(worst, heatmap[i]);
+    }
+    return worst;
+}
+
+void SurfaceScanControl::pause() {
+    QMutexLocker locker(&m_mutex);
+    m_paused.store(true);
+}
+
+void SurfaceScanControl::resume() {
+    QMutexLocker locker(&m_mutex);
+    m_paused.store(false);
+    // No catching up on the bandwidth not used while paused
+    m_nextSlotNs.store(0);
+    m_resumed.wakeAll();
+}
+
+void SurfaceScanControl::cancel() {
+    QMutexLocker locker(&m_mutex);
+    m_cancelled.store(true);
+    m_resumed.wakeAll();
+}
+
+void SurfaceScanControl::setRateLimit(quint64 bytesPerSecond) {
+    m_rateLimit.store(bytesPerSecond);
+    m_nextSlotNs.store(0);
+}
+
+bool SurfaceScanControl::waitWhilePaused() {
+    if (!m_paused.load()) return !m_cancelled.load();
+    QMutexLocker locker(&m_mutex);
+    while (m_paused.load() && !m_cancelled.load()) {
+        m_resumed.wait(&m_mutex);
+    }
+    return !m_cancelled.load();
+}
+
+void SurfaceScanControl::throttle(quint64 bytes) {
+    quint64 rate = m_rateLimit.load(std::memory_order_relaxed);
+    if (rate == 0) return;
+
+    qint64 cost = qint64(bytes * 1e9 / rate);
+    qint64 now = nowNs();
+    qint64 slot = m_nextSlotNs.load();
+    qint64 start;
+    do {
+        start = std::max(slot, now);
+    } while (!m_nextSlotNs.compare_exchange_weak(slot, start + cost));
+
+    // Sleep in slices so cancel, pause and a new limit are noticed quickly
+    while (nowNs() < start && !m_cancelled.load() && !m_paused.load() &&
+           m_rateLimit.load(std::memory_order_relaxed) == rate) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(std::min<qint64>(start - nowNs(), 50000000)));
+    }
+}
+
+SurfaceScanResult SurfaceScanner::scan(const QString& devicePath, const SurfaceScanOptions& options,
+                                       SurfaceScanControl& control) {
+    Metrics::ScopedTrace trace("SurfaceScanner::scan", devicePath, false);
+    SurfaceScanResult result;
+    result.devicePath = devicePath;
+    result.sectorSize = options.sectorSize ? options.sectorSize : 512;
+
+    // Bypass the page cache: every read has to reach the medium, and a scan
+    // of a live system must not evict everything else
+    int fd = ::open(devicePath.toUtf8().constData(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    result.direct = fd >= 0;
+    if (fd < 0) {
+        fd = ::open(devicePath.toUtf8().constData(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            result.error = QString("Cannot open %1: %2").arg(devicePath).arg(strerror(errno));
+            return result;
+        }
+        LOG_WARNING("surface-scan", devicePath, "O_DIRECT not supported, latencies include the page cache.");
+    }
+
+    const quint64 sectorSize = result.sectorSize;
+    quint64 deviceSize = PartitionImage::deviceSize(fd);
+    result.offset = options.offset / sectorSize * sectorSize;
+    quint64 end = options.length ? std::min(deviceSize, options.offset + options.length) : deviceSize;
+    result.length = end > result.offset ? end - result.offset : 0;
+
+    const quint64 blockSize = std::max<quint64>(options.blockSize / sectorSize * sectorSize, sectorSize);
+    const quint64 blockCount = (result.length + blockSize - 1) / blockSize;
+    const quint64 cells = std::max<quint64>(1, std::min<quint64>(options.heatmapCells, blockCount));
+    result.heatmapCellBytes = std::max<quint64>(1, (result.length + cells - 1) / cells);
+    std::unique_ptr<std::atomic<quint32>[]> heatmap(new std::atomic<quint32>[cells]);
+    for (quint64 i = 0; i < cells; ++i) heatmap[i].store(kNotRead);
+
+    control.m_bytesTotal.store(result.length);
+    control.m_bytesDone.store(0);
+    control.m_badSectors.store(0);
+
+    std::atomic<quint64> nextBlock(0);
+    QMutex resultMutex;
+    const qint64 slowNs = qint64(options.slowThresholdMs) * 1000000;
+    qint64 startNs = nowNs();
+
+    // Each worker keeps one synchronous read in flight, so 'workers' is the
+    // queue depth the device sees
+    auto worker = [&]() {
+        std::unique_ptr<char, decltype(&free)> buffer(nullptr, &free);
+        void *memory = nullptr;
+        if (posix_memalign(&memory, kDirectAlignment, blockSize) != 0) return;
+        buffer.reset(static_cast<char *>(memory));
+
+        std::vector<BadSectorRange> bad;
+        std::vector<quint64> slow;
+        while (control.waitWhilePaused()) {
+            quint64 index = nextBlock.fetch_add(1);
+            if (index >= blockCount) break;
+            quint64 offset = result.offset + index * blockSize;
+            quint64 length = std::min(blockSize, end - offset);
+            control.throttle(length);
+
+            qint64 readStart = nowNs();
+            bool ok = readBlock(fd, buffer.get(), length, offset);
+            qint64 latency = nowNs() - readStart;
+
+            if (!ok) {
+                // Narrow the failure down to single sectors
+                for (quint64 sector = offset; sector < offset + length; sector += sectorSize) {
+                    if (readBlock(fd, buffer.get(), sectorSize, sector)) continue;
+                    if (!bad.empty() && bad.back().offset + bad.back().length == sector) {
+                        bad.back().length += sectorSize;
+                    } else {
+                        bad.push_back({sector, sectorSize});
+                    }
+                    control.m_badSectors.fetch_add(1, std::memory_order_relaxed);
+                }
+                latency = nowNs() - readStart;
+            }
+            if (latency >= slowNs) slow.push_back(offset);
+
+            quint32 micros = quint32(std::min<qint64>(latency / 1000, kNotRead - 1));
+            quint64 firstCell = (offset - result.offset) / result.heatmapCellBytes;
+            quint64 lastCell = std::min(cells - 1, (offset + length - 1 - result.offset) / result.heatmapCellBytes);
+            for (quint64 cell = firstCell; cell <= lastCell; ++cell) {
+                raiseToAtLeast(heatmap[cell], micros);
+            }
+            control.m_bytesDone.fetch_add(length, std::memory_order_relaxed);
+        }
+
+        QMutexLocker locker(&resultMutex);
+        result.badRanges.insert(result.badRanges.end(), bad.begin(), bad.end());
+        result.slowBlocks.insert(result.slowBlocks.end(), slow.begin(), slow.end());
+    };
+
+    // Own pool: the workers mostly wait for the device and must not starve
+    // the global pool
+    QThreadPool pool;
+    pool.setMaxThreadCount(std::max(1, options.workers));
+    for (int i = 0; i < std::max(1, options.workers); ++i) {
+        QtConcurrent::run(&pool, worker);
+    }
+    pool.waitForDone();
+    ::close(fd);
+
+    // Merge the runs of the workers, which may touch at block boundaries
+    std::sort(result.badRanges.begin(), result.badRanges.end(), [](const BadSectorRange& a, const BadSectorRange& b) {
+        return a.offset < b.offset;
+    });
+    std::vector<BadSectorRange> merged;
+    for (const BadSectorRange& range : result.badRanges) {
+        if (!merged.empty() && merged.back().offset + merged.back().length == range.offset) {
+            merged.back().length += range.length;
+        } else {
+            merged.push_back(range);
+        }
+    }
+    result.badRanges.swap(merged);
+    std::sort(result.slowBlocks.begin(), result.slowBlocks.end());
+
+    result.heatmap.resize(cells);
+    for (quint64 i = 0; i < cells; ++i) {
+        quint32 micros = heatmap[i].load();
+        result.heatmap[i] = micros == kNotRead ? -1.0f : micros / 1000.0f;
+    }
+    result.bytesScanned = control.bytesDone();
+    result.elapsedMs = (nowNs() - startNs) / 1000000;
+    result.cancelled = control.isCancelled();
+
+    LOG_INFO("surface-scan", devicePath, QString("Read %1 of %2 bytes in %3 ms: %4 unreadable sector(s), %5 slow block(s).")
+                                             .arg(result.bytesScanned).arg(result.length).arg(result.elapsedMs)
+                                             .arg(result.badSectorCount()).arg(result.slowBlocks.size()));
+    trace.finish(!result.cancelled && result.badRanges.empty());
+    return result;
+}
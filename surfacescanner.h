@@ -0,0 +1,92 @@
+#ifndef SURFACESCANNER_H
+#define SURFACESCANNER_H
+
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+#include <QtGlobal>
+#include <atomic>
+#include <vector>
+
+struct SurfaceScanOptions {
+    quint64 offset = 0;       // bytes, multiple of sectorSize
+    quint64 length = 0;       // 0 = up to the end of the device
+    quint32 blockSize = 1024 * 1024;
+    quint32 sectorSize = 512; // logical sector size, the unit bad sectors are reported in
+    int workers = 8;          // reads in flight at the same time
+    int heatmapCells = 512;
+    int slowThresholdMs = 200;
+};
+
+// Run of unreadable sectors, in bytes relative to the start of the device
+struct BadSectorRange {
+    quint64 offset = 0;
+    quint64 length = 0;
+};
+
+struct SurfaceScanResult {
+    QString devicePath;
+    quint64 offset = 0;
+    quint64 length = 0;
+    quint32 sectorSize = 512;
+    quint64 bytesScanned = 0;
+    qint64 elapsedMs = 0;
+    bool direct = false;                 // O_DIRECT, latencies are not page cache hits
+    std::vector<BadSectorRange> badRanges; // sorted, adjacent sectors merged
+    std::vector<quint64> slowBlocks;     // offsets of blocks slower than the threshold, sorted
+    std::vector<float> heatmap;          // worst read latency in ms per cell, -1 for cells not read
+    quint64 heatmapCellBytes = 0;
+    bool cancelled = false;
+    QString error;
+
+    quint64 badSectorCount() const;
+    // Bad sectors and worst latency within [start, end)
+    quint64 badSectorsIn(quint64 start, quint64 end) const;
+    float worstLatencyIn(quint64 start, quint64 end) const;
+};
+
+// Steers a running scan from another thread: pause/resume, cancel and a
+// bandwidth cap that can be changed while the scan runs.
+class SurfaceScanControl {
+public:
+    void pause();
+    void resume();
+    void cancel();
+    bool isPaused() const { return m_paused.load(); }
+    bool isCancelled() const { return m_cancelled.load(); }
+    void setRateLimit(quint64 bytesPerSecond); // 0 = unlimited
+
+    quint64 bytesDone() const { return m_bytesDone.load(std::memory_order_relaxed); }
+    quint64 bytesTotal() const { return m_bytesTotal.load(std::memory_order_relaxed); }
+    quint64 badSectors() const { return m_badSectors.load(std::memory_order_relaxed); }
+
+private:
+    friend class SurfaceScanner;
+
+    // Blocks while paused; false once the scan is cancelled
+    bool waitWhilePaused();
+    // Token bucket shared by all workers: reserves the time slot for 'bytes'
+    // and sleeps until it starts
+    void throttle(quint64 bytes);
+
+    QMutex m_mutex;
+    QWaitCondition m_resumed;
+    std::atomic<bool> m_paused{false};
+    std::atomic<bool> m_cancelled{false};
+    std::atomic<quint64> m_rateLimit{0};
+    std::atomic<qint64> m_nextSlotNs{0};
+    std::atomic<quint64> m_bytesDone{0};
+    std::atomic<quint64> m_bytesTotal{0};
+    std::atomic<quint64> m_badSectors{0};
+};
+
+class SurfaceScanner {
+public:
+    // Reads [offset, offset + length) of devicePath with O_DIRECT on
+    // options.workers threads and records unreadable sectors and read
+    // latencies. Runs until done or cancelled; call it off the GUI thread.
+    static SurfaceScanResult scan(const QString& devicePath, const SurfaceScanOptions& options,
+                                  SurfaceScanControl& control);
+};
+
+#endif // SURFACESCANNER_H
@@ -0,0 +1,297 @@
+#include "topologycache.h"
+#include "logger.h"
+#include "metrics.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+
+namespace {
+
+const quint32 kCacheMagic = 0x50585443; // "PXTC"
+// Bump whenever DeviceInfo/PartitionInfo or the fingerprint change, old caches are then ignored
+const quint32 kCacheVersion = 2;
+const quint32 kMaxCachedDevices = 4096;
+
+// Enough to see the signatures ext*, xfs, ntfs, fat and swap keep at the start of a partition
+const int kFileSystemHeaderBytes = 4096;
+
+quint64 fnv1a(quint64 hash, const void *data, size_t length) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+quint64 fnv1a(quint64 hash, const QString& text) {
+    QByteArray bytes = text.toUtf8();
+    return fnv1a(hash, bytes.constData(), bytes.size() + 1); // include the terminator as a separator
+}
+
+QString readSysfs(const QString& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return QString();
+    return QString::fromUtf8(file.readAll()).trimmed();
+}
+
+// Reads up to 'length' bytes at 'offset'; returns the number of bytes read
+qint64 readAt(const QString& path, qint64 offset, char *buffer, qint64 length) {
+    int fd = ::open(path.toUtf8().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t got = pread(fd, buffer, length, offset);
+    ::close(fd);
+    return got > 0 ? got : 0;
+}
+
+QString gptDiskGuid(const unsigned char *header) {
+    // Mixed endian like every EFI GUID: the first three fields are little-endian
+    const unsigned char *g = header + 56;
+    return QString::asprintf("%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+                             g[3], g[2], g[1], g[0], g[5], g[4], g[7], g[6],
+                             g[8], g[9], g[10], g[11], g[12], g[13], g[14], g[15]);
+}
+
+void writeDevice(QDataStream& out, const CachedDevice& device) {
+    const DeviceFingerprint& fp = device.fingerprint;
+    out << fp.path << fp.serial << (qint64)fp.size << fp.labelId << fp.contentHash;
+
+    const DeviceInfo& info = device.info;
+    out << info.model << info.path << (qint64)info.size << (qint64)info.sectorSize
+        << (qint64)info.alignmentBytes << (qint64)info.alignmentOffsetBytes << (qint64)info.lengthSectors;
+    out << (quint32)info.partitions.size();
+    for (const PartitionInfo& part : info.partitions) {
+        out << (qint32)part.number << part.type << part.fileSystem
+            << (qint64)part.start << (qint64)part.end << (qint64)part.size
+            << (qint64)part.startSector << (qint64)part.endSector << part.flags
+            << part.isFreeSpace << part.devicePath << part.isExtendedContainer << part.isLogical;
+    }
+}
+
+bool readDevice(QDataStream& in, CachedDevice& device) {
+    qint64 size, sectorSize, alignmentBytes, alignmentOffsetBytes, lengthSectors;
+    DeviceFingerprint& fp = device.fingerprint;
+    in >> fp.path >> fp.serial >> size >> fp.labelId >> fp.contentHash;
+    fp.size = size;
+
+    DeviceInfo& info = device.info;
+    in >> info.model >> info.path >> size >> sectorSize >> alignmentBytes >> alignmentOffsetBytes >> lengthSectors;
+    info.size = size;
+    info.lengthSectors = lengthSectors;
+    info.sectorSize = sectorSize;
+    info.alignmentBytes = alignmentBytes;
+    info.alignmentOffsetBytes = alignmentOffsetBytes;
+
+    quint32 partitionCount = 0;
+    in >> partitionCount;
+    if (in.status() != QDataStream::Ok || partitionCount > 65536) return false;
+    info.partitions.resize(partitionCount);
+    for (PartitionInfo& part : info.partitions) {
+        qint32 number;
+        qint64 start, end, partSize, startSector, endSector;
+        in >> number >> part.type >> part.fileSystem >> start >> end >> partSize
+           >> startSector >> endSector >> part.flags
+           >> part.isFreeSpace >> part.devicePath >> part.isExtendedContainer >> part.isLogical;
+        part.number = number;
+        part.start = start;
+        part.end = end;
+        part.size = partSize;
+        part.startSector = startSector;
+        part.endSector = endSector;
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+void setError(QString *error, const QString& message) {
+    if (error) *error = message;
+}
+
+} // namespace
+
+QString DeviceFingerprint::key() const {
+    // Without a serial the path is the best identity there is
+    QString identity = serial.isEmpty() ? QString("path:%1").arg(path) : serial;
+    return QString("%1|%2|%3").arg(identity, QString::number(size), labelId);
+}
+
+DeviceFingerprint TopologyCache::fingerprint(const QString& devicePath) {
+    DeviceFingerprint fp;
+    fp.path = devicePath;
+
+    QFileInfo node(devicePath);
+    QString name = QFileInfo(node.canonicalFilePath()).fileName();
+    QString sysfs = "/sys/class/block/" + name;
+
+    for (const char *attribute : {"/device/serial", "/device/wwid", "/wwid", "/loop/backing_file"}) {
+        fp.serial = readSysfs(sysfs + attribute);
+        if (!fp.serial.isEmpty()) break;
+    }
+    fp.size = readSysfs(sysfs + "/size").toLongLong() * 512; // sysfs counts 512 byte units
+
+    int sectorSize = readSysfs(sysfs + "/queue/logical_block_size").toInt();
+    if (sectorSize < 512 || sectorSize > 65536) sectorSize = 512;
+
+    quint64 hash = 14695981039346656037ULL;
+    hash = fnv1a(hash, &fp.size, sizeof(fp.size));
+
+    // Sector 0 holds the MBR (or protective MBR), the GPT header follows in
+    // LBA 1 and carries the CRC of the whole partition entry array.
+    std::vector<char> sectors(2 * sectorSize);
+    if (readAt(devicePath, 0, sectors.data(), sectors.size()) == (qint64)sectors.size()) {
+        const unsigned char *mbr = reinterpret_cast<const unsigned char *>(sectors.data());
+        const unsigned char *gpt = mbr + sectorSize;
+        hash = fnv1a(hash, mbr, sectorSize);
+        if (memcmp(gpt, "EFI PART", 8) == 0) {
+            fp.labelId = "gpt:" + gptDiskGuid(gpt);
+            hash = fnv1a(hash, gpt, 92);
+        } else if (mbr[510] == 0x55 && mbr[511] == 0xAA) {
+            quint32 signature = mbr[440] | (mbr[441] << 8) | (mbr[442] << 16) | ((quint32)mbr[443] << 24);
+            fp.labelId = QString("msdos:%1").arg(signature, 8, 16, QChar('0'));
+        }
+    }
+
+    // The kernel's view covers logical partitions whose EBRs are outside
+    // sector 0; the file system headers catch a mkfs without table change.
+    QStringList partitions = QDir(sysfs).entryList(QStringList() << name + "*", QDir::Dirs | QDir::NoDotAndDotDot);
+    std::sort(partitions.begin(), partitions.end());
+    std::vector<char> header(kFileSystemHeaderBytes);
+    for (const QString& partition : partitions) {
+        QString partitionSysfs = sysfs + "/" + partition;
+        if (!QFileInfo::exists(partitionSysfs + "/partition")) continue;
+        hash = fnv1a(hash, partition);
+        hash = fnv1a(hash, readSysfs(partitionSysfs + "/start"));
+        hash = fnv1a(hash, readSysfs(partitionSysfs + "/size"));
+        qint64 got = readAt("/dev/" + partition, 0, header.data(), header.size());
+        hash = fnv1a(hash, header.data(), got);
+    }
+
+    fp.contentHash = hash;
+    return fp;
+}
+
+QString TopologyCache::defaultPath() {
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/topology.bin";
+}
+
+bool TopologyCache::save(const QString& path, const std::vector<CachedDevice>& devices, QString *error) {
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        setError(error, QString("Cannot write %1: %2").arg(path, file.errorString()));
+        return false;
+    }
+
+    QDataStream out(&file);
+    out << kCacheMagic << kCacheVersion;
+    out.setVersion(QDataStream::Qt_5_15);
+    out << (qint64)QDateTime::currentMSecsSinceEpoch() << (quint32)devices.size();
+    for (const CachedDevice& device : devices) {
+        writeDevice(out, device);
+    }
+
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        setError(error, QString("Failed to write %1.").arg(path));
+        return false;
+    }
+    return true;
+}
+
+bool TopologyCache::load(const QString& path, std::vector<CachedDevice>& devices, qint64 *savedAtMs, QString *error) {
+    Metrics::ScopedTrace trace("TopologyCache::load", QString(), false);
+    devices.clear();
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        setError(error, QString("No topology cache at %1.").arg(path));
+        return false;
+    }
+
+    QDataStream in(&file);
+    quint32 magic = 0;
+    quint32 version = 0;
+    in >> magic >> version;
+    if (magic != kCacheMagic || version != kCacheVersion) {
+        setError(error, QString("%1 is not a version %2 topology cache.").arg(path).arg(kCacheVersion));
+        return false;
+    }
+    in.setVersion(QDataStream::Qt_5_15);
+
+    qint64 savedAt = 0;
+    quint32 count = 0;
+    in >> savedAt >> count;
+    if (in.status() != QDataStream::Ok || count > kMaxCachedDevices) {
+        setError(error, QString("%1 is damaged.").arg(path));
+        return false;
+    }
+
+    devices.resize(count);
+    for (CachedDevice& device : devices) {
+        if (!readDevice(in, device)) {
+            devices.clear();
+            setError(error, QString("%1 is damaged.").arg(path));
+            return false;
+        }
+    }
+    if (savedAtMs) *savedAtMs = savedAt;
+    return trace.finish(true);
+}
+
+TopologyRevalidation TopologyCache::revalidate(DiskManager& diskManager, const std::vector<CachedDevice>& cached) {
+    Metrics::ScopedTrace trace("TopologyCache::revalidate");
+    TopologyRevalidation result;
+
+    QHash<QString, const CachedDevice*> byKey;
+    for (const CachedDevice& device : cached) {
+        byKey.insert(device.fingerprint.key(), &device);
+    }
+
+    QSet<QString> seen;
+    for (const QString& path : diskManager.listDevicePaths()) {
+        CachedDevice current;
+        current.fingerprint = fingerprint(path);
+        QString key = current.fingerprint.key();
+        const CachedDevice *previous = byKey.value(key, nullptr);
+        if (previous) seen.insert(key);
+
+        // A renamed device is rescanned too, every PartitionInfo carries the path
+        if (previous && previous->fingerprint.path == path && previous->fingerprint.sameContent(current.fingerprint)) {
+            current.info = previous->info;
+        } else {
+            bool found = false;
+            current.info = diskManager.scanDevice(path, &found);
+            if (!found) continue;
+            result.changed << path;
+            LOG_INFO("topology-cache", path, previous ? "Fingerprint changed, rescanned." : "New device, scanned.");
+        }
+        result.devices.push_back(current);
+    }
+
+    for (const CachedDevice& device : cached) {
+        if (!seen.contains(device.fingerprint.key())) {
+            result.removed << device.fingerprint.path;
+        }
+    }
+    return result;
+}
+
+std::vector<CachedDevice> TopologyCache::withFingerprints(const std::vector<DeviceInfo>& devices) {
+    std::vector<CachedDevice> result;
+    result.reserve(devices.size());
+    for (const DeviceInfo& info : devices) {
+        CachedDevice device;
+        device.fingerprint = fingerprint(info.path);
+        device.info = info;
+        result.push_back(device);
+    }
+    return result;
+}
@@ -0,0 +1,55 @@
+#ifndef TOPOLOGYCACHE_H
+#define TOPOLOGYCACHE_H
+
+#include "diskmanager.h"
+#include <QString>
+#include <QStringList>
+#include <QtGlobal>
+#include <vector>
+
+// Cheap identity and change detector of one device, computed from sysfs and
+// a few sectors instead of a libparted scan.
+struct DeviceFingerprint {
+    QString path;
+    QString serial;          // serial/wwid, backing file for loop devices
+    long long size = 0;      // bytes
+    QString labelId;         // "gpt:<disk guid>", "msdos:<disk signature>" or empty
+    quint64 contentHash = 0; // label sectors, kernel partition list and file system headers
+
+    // Identifies the device across reboots and renames (sdb -> sdc)
+    QString key() const;
+    bool sameContent(const DeviceFingerprint& other) const {
+        return key() == other.key() && contentHash == other.contentHash;
+    }
+};
+
+struct CachedDevice {
+    DeviceFingerprint fingerprint;
+    DeviceInfo info;
+};
+
+// Outcome of checking a cached topology against the hardware
+struct TopologyRevalidation {
+    std::vector<CachedDevice> devices; // current topology, in probe order
+    QStringList changed;               // rescanned because new or fingerprint differs
+    QStringList removed;               // in the cache but gone
+};
+
+// Versioned binary cache of the last scanned topology (QDataStream)
+class TopologyCache {
+public:
+    static DeviceFingerprint fingerprint(const QString& devicePath);
+
+    static QString defaultPath();
+    static bool save(const QString& path, const std::vector<CachedDevice>& devices, QString *error);
+    static bool load(const QString& path, std::vector<CachedDevice>& devices, qint64 *savedAtMs, QString *error);
+
+    // Fingerprints every device and only rescans those that differ from the
+    // cache. Runs libparted calls, so keep other disk operations off while
+    // it runs in the background.
+    static TopologyRevalidation revalidate(DiskManager& diskManager, const std::vector<CachedDevice>& cached);
+
+    static std::vector<CachedDevice> withFingerprints(const std::vector<DeviceInfo>& devices);
+};
+
+#endif // TOPOLOGYCACHE_H
@@ -0,0 +1,493 @@
+#include "topologyexport.h"
+#include "logger.h"
+#include "metrics.h"
+#include "topologycache.h"
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QThread>
+#include <csignal>
+
+namespace {
+
+const char kBinaryMagic[4] = {'P', 'X', 'T', 'E'};
+const quint8 kFormatVersion = 1;
+
+// Binary record kinds
+enum : quint8 {
+    RecordDevice = 1,
+    RecordSync,
+    RecordDeviceAdded,
+    RecordDeviceRemoved,
+    RecordDeviceChanged,
+    RecordPartitionAdded,
+    RecordPartitionRemoved,
+    RecordPartitionChanged
+};
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void requestStop(int) {
+    stopRequested = 1;
+}
+
+void setError(QString *error, const QString& message) {
+    if (error) *error = message;
+}
+
+long long lengthSectors(const PartitionInfo& part) {
+    return part.endSector - part.startSector + 1;
+}
+
+// Free space rows have no number, they are told apart by where they start
+QString partitionKey(const PartitionInfo& part) {
+    return part.isFreeSpace ? QString("free@%1").arg(part.startSector) : QString::number(part.number);
+}
+
+bool samePartition(const PartitionInfo& a, const PartitionInfo& b) {
+    return a.number == b.number && a.startSector == b.startSector && a.endSector == b.endSector
+        && a.type == b.type && a.fileSystem == b.fileSystem && a.flags == b.flags
+        && a.isFreeSpace == b.isFreeSpace && a.isExtendedContainer == b.isExtendedContainer
+        && a.isLogical == b.isLogical;
+}
+
+bool sameDevice(const DeviceInfo& a, const DeviceInfo& b) {
+    return a.model == b.model && a.size == b.size && a.sectorSize == b.sectorSize
+        && a.lengthSectors == b.lengthSectors && a.alignmentBytes == b.alignmentBytes
+        && a.alignmentOffsetBytes == b.alignmentOffsetBytes;
+}
+
+DeviceInfo withoutPartitions(const DeviceInfo& info) {
+    DeviceInfo device = info;
+    device.partitions.clear();
+    return device;
+}
+
+class JsonWriter : public TopologyWriter {
+public:
+    explicit JsonWriter(QIODevice *out) : TopologyWriter(out) {}
+
+    void begin(qint64 timeMs) override {
+        open("header", timeMs);
+        m_record += ",\"format\":\"parted-explorer-topology\",\"version\":";
+        m_record += QByteArray::number(kFormatVersion);
+        close();
+    }
+
+    void device(const DeviceInfo& info, qint64 timeMs) override {
+        open("device", timeMs);
+        m_record += ",\"device\":";
+        writeDevice(info, true);
+        close();
+    }
+
+    void sync(int deviceCount, qint64 timeMs) override {
+        open("sync", timeMs);
+        m_record += ",\"devices\":";
+        m_record += QByteArray::number(deviceCount);
+        close();
+    }
+
+    void change(const TopologyChange& change, qint64 timeMs) override {
+        switch (change.kind) {
+        case TopologyChange::DeviceAdded:
+        case TopologyChange::DeviceChanged:
+            open(change.kind == TopologyChange::DeviceAdded ? "device_added" : "device_changed", timeMs);
+            m_record += ",\"device\":";
+            writeDevice(change.device, change.kind == TopologyChange::DeviceAdded);
+            break;
+        case TopologyChange::DeviceRemoved:
+            open("device_removed", timeMs);
+            m_record += ",\"path\":";
+            writeString(change.devicePath);
+            break;
+        case TopologyChange::PartitionAdded:
+        case TopologyChange::PartitionRemoved:
+        case TopologyChange::PartitionChanged:
+            open(change.kind == TopologyChange::PartitionAdded ? "partition_added"
+                 : change.kind == TopologyChange::PartitionRemoved ? "partition_removed" : "partition_changed", timeMs);
+            m_record += ",\"path\":";
+            writeString(change.devicePath);
+            m_record += ",\"partition\":";
+            writePartition(change.partition, change.device.sectorSize);
+            break;
+        }
+        close();
+    }
+
+private:
+    void open(const char *record, qint64 timeMs) {
+        m_record.clear();
+        m_record += "{\"record\":\"";
+        m_record += record;
+        m_record += "\",\"time_ms\":";
+        m_record += QByteArray::number(timeMs);
+    }
+
+    void close() {
+        m_record += "}\n";
+        emitRecord();
+    }
+
+    void writeString(const QString& value) {
+        m_record += '"';
+        for (char c : value.toUtf8()) {
+            if (c == '"' || c == '\\') {
+                m_record += '\\';
+                m_record += c;
+            } else if ((unsigned char)c < 0x20) {
+                m_record += QString::asprintf("\\u%04x", (unsigned char)c).toLatin1();
+            } else {
+                m_record += c;
+            }
+        }
+        m_record += '"';
+    }
+
+    void writeField(const char *name, long long value) {
+        m_record += ",\"";
+        m_record += name;
+        m_record += "\":";
+        m_record += QByteArray::number(value);
+    }
+
+    void writeField(const char *name, bool value) {
+        m_record += ",\"";
+        m_record += name;
+        m_record += value ? "\":true" : "\":false";
+    }
+
+    void writeField(const char *name, const QString& value) {
+        m_record += ",\"";
+        m_record += name;
+        m_record += "\":";
+        writeString(value);
+    }
+
+    void writeDevice(const DeviceInfo& info, bool partitions) {
+        m_record += "{\"path\":";
+        writeString(info.path);
+        writeField("model", info.model);
+        writeField("sector_size", info.sectorSize);
+        writeField("length_sectors", info.lengthSectors);
+        writeField("size_bytes", info.size);
+        writeField("alignment_bytes", info.alignmentBytes);
+        writeField("alignment_offset_bytes", info.alignmentOffsetBytes);
+        if (partitions) {
+            m_record += ",\"partitions\":[";
+            for (size_t i = 0; i < info.partitions.size(); ++i) {
+                if (i > 0) m_record += ',';
+                writePartition(info.partitions[i], info.sectorSize);
+            }
+            m_record += ']';
+        }
+        m_record += '}';
+    }
+
+    void writePartition(const PartitionInfo& part, long long sectorSize) {
+        m_record += "{\"number\":";
+        m_record += QByteArray::number(part.number);
+        writeField("type", part.type);
+        writeField("filesystem", part.fileSystem);
+        m_record += ",\"flags\":[";
+        // getPartitionFlags() joins the names with ", "
+        const QStringList flags = part.flags.split(", ", Qt::SkipEmptyParts);
+        for (int i = 0; i < flags.size(); ++i) {
+            if (i > 0) m_record += ',';
+            writeString(flags[i]);
+        }
+        m_record += ']';
+        writeField("start_sector", part.startSector);
+        writeField("end_sector", part.endSector);
+        writeField("length_sectors", lengthSectors(part));
+        writeField("start_bytes", part.startSector * sectorSize);
+        writeField("size_bytes", lengthSectors(part) * sectorSize);
+        writeField("free_space", part.isFreeSpace);
+        writeField("extended", part.isExtendedContainer);
+        writeField("logical", part.isLogical);
+        m_record += '}';
+    }
+};
+
+class BinaryWriter : public TopologyWriter {
+public:
+    explicit BinaryWriter(QIODevice *out) : TopologyWriter(out) {}
+
+    void begin(qint64 timeMs) override {
+        m_record.clear();
+        m_record.append(kBinaryMagic, sizeof(kBinaryMagic));
+        m_record += char(kFormatVersion);
+        putVarint(m_record, quint64(timeMs));
+        m_lastTimeMs = timeMs;
+        emitRecord();
+    }
+
+    void device(const DeviceInfo& info, qint64 timeMs) override {
+        open(timeMs);
+        writeDevice(info, true);
+        close(RecordDevice);
+    }
+
+    void sync(int deviceCount, qint64 timeMs) override {
+        open(timeMs);
+        putVarint(m_payload, quint64(deviceCount));
+        close(RecordSync);
+    }
+
+    void change(const TopologyChange& change, qint64 timeMs) override {
+        open(timeMs);
+        switch (change.kind) {
+        case TopologyChange::DeviceAdded:
+            writeDevice(change.device, true);
+            close(RecordDeviceAdded);
+            break;
+        case TopologyChange::DeviceChanged:
+            writeDevice(change.device, false);
+            close(RecordDeviceChanged);
+            break;
+        case TopologyChange::DeviceRemoved:
+            putString(change.devicePath);
+            close(RecordDeviceRemoved);
+            break;
+        case TopologyChange::PartitionAdded:
+        case TopologyChange::PartitionRemoved:
+        case TopologyChange::PartitionChanged:
+            putString(change.devicePath);
+            writePartition(change.partition, 0);
+            close(change.kind == TopologyChange::PartitionAdded ? RecordPartitionAdded
+                  : change.kind == TopologyChange::PartitionRemoved ? RecordPartitionRemoved : RecordPartitionChanged);
+            break;
+        }
+    }
+
+private:
+    static void putVarint(QByteArray& out, quint64 value) {
+        while (value >= 0x80) {
+            out += char((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        out += char(value);
+    }
+
+    void putSigned(qint64 value) {
+        putVarint(m_payload, (quint64(value) << 1) ^ quint64(value >> 63));
+    }
+
+    void putString(const QString& value) {
+        QByteArray utf8 = value.toUtf8();
+        putVarint(m_payload, quint64(utf8.size()));
+        m_payload += utf8;
+    }
+
+    void open(qint64 timeMs) {
+        m_payload.clear();
+        // The clock may step back, hence signed
+        putSigned(timeMs - m_lastTimeMs);
+        m_lastTimeMs = timeMs;
+    }
+
+    void close(quint8 kind) {
+        m_record.clear();
+        m_record += char(kind);
+        putVarint(m_record, quint64(m_payload.size()));
+        m_record += m_payload;
+        emitRecord();
+    }
+
+    void writeDevice(const DeviceInfo& info, bool partitions) {
+        putString(info.path);
+        putString(info.model);
+        putVarint(m_payload, quint64(info.sectorSize));
+        putVarint(m_payload, quint64(info.lengthSectors));
+        putVarint(m_payload, quint64(info.alignmentBytes));
+        putVarint(m_payload, quint64(info.alignmentOffsetBytes));
+        if (!partitions) {
+            putVarint(m_payload, 0);
+            return;
+        }
+        putVarint(m_payload, quint64(info.partitions.size()));
+        // Rows mostly follow each other, so the starts shrink to a byte or
+        // two. Logical partitions start before the end of their container.
+        long long next = 0;
+        for (const PartitionInfo& part : info.partitions) {
+            writePartition(part, next);
+            next = part.endSector + 1;
+        }
+    }
+
+    void writePartition(const PartitionInfo& part, long long base) {
+        putSigned(part.number);
+        putString(part.type);
+        putString(part.fileSystem);
+        putString(part.flags);
+        putSigned(part.startSector - base);
+        putVarint(m_payload, quint64(lengthSectors(part)));
+        m_payload += char((part.isFreeSpace ? 1 : 0) | (part.isExtendedContainer ? 2 : 0) | (part.isLogical ? 4 : 0));
+    }
+
+    QByteArray m_payload;
+    qint64 m_lastTimeMs = 0;
+};
+
+} // namespace
+
+void TopologyWriter::emitRecord() {
+    if (m_failed) return;
+    if (m_out->write(m_record) != m_record.size()) {
+        m_failed = true;
+        LOG_WARNING("topology-export", QString(), QString("Write failed: %1").arg(m_out->errorString()));
+    }
+}
+
+bool TopologyWriter::parseFormat(const QString& name, Format *format) {
+    if (name.compare("json", Qt::CaseInsensitive) == 0) {
+        *format = Json;
+    } else if (name.compare("binary", Qt::CaseInsensitive) == 0) {
+        *format = Binary;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<TopologyWriter> TopologyWriter::create(Format format, QIODevice *out) {
+    if (format == Binary) return std::unique_ptr<TopologyWriter>(new BinaryWriter(out));
+    return std::unique_ptr<TopologyWriter>(new JsonWriter(out));
+}
+
+std::vector<TopologyChange> TopologyExport::diff(const DeviceInfo& before, const DeviceInfo& after) {
+    std::vector<TopologyChange> changes;
+    TopologyChange change;
+    change.devicePath = after.path;
+    change.device = withoutPartitions(after);
+
+    if (!sameDevice(before, after)) {
+        change.kind = TopologyChange::DeviceChanged;
+        changes.push_back(change);
+    }
+
+    QHash<QString, const PartitionInfo*> previous;
+    for (const PartitionInfo& part : before.partitions) {
+        previous.insert(partitionKey(part), &part);
+    }
+    QSet<QString> kept;
+    for (const PartitionInfo& part : after.partitions) {
+        kept.insert(partitionKey(part));
+    }
+
+    // Removals first, a reused number then reads as remove + add
+    for (const PartitionInfo& part : before.partitions) {
+        if (kept.contains(partitionKey(part))) continue;
+        change.kind = TopologyChange::PartitionRemoved;
+        change.partition = part;
+        changes.push_back(change);
+    }
+    for (const PartitionInfo& part : after.partitions) {
+        const PartitionInfo *old = previous.value(partitionKey(part), nullptr);
+        if (old && samePartition(*old, part)) continue;
+        change.kind = old ? TopologyChange::PartitionChanged : TopologyChange::PartitionAdded;
+        change.partition = part;
+        changes.push_back(change);
+    }
+    return changes;
+}
+
+bool TopologyExport::run(DiskManager& diskManager, QIODevice *out, const TopologyExportOptions& options, QString *error) {
+    // A reader closing the pipe (e.g. "| head -1") must fail the write with
+    // EPIPE instead of killing the process before metrics and log are flushed
+    void (*previousPipeHandler)(int) = std::signal(SIGPIPE, SIG_IGN);
+
+    std::unique_ptr<TopologyWriter> writer = TopologyWriter::create(options.format, out);
+    writer->begin(QDateTime::currentMSecsSinceEpoch());
+
+    if (options.watchIntervalMs <= 0) {
+        std::vector<DeviceInfo> devices = diskManager.listAllDevices();
+        qint64 now = QDateTime::currentMSecsSinceEpoch();
+        for (const DeviceInfo& info : devices) {
+            writer->device(info, now);
+        }
+        writer->sync(int(devices.size()), now);
+        std::signal(SIGPIPE, previousPipeHandler);
+        if (!writer->ok()) setError(error, QString("Failed to write the topology: %1").arg(out->errorString()));
+        return writer->ok();
+    }
+
+    // The fingerprints decide what to rescan, the first pass scans everything
+    std::vector<CachedDevice> current = TopologyCache::revalidate(diskManager, {}).devices;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (const CachedDevice& device : current) {
+        writer->device(device.info, now);
+    }
+    writer->sync(int(current.size()), now);
+
+    stopRequested = 0;
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    while (writer->ok() && !stopRequested) {
+        QElapsedTimer slept;
+        slept.start();
+        while (!stopRequested && slept.elapsed() < options.watchIntervalMs) {
+            QThread::msleep(qMin<qint64>(100, options.watchIntervalMs - slept.elapsed()));
+        }
+        if (stopRequested) break;
+
+        Metrics::ScopedTrace trace("TopologyExport::poll");
+        TopologyRevalidation revalidation = TopologyCache::revalidate(diskManager, current);
+        now = QDateTime::currentMSecsSinceEpoch();
+
+        QHash<QString, const DeviceInfo*> before;
+        for (const CachedDevice& device : current) {
+            before.insert(device.info.path, &device.info);
+        }
+        QSet<QString> present;
+        for (const CachedDevice& device : revalidation.devices) {
+            present.insert(device.info.path);
+        }
+
+        int records = 0;
+        // By path, a renamed device is removed under the old and added under the new name
+        for (const CachedDevice& device : current) {
+            if (present.contains(device.info.path)) continue;
+            TopologyChange change;
+            change.kind = TopologyChange::DeviceRemoved;
+            change.devicePath = device.info.path;
+            writer->change(change, now);
+            ++records;
+        }
+        for (const CachedDevice& device : revalidation.devices) {
+            if (!revalidation.changed.contains(device.info.path)) continue;
+            const DeviceInfo *previous = before.value(device.info.path, nullptr);
+            if (!previous) {
+                TopologyChange change;
+                change.kind = TopologyChange::DeviceAdded;
+                change.devicePath = device.info.path;
+                change.device = device.info;
+                writer->change(change, now);
+                ++records;
+                continue;
+            }
+            // The fingerprint also covers sectors the scan does not report
+            // (file system contents), so a rescan may find nothing to emit
+            for (const TopologyChange& change : diff(*previous, device.info)) {
+                writer->change(change, now);
+                ++records;
+            }
+        }
+        if (records > 0) {
+            writer->sync(int(revalidation.devices.size()), now);
+        }
+        current = std::move(revalidation.devices);
+    }
+
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    std::signal(SIGPIPE, previousPipeHandler);
+    if (!writer->ok()) {
+        setError(error, QString("Failed to write the topology: %1").arg(out->errorString()));
+        return false;
+    }
+    return true;
+}
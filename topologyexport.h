@@ -0,0 +1,88 @@
+#ifndef TOPOLOGYEXPORT_H
+#define TOPOLOGYEXPORT_H
+
+#include "diskmanager.h"
+#include <QByteArray>
+#include <QIODevice>
+#include <QString>
+#include <QtGlobal>
+#include <memory>
+#include <vector>
+
+// One incremental record of the watch stream
+struct TopologyChange {
+    enum Kind {
+        DeviceAdded,      // 'device' with all partitions
+        DeviceRemoved,    // only 'devicePath'
+        DeviceChanged,    // model, size, sector size or alignment
+        PartitionAdded,
+        PartitionRemoved, // 'partition' as it was
+        PartitionChanged  // 'partition' as it is now
+    };
+    Kind kind = DeviceChanged;
+    QString devicePath;
+    DeviceInfo device;       // partitions only filled for DeviceAdded
+    PartitionInfo partition;
+};
+
+// Streaming serializer of the topology. Every record goes to the device as
+// soon as it is complete, nothing else is buffered.
+//
+// Json: one object per line (JSON Lines):
+//   {"record":"header","time_ms":...,"format":"parted-explorer-topology","version":1}
+//   {"record":"device","time_ms":...,"device":{...,"partitions":[...]}}
+//   {"record":"sync","time_ms":...,"devices":N}  snapshot complete
+//   {"record":"partition_changed","time_ms":...,"path":"/dev/sda","partition":{...}}
+//
+// Binary: "PXTE", version byte, then records of
+//   [kind byte][varint payload length][payload]
+// so readers can skip kinds they do not know. Integers are LEB128 varints
+// (signed ones zigzag encoded), strings a varint length plus UTF-8. Every
+// payload starts with the time in ms since the previous record (the header
+// holds the absolute time). Geometry is in sectors only; inside a device
+// record partition starts are relative to the end of the previous one.
+class TopologyWriter {
+public:
+    enum Format { Json, Binary };
+
+    virtual ~TopologyWriter() = default;
+
+    static bool parseFormat(const QString& name, Format *format);
+    static std::unique_ptr<TopologyWriter> create(Format format, QIODevice *out);
+
+    virtual void begin(qint64 timeMs) = 0;
+    virtual void device(const DeviceInfo& info, qint64 timeMs) = 0;
+    // Ends the initial snapshot, or a batch of changes in watch mode
+    virtual void sync(int deviceCount, qint64 timeMs) = 0;
+    virtual void change(const TopologyChange& change, qint64 timeMs) = 0;
+
+    // False once a write failed (closed pipe, full disk)
+    bool ok() const { return !m_failed; }
+
+protected:
+    explicit TopologyWriter(QIODevice *out) : m_out(out) {}
+    void emitRecord();
+
+    QIODevice *m_out;
+    QByteArray m_record; // reused for every record
+    bool m_failed = false;
+};
+
+struct TopologyExportOptions {
+    TopologyWriter::Format format = TopologyWriter::Json;
+    int watchIntervalMs = 0; // 0 writes one snapshot and returns
+};
+
+class TopologyExport {
+public:
+    // Partition and device level differences between two scans of one device
+    static std::vector<TopologyChange> diff(const DeviceInfo& before, const DeviceInfo& after);
+
+    // Writes the snapshot and, when watching, polls the fingerprints every
+    // interval and rescans only the devices whose fingerprint changed.
+    // Watching stops on SIGINT/SIGTERM or when the output fails; SIGPIPE is
+    // ignored meanwhile so a closed pipe is a write error, not a kill.
+    static bool run(DiskManager& diskManager, QIODevice *out, const TopologyExportOptions& options, QString *error);
+};
+
+#endif // TOPOLOGYEXPORT_H
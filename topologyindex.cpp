@@ -0,0 +1,217 @@
+#include "topologyindex.h"
+#include "devicefilter.h"
+#include <fnmatch.h>
+
+namespace {
+
+void setError(QString *error, const QString& message) {
+    if (error) *error = message;
+}
+
+void post(QHash<QString, RowSet>& postings, const QString& value, int row, int rowCount) {
+    if (value.isEmpty()) return;
+    RowSet& rows = postings[value];
+    if (rows.size() == 0) rows = RowSet(rowCount);
+    rows.set(row);
+}
+
+bool isGlob(const QString& value) {
+    return value.contains('*') || value.contains('?') || value.contains('[');
+}
+
+// Splits on spaces outside double quotes and drops the quotes
+QStringList tokenize(const QString& expression) {
+    QStringList terms;
+    QString current;
+    bool quoted = false;
+    for (QChar c : expression) {
+        if (c == '"') {
+            quoted = !quoted;
+        } else if (c.isSpace() && !quoted) {
+            if (!current.isEmpty()) terms << current;
+            current.clear();
+        } else {
+            current += c;
+        }
+    }
+    if (!current.isEmpty()) terms << current;
+    return terms;
+}
+
+} // namespace
+
+RowSet::RowSet(int size, bool value) : m_words((size + 63) / 64, value ? ~quint64(0) : 0), m_size(size) {
+    clearTail();
+}
+
+int RowSet::count() const {
+    int total = 0;
+    for (quint64 word : m_words) {
+        total += __builtin_popcountll(word);
+    }
+    return total;
+}
+
+RowSet& RowSet::operator&=(const RowSet& other) {
+    for (size_t i = 0; i < m_words.size(); ++i) {
+        m_words[i] &= other.m_words[i];
+    }
+    return *this;
+}
+
+RowSet& RowSet::operator|=(const RowSet& other) {
+    for (size_t i = 0; i < m_words.size(); ++i) {
+        m_words[i] |= other.m_words[i];
+    }
+    return *this;
+}
+
+void RowSet::invert() {
+    for (quint64& word : m_words) {
+        word = ~word;
+    }
+    clearTail();
+}
+
+void RowSet::clearTail() {
+    if (m_size % 64) m_words.back() &= (quint64(1) << (m_size % 64)) - 1;
+}
+
+void TopologyIndex::build(const std::vector<DeviceInfo>& devices) {
+    m_rows.clear();
+    for (int d = 0; d < (int)devices.size(); ++d) {
+        m_rows.push_back({d, -1});
+        for (int p = 0; p < (int)devices[d].partitions.size(); ++p) {
+            m_rows.push_back({d, p});
+        }
+    }
+
+    const int rowCount = (int)m_rows.size();
+    m_sizes.assign(rowCount, 0);
+    m_fileSystems.clear();
+    m_flags.clear();
+    m_types.clear();
+    m_models.clear();
+    m_paths.clear();
+    m_free = RowSet(rowCount);
+
+    for (int r = 0; r < rowCount; ++r) {
+        const DeviceInfo& device = devices[m_rows[r].device];
+        // Partitions inherit model and path, so model:x finds them too
+        post(m_models, device.model.toLower(), r, rowCount);
+        post(m_paths, device.path.toLower(), r, rowCount);
+
+        if (m_rows[r].partition < 0) {
+            m_sizes[r] = device.size;
+            post(m_types, "disk", r, rowCount);
+            continue;
+        }
+
+        const PartitionInfo& part = device.partitions[m_rows[r].partition];
+        m_sizes[r] = part.size;
+        post(m_types, part.type.toLower(), r, rowCount);
+        if (part.isFreeSpace) {
+            m_free.set(r);
+            continue;
+        }
+        if (part.fileSystem != "Unknown/None") post(m_fileSystems, part.fileSystem.toLower(), r, rowCount);
+        for (const QString& flag : part.flags.split(',', Qt::SkipEmptyParts)) {
+            post(m_flags, flag.trimmed().toLower(), r, rowCount);
+        }
+    }
+}
+
+RowSet TopologyIndex::matchPostings(const Postings& postings, const QString& value, bool substring) const {
+    RowSet rows(rowCount());
+    if (!isGlob(value) && !substring) {
+        auto it = postings.constFind(value);
+        if (it != postings.constEnd()) rows |= it.value();
+        return rows;
+    }
+
+    QByteArray pattern = value.toUtf8();
+    for (auto it = postings.constBegin(); it != postings.constEnd(); ++it) {
+        bool matched = isGlob(value) ? fnmatch(pattern.constData(), it.key().toUtf8().constData(), 0) == 0
+                                     : it.key().contains(value);
+        if (matched) rows |= it.value();
+    }
+    return rows;
+}
+
+RowSet TopologyIndex::matchSize(const QString& op, qint64 bytes) const {
+    RowSet rows(rowCount());
+    for (int r = 0; r < rowCount(); ++r) {
+        qint64 size = m_sizes[r];
+        bool matched = op == ">"    ? size > bytes
+                     : op == ">="   ? size >= bytes
+                     : op == "<"    ? size < bytes
+                     : op == "<="   ? size <= bytes
+                                    : size == bytes;
+        if (matched) rows.set(r);
+    }
+    return rows;
+}
+
+bool TopologyIndex::evaluateTerm(const QString& term, RowSet *rows, QString *error) const {
+    if (term.startsWith("size") && term.size() > 4 && QString(":<>=").contains(term[4])) {
+        QString rest = term.mid(4);
+        if (rest.startsWith(':')) rest = rest.mid(1);
+        QString op = rest.startsWith(">=") || rest.startsWith("<=") ? rest.left(2)
+                   : rest.startsWith('>') || rest.startsWith('<') || rest.startsWith('=') ? rest.left(1)
+                                                                                          : QString();
+        qint64 bytes;
+        if (op.isEmpty() || !DeviceFilter::parseSize(rest.mid(op.size()), &bytes)) {
+            setError(error, QString("Invalid size condition '%1', e.g. size>100G.").arg(term));
+            return false;
+        }
+        *rows = matchSize(op, bytes);
+        return true;
+    }
+
+    QString lower = term.toLower();
+    if (lower == "free") {
+        *rows = m_free;
+        return true;
+    }
+
+    int colon = lower.indexOf(':');
+    if (colon < 0) {
+        // Bare word: any text field
+        *rows = matchPostings(m_fileSystems, lower, true);
+        for (const Postings *postings : {&m_flags, &m_types, &m_models, &m_paths}) {
+            *rows |= matchPostings(*postings, lower, true);
+        }
+        return true;
+    }
+
+    QString key = lower.left(colon);
+    QString value = lower.mid(colon + 1);
+    if (key == "fs") {
+        *rows = matchPostings(m_fileSystems, value, false);
+    } else if (key == "flag") {
+        *rows = matchPostings(m_flags, value, false);
+    } else if (key == "type") {
+        *rows = matchPostings(m_types, value, false);
+    } else if (key == "model") {
+        *rows = matchPostings(m_models, value, true);
+    } else if (key == "path" || key == "dev") {
+        *rows = matchPostings(m_paths, value, true);
+    } else {
+        setError(error, QString("Unknown field '%1', use fs, flag, type, model, path or size.").arg(key));
+        return false;
+    }
+    return true;
+}
+
+bool TopologyIndex::query(const QString& expression, RowSet *matches, QString *error) const {
+    RowSet result(rowCount(), true);
+    for (const QString& token : tokenize(expression)) {
+        bool negate = token.startsWith('-') && token.size() > 1;
+        RowSet rows;
+        if (!evaluateTerm(negate ? token.mid(1) : token, &rows, error)) return false;
+        if (negate) rows.invert();
+        result &= rows;
+    }
+    *matches = result;
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef TOPOLOGYINDEX_H
+#define TOPOLOGYINDEX_H
+
+#include "diskmanager.h"
+#include <QHash>
+#include <QString>
+#include <QtGlobal>
+#include <vector>
+
+// Fixed-size set of row numbers, one bit per row
+class RowSet {
+public:
+    RowSet() {}
+    explicit RowSet(int size, bool value = false);
+
+    int size() const { return m_size; }
+    bool test(int row) const { return (m_words[row >> 6] >> (row & 63)) & 1; }
+    void set(int row) { m_words[row >> 6] |= quint64(1) << (row & 63); }
+    int count() const;
+
+    RowSet& operator&=(const RowSet& other);
+    RowSet& operator|=(const RowSet& other);
+    void invert();
+
+private:
+    void clearTail();
+
+    std::vector<quint64> m_words;
+    int m_size = 0;
+};
+
+// In-memory index over a scanned topology: one row per device followed by
+// one row per entry of its partition list, in the order of listAllDevices().
+// Text fields are kept as posting sets per distinct value, so a query
+// touches the few distinct file systems/flags/models instead of every row.
+//
+// Query language: terms separated by spaces, all of them must match;
+// a leading '-' negates a term, double quotes keep spaces in a value.
+//   fs:ext4 flag:boot type:logical   exact, or a glob (fs:ext*)
+//   model:samsung path:nvme          substring, or a glob (path:/dev/sd?)
+//   size>100G size<=2T size=512M     comparisons, K/M/G/T suffixes
+//   free                             free space rows
+//   anything else                    substring of any of the fields above
+class TopologyIndex {
+public:
+    struct Row {
+        int device = 0;
+        int partition = -1; // index into DeviceInfo::partitions, -1 for the device row
+    };
+
+    void build(const std::vector<DeviceInfo>& devices);
+
+    int rowCount() const { return (int)m_rows.size(); }
+    const Row& row(int index) const { return m_rows[index]; }
+
+    // Rows matching the expression; an empty expression matches everything
+    bool query(const QString& expression, RowSet *matches, QString *error) const;
+
+private:
+    typedef QHash<QString, RowSet> Postings; // lower-case value -> rows
+
+    bool evaluateTerm(const QString& term, RowSet *rows, QString *error) const;
+    RowSet matchPostings(const Postings& postings, const QString& value, bool substring) const;
+    RowSet matchSize(const QString& op, qint64 bytes) const;
+
+    std::vector<Row> m_rows;
+    std::vector<qint64> m_sizes;
+    Postings m_fileSystems;
+    Postings m_flags;
+    Postings m_types;
+    Postings m_models;
+    Postings m_paths;
+    RowSet m_free;
+};
+
+#endif // TOPOLOGYINDEX_H